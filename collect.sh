@@ -0,0 +1,266 @@
+#!/bin/bash
+#
+# ESP32 WiFi Bridge - Fleet Metrics Collector
+#
+# Discovers every bridge via mDNS (using deploy.sh --discover), scrapes their status
+# and request APIs concurrently and prints one fleet-wide table or a Prometheus
+# exposition. Devices that stand out from the fleet median are flagged.
+#
+
+# Configuration
+OTA_PORT=8080
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+
+# Outlier thresholds (relative to the fleet median)
+TTFB_OUTLIER_FACTOR=2       # avg TTFB above 2x median
+TTFB_OUTLIER_MIN_MS=50      # ...and at least this many ms
+HEAP_OUTLIER_PCT=75         # free heap below 75% of median
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+print_status() { echo -e "${BLUE}[*]${NC} $1" >&2; }
+print_warning() { echo -e "${YELLOW}[!]${NC} $1" >&2; }
+print_error() { echo -e "${RED}[✗]${NC} $1" >&2; }
+
+usage() {
+    echo "Usage: $0 [OPTIONS]"
+    echo ""
+    echo "Options:"
+    echo "  -i, --ip LIST        Comma-separated IPs instead of mDNS discovery"
+    echo "  -p, --prometheus     Print Prometheus exposition format instead of a table"
+    echo "  -o, --output FILE    Write output to FILE (e.g. node_exporter textfile dir)"
+    echo "  -h, --help           Show this help message"
+    echo ""
+    echo "Examples:"
+    echo "  $0                                   # Table for all discovered bridges"
+    echo "  $0 -p -o /var/lib/node_exporter/powerwall_bridge.prom"
+    echo "  $0 -i 192.168.1.100,192.168.1.101"
+}
+
+PROMETHEUS=false
+OUTPUT=""
+DEVICE_IPS=""
+
+while [[ $# -gt 0 ]]; do
+    case $1 in
+        -i|--ip)
+            DEVICE_IPS="${2//,/ }"
+            shift 2
+            ;;
+        -p|--prometheus)
+            PROMETHEUS=true
+            shift
+            ;;
+        -o|--output)
+            OUTPUT="$2"
+            shift 2
+            ;;
+        -h|--help)
+            usage
+            exit 0
+            ;;
+        *)
+            print_error "Unknown option: $1"
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+# Extract a scalar JSON field (first match) - numbers, booleans or strings
+json_field() {
+    echo "$1" | grep -oE "\"$2\":(\"[^\"]*\"|-?[0-9]+|true|false)" | head -1 | cut -d: -f2- | tr -d '"'
+}
+
+# Scrape one device; writes "IP|HOST|UP|VERSION|UPTIME|RSSI|CPU|HEAP|ACTIVE|REJECTED|AVG_TTFB|ERRORS|REACHABLE"
+scrape_device() {
+    local ip="$1"
+    local host="$2"
+    local result_file="$3"
+
+    local status requests
+    status=$(curl -s --connect-timeout 3 --max-time 5 "http://${ip}:${OTA_PORT}/api/status" 2>/dev/null)
+    requests=$(curl -s --connect-timeout 3 --max-time 5 "http://${ip}:${OTA_PORT}/api/requests" 2>/dev/null)
+
+    if [[ -z "$status" ]]; then
+        echo "${ip}|${host}|0|-|0|0|0|0|0|0|0|0|false" > "$result_file"
+        return
+    fi
+
+    local version uptime rssi cpu heap active rejected ttfb errors reachable
+    version=$(json_field "$status" version)
+    uptime=$(json_field "$status" uptime)
+    rssi=$(json_field "$status" rssi)
+    cpu=$(json_field "$status" cpu)
+    heap=$(json_field "$status" heap)
+    active=$(json_field "$status" active)
+    rejected=$(json_field "$status" rejected)
+    reachable=$(json_field "$status" reachable)
+    ttfb=$(json_field "$requests" avg_ttfb)
+    errors=$(echo "$requests" | grep -oE '"ok":0' | wc -l | tr -d ' ')
+
+    # Older firmware lacks some fields - report them as 0
+    echo "${ip}|${host}|1|${version:--}|${uptime:-0}|${rssi:-0}|${cpu:-0}|${heap:-0}|${active:-0}|${rejected:-0}|${ttfb:-0}|${errors:-0}|${reachable:-false}" > "$result_file"
+}
+
+# Median of numbers on stdin
+median() {
+    sort -n | awk '{v[NR]=$1} END {if (NR == 0) print 0; else if (NR % 2) print v[(NR+1)/2]; else print int((v[NR/2]+v[NR/2+1])/2)}'
+}
+
+# Outlier flags for one result line given fleet medians
+outlier_flags() {
+    local line="$1" med_ttfb="$2" med_rejected="$3" med_heap="$4"
+    local ip host up version uptime rssi cpu heap active rejected ttfb errors reachable
+    IFS='|' read -r ip host up version uptime rssi cpu heap active rejected ttfb errors reachable <<< "$line"
+
+    local flags=""
+    if [[ "$up" != "1" ]]; then
+        echo "down"
+        return
+    fi
+    if [[ "$ttfb" -gt $((med_ttfb * TTFB_OUTLIER_FACTOR)) ]] && [[ "$ttfb" -ge "$TTFB_OUTLIER_MIN_MS" ]]; then
+        flags+="ttfb "
+    fi
+    if [[ "$rejected" -gt 0 ]] && [[ "$rejected" -gt $((med_rejected * 2)) ]]; then
+        flags+="rejects "
+    fi
+    if [[ "$heap" -lt $((med_heap * HEAP_OUTLIER_PCT / 100)) ]]; then
+        flags+="heap "
+    fi
+    [[ "$reachable" != "true" ]] && flags+="powerwall "
+    echo "${flags% }"
+}
+
+print_table() {
+    local results="$1" med_ttfb="$2" med_rejected="$3" med_heap="$4"
+
+    printf "%-15s  %-16s  %-14s  %7s  %5s  %4s  %7s  %6s  %8s  %5s  %4s  %s\n" \
+        "IP" "HOSTNAME" "VERSION" "UPTIME" "RSSI" "CPU" "HEAP_KB" "ACTIVE" "REJECTED" "TTFB" "ERR" "FLAGS"
+    while IFS= read -r line; do
+        [[ -z "$line" ]] && continue
+        local ip host up version uptime rssi cpu heap active rejected ttfb errors reachable
+        IFS='|' read -r ip host up version uptime rssi cpu heap active rejected ttfb errors reachable <<< "$line"
+        local flags
+        flags=$(outlier_flags "$line" "$med_ttfb" "$med_rejected" "$med_heap")
+        local color="$GREEN"
+        [[ -n "$flags" ]] && color="$RED"
+        printf "%-15s  %-16s  %-14s  %6ss  %5s  %3s%%  %7s  %6s  %8s  %5s  %4s  ${color}%s${NC}\n" \
+            "$ip" "$host" "$version" "$uptime" "$rssi" "$cpu" "$((heap / 1024))" "$active" "$rejected" "$ttfb" "$errors" "${flags:-ok}"
+    done <<< "$results"
+    echo ""
+    echo "Fleet median: TTFB ${med_ttfb} ms, rejected ${med_rejected}, heap $((med_heap / 1024)) KB"
+}
+
+print_prometheus() {
+    local results="$1" med_ttfb="$2" med_rejected="$3" med_heap="$4"
+
+    # metric name|type|help|field index (1-based in the result line)
+    local metrics=(
+        "powerwall_bridge_up|gauge|Bridge answered the status API|3"
+        "powerwall_bridge_uptime_seconds|counter|Seconds since boot|5"
+        "powerwall_bridge_wifi_rssi_dbm|gauge|WiFi signal strength|6"
+        "powerwall_bridge_cpu_percent|gauge|CPU usage|7"
+        "powerwall_bridge_heap_free_bytes|gauge|Free heap|8"
+        "powerwall_bridge_connections_active|gauge|Proxied connections in flight|9"
+        "powerwall_bridge_connections_rejected_total|counter|Connections refused for lack of slots|10"
+        "powerwall_bridge_ttfb_avg_ms|gauge|Average time to first byte from the Powerwall|11"
+        "powerwall_bridge_recent_errors|gauge|Failed exchanges in the recent request log|12"
+    )
+
+    for metric in "${metrics[@]}"; do
+        local name type help idx
+        IFS='|' read -r name type help idx <<< "$metric"
+        echo "# HELP ${name} ${help}"
+        echo "# TYPE ${name} ${type}"
+        while IFS= read -r line; do
+            [[ -z "$line" ]] && continue
+            local ip host version value
+            ip=$(echo "$line" | cut -d'|' -f1)
+            host=$(echo "$line" | cut -d'|' -f2)
+            version=$(echo "$line" | cut -d'|' -f4)
+            value=$(echo "$line" | cut -d'|' -f"$idx")
+            echo "${name}{instance=\"${ip}\",host=\"${host}\",version=\"${version}\"} ${value:-0}"
+        done <<< "$results"
+    done
+
+    echo "# HELP powerwall_bridge_outlier Bridge deviates from the fleet median (1 per flagged reason)"
+    echo "# TYPE powerwall_bridge_outlier gauge"
+    while IFS= read -r line; do
+        [[ -z "$line" ]] && continue
+        local ip host flags
+        ip=$(echo "$line" | cut -d'|' -f1)
+        host=$(echo "$line" | cut -d'|' -f2)
+        flags=$(outlier_flags "$line" "$med_ttfb" "$med_rejected" "$med_heap")
+        for reason in ttfb rejects heap powerwall down; do
+            local v=0
+            [[ " $flags " == *" $reason "* ]] && v=1
+            echo "powerwall_bridge_outlier{instance=\"${ip}\",host=\"${host}\",reason=\"${reason}\"} ${v}"
+        done
+    done <<< "$results"
+}
+
+main() {
+    # Build "IP|HOSTNAME" list
+    local targets=""
+    if [[ -n "$DEVICE_IPS" ]]; then
+        for ip in $DEVICE_IPS; do
+            targets+="${ip}|${ip}"$'\n'
+        done
+    else
+        local devices
+        devices=$("${SCRIPT_DIR}/deploy.sh" --discover)
+        while IFS='|' read -r ip hostname wifi_ssid target ota_port; do
+            [[ -z "$ip" ]] && continue
+            targets+="${ip}|${hostname}"$'\n'
+        done <<< "$devices"
+    fi
+
+    if [[ -z "$targets" ]]; then
+        print_error "No bridges discovered"
+        exit 1
+    fi
+
+    # Scrape all devices concurrently
+    local results_dir=$(mktemp -d)
+    local count=0
+    while IFS='|' read -r ip host; do
+        [[ -z "$ip" ]] && continue
+        scrape_device "$ip" "$host" "$results_dir/$ip" &
+        ((count++))
+    done <<< "$targets"
+    print_status "Scraping ${count} bridge(s)..."
+    wait
+
+    local results
+    results=$(cat "$results_dir"/* 2>/dev/null | sort -t'|' -k1,1)
+    rm -rf "$results_dir"
+
+    # Fleet medians over devices that responded
+    local up_results med_ttfb med_rejected med_heap
+    up_results=$(echo "$results" | awk -F'|' '$3 == 1')
+    med_ttfb=$(echo "$up_results" | cut -d'|' -f11 | median)
+    med_rejected=$(echo "$up_results" | cut -d'|' -f10 | median)
+    med_heap=$(echo "$up_results" | cut -d'|' -f8 | median)
+
+    local out
+    if [[ "$PROMETHEUS" == true ]]; then
+        out=$(print_prometheus "$results" "$med_ttfb" "$med_rejected" "$med_heap")
+    else
+        out=$(print_table "$results" "$med_ttfb" "$med_rejected" "$med_heap")
+    fi
+
+    if [[ -n "$OUTPUT" ]]; then
+        # Write atomically so scrapers never see a partial file
+        echo "$out" | sed 's/\x1b\[[0-9;]*m//g' > "${OUTPUT}.tmp" && mv "${OUTPUT}.tmp" "$OUTPUT"
+    else
+        echo -e "$out"
+    fi
+}
+
+main
@@ -13,6 +13,7 @@ MDNS_HOSTNAME="powerwall"
 OTA_PORT=8080
 FIRMWARE_PATH=".pio/build/esp32-s3-devkitc-1/firmware.bin"
 TIMEOUT=10
+FLEET_JOBS=3
 
 # Colors for output
 RED='\033[0;31m'
@@ -34,6 +35,10 @@ usage() {
     echo "  -d, --deploy-only    Only deploy (skip build)"
     echo "  -i, --ip ADDRESS     Use specific IP instead of mDNS discovery"
     echo "  -a, --all            Deploy to ALL eligible devices (no prompt)"
+    echo "  -f, --fleet          Parallel rollout to all eligible devices (canary first)"
+    echo "  -j, --jobs N         Max parallel uploads in fleet mode (default: ${FLEET_JOBS})"
+    echo "      --no-canary      Fleet mode without a canary device"
+    echo "      --discover       Print discovered devices (IP|HOSTNAME|WIFI_SSID|TARGET|OTA_PORT) and exit"
     echo "  -h, --help           Show this help message"
     echo ""
     echo "Examples:"
@@ -42,12 +47,16 @@ usage() {
     echo "  $0 -b                # Build only"
     echo "  $0 -d -i 10.0.0.50   # Deploy only to specific IP"
     echo "  $0 -a                # Build and deploy to all eligible devices"
+    echo "  $0 -f -j 4           # Build and roll out to the fleet, 4 at a time"
 }
 
 # Parse arguments
 BUILD=true
 DEPLOY=true
 DEPLOY_ALL=false
+FLEET=false
+CANARY=true
+DISCOVER_ONLY=false
 DEVICE_IP=""
 
 while [[ $# -gt 0 ]]; do
@@ -68,6 +77,22 @@ while [[ $# -gt 0 ]]; do
             DEPLOY_ALL=true
             shift
             ;;
+        -f|--fleet)
+            FLEET=true
+            shift
+            ;;
+        -j|--jobs)
+            FLEET_JOBS="$2"
+            shift 2
+            ;;
+        --no-canary)
+            CANARY=false
+            shift
+            ;;
+        --discover)
+            DISCOVER_ONLY=true
+            shift
+            ;;
         -h|--help)
             usage
             exit 0
@@ -405,8 +430,158 @@ deploy_firmware() {
     fi
 }
 
+# Read the app version embedded in the firmware image
+# (esp_app_desc_t follows the 24-byte image header and 8-byte segment header; version is at +16)
+firmware_version() {
+    dd if="$FIRMWARE_PATH" bs=1 skip=48 count=32 2>/dev/null | tr -d '\0'
+}
+
+# Read the running firmware version from a device's /api/status
+device_version() {
+    local ip="$1"
+    curl -s --connect-timeout 2 --max-time 5 "http://${ip}:${OTA_PORT}/api/status" 2>/dev/null \
+        | grep -oE '"version":"[^"]*"' | cut -d'"' -f4
+}
+
+# Upload to one device and verify the new version (no interactive output)
+# Writes "IP|STATUS|UPLOAD_S|REBOOT_S|TOTAL_S|VERSION" to the result file
+fleet_deploy_device() {
+    local ip="$1"
+    local result_file="$2"
+    local expected="$3"
+    local start=$(date +%s)
+
+    if ! curl -s --connect-timeout 5 "http://${ip}:${OTA_PORT}/" > /dev/null; then
+        echo "${ip}|unreachable|-|-|$(( $(date +%s) - start ))|-" > "$result_file"
+        return 1
+    fi
+
+    local old_version
+    old_version=$(device_version "$ip")
+
+    local tmpfile=$(mktemp)
+    local http_code
+    http_code=$(curl -s \
+        --connect-timeout 10 \
+        --max-time 180 \
+        -X POST \
+        -F "firmware=@${FIRMWARE_PATH}" \
+        -o "$tmpfile" \
+        -w "%{http_code}" \
+        "http://${ip}:${OTA_PORT}/ota/upload")
+    local uploaded=$(date +%s)
+
+    if [[ "$http_code" != "200" ]] && ! grep -qi "success" "$tmpfile" 2>/dev/null; then
+        rm -f "$tmpfile"
+        echo "${ip}|upload failed (HTTP ${http_code})|$((uploaded - start))|-|$((uploaded - start))|${old_version:--}" > "$result_file"
+        return 1
+    fi
+    rm -f "$tmpfile"
+
+    # Wait for the device to reboot and report the expected version
+    local version=""
+    sleep 3
+    for i in {1..60}; do
+        version=$(device_version "$ip")
+        if [[ -n "$version" ]] && { [[ -z "$expected" ]] || [[ "$version" == "$expected" ]]; }; then
+            break
+        fi
+        sleep 1
+    done
+    local done_at=$(date +%s)
+
+    local status="ok"
+    if [[ -z "$version" ]]; then
+        status="no response after reboot"
+    elif [[ -n "$expected" ]] && [[ "$version" != "$expected" ]]; then
+        status="version mismatch"
+    fi
+
+    echo "${ip}|${status}|$((uploaded - start))|$((done_at - uploaded))|$((done_at - start))|${version:--}" > "$result_file"
+    [[ "$status" == "ok" ]]
+}
+
+# Print the fleet summary table from a results directory
+print_fleet_summary() {
+    local results_dir="$1"
+
+    echo ""
+    printf "  %-15s  %-26s  %7s  %7s  %7s  %s\n" "IP" "STATUS" "UPLOAD" "REBOOT" "TOTAL" "VERSION"
+    printf "  %-15s  %-26s  %7s  %7s  %7s  %s\n" "---------------" "--------------------------" "-------" "-------" "-------" "--------------"
+    for result in "$results_dir"/*; do
+        [[ -f "$result" ]] || continue
+        local ip status upload reboot total version
+        IFS='|' read -r ip status upload reboot total version < "$result"
+        local color="$GREEN"
+        [[ "$status" != "ok" ]] && color="$RED"
+        printf "  %-15s  ${color}%-26s${NC}  %6ss  %6ss  %6ss  %s\n" \
+            "$ip" "$status" "$upload" "$reboot" "$total" "$version"
+    done
+    echo ""
+}
+
+# Roll out firmware to a set of devices in parallel, canary first
+fleet_deploy() {
+    local ip_array=($1)
+
+    if [[ ! -f "$FIRMWARE_PATH" ]]; then
+        print_error "Firmware not found at $FIRMWARE_PATH"
+        exit 1
+    fi
+
+    local expected
+    expected=$(firmware_version)
+    print_status "Fleet rollout of ${expected:-unknown version} to ${#ip_array[@]} device(s), ${FLEET_JOBS} at a time"
+
+    local results_dir=$(mktemp -d)
+    local fleet_start=$(date +%s)
+
+    if [[ "$CANARY" == true ]] && [[ ${#ip_array[@]} -gt 1 ]]; then
+        local canary="${ip_array[0]}"
+        ip_array=("${ip_array[@]:1}")
+        print_status "Canary: ${canary}"
+        if ! fleet_deploy_device "$canary" "$results_dir/$canary" "$expected"; then
+            print_fleet_summary "$results_dir"
+            rm -rf "$results_dir"
+            print_error "Canary ${canary} failed - aborting rollout"
+            exit 1
+        fi
+        print_success "Canary ${canary} verified, continuing with ${#ip_array[@]} device(s)"
+    fi
+
+    for ip in "${ip_array[@]}"; do
+        # Limit concurrency (polling keeps this compatible with bash 3.2 on macOS)
+        while [[ $(jobs -rp | wc -l) -ge $FLEET_JOBS ]]; do
+            sleep 1
+        done
+        print_status "Deploying to ${ip}..."
+        fleet_deploy_device "$ip" "$results_dir/$ip" "$expected" &
+    done
+    wait
+
+    print_fleet_summary "$results_dir"
+
+    local success_count fail_count
+    success_count=$(cat "$results_dir"/* | awk -F'|' '$2 == "ok"' | wc -l | tr -d ' ')
+    fail_count=$(cat "$results_dir"/* | awk -F'|' '$2 != "ok"' | wc -l | tr -d ' ')
+    rm -rf "$results_dir"
+
+    print_status "Fleet rollout took $(( $(date +%s) - fleet_start ))s"
+    if [[ "$fail_count" -gt 0 ]]; then
+        print_error "Deployment complete: ${success_count} succeeded, ${fail_count} failed"
+        exit 1
+    fi
+    print_success "Deployment complete: ${success_count} succeeded, ${fail_count} failed"
+}
+
 # Main
 main() {
+    # Machine-readable discovery for other host tools (e.g. collect.sh)
+    if [[ "$DISCOVER_ONLY" == true ]]; then
+        discover_devices
+        exit 0
+    fi
+
     echo "========================================"
     echo "  ESP32 WiFi Bridge - Deploy Script"
     echo "========================================"
@@ -432,7 +607,18 @@ main() {
                 exit 1
             fi
 
-            if [[ "$DEPLOY_ALL" == true ]]; then
+            if [[ "$FLEET" == true ]]; then
+                local compatible_ips
+                compatible_ips=$(get_compatible_devices "$devices")
+
+                if [[ -z "$compatible_ips" ]]; then
+                    print_error "No compatible devices found"
+                    print_error "Devices must have ota_port TXT record"
+                    exit 1
+                fi
+
+                fleet_deploy "$compatible_ips"
+            elif [[ "$DEPLOY_ALL" == true ]]; then
                 # Deploy to all compatible devices
                 local compatible_ips
                 compatible_ips=$(get_compatible_devices "$devices")
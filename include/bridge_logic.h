@@ -0,0 +1,250 @@
+// Pure logic shared by src/main.c and the host tests in test/ (pio test -e native).
+// Nothing here calls ESP-IDF, FreeRTOS or lwIP, so it builds and runs on a PC; main.c does
+// the I/O and hands the results in and out.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// ===== Source ACL =====
+typedef struct {
+    uint32_t net;           // Network address (host byte order, already masked)
+    uint32_t mask;
+    uint8_t prefix_len;
+    bool allow;
+} acl_rule_t;
+
+/** Parse a dotted-quad IPv4 address into host byte order; returns the characters used, 0 if invalid */
+static inline int parse_ipv4(const char *s, uint32_t *out)
+{
+    const char *p = s;
+    uint32_t ip = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i > 0 && *p++ != '.') return 0;
+        if (*p < '0' || *p > '9') return 0;
+        uint32_t octet = 0;
+        int digits = 0;
+        while (*p >= '0' && *p <= '9') {
+            octet = octet * 10 + (*p++ - '0');
+            if (++digits > 3 || octet > 255) return 0;
+        }
+        ip = ip << 8 | octet;
+    }
+    *out = ip;
+    return (int)(p - s);
+}
+
+/** Parse one SOURCE_ACL rule ("+a.b.c.d/len" or "-a.b.c.d", which means /32); false if malformed */
+static inline bool acl_parse_rule(const char *tok, acl_rule_t *rule)
+{
+    if (tok[0] != '+' && tok[0] != '-') return false;
+    uint32_t ip;
+    int used = parse_ipv4(tok + 1, &ip);
+    if (used == 0) return false;
+
+    const char *p = tok + 1 + used;
+    int prefix_len = 32;
+    if (*p == '/') {
+        p++;
+        if (*p < '0' || *p > '9') return false;
+        prefix_len = 0;
+        while (*p >= '0' && *p <= '9') {
+            prefix_len = prefix_len * 10 + (*p++ - '0');
+            if (prefix_len > 32) return false;
+        }
+    }
+    if (*p != '\0') return false;
+
+    rule->mask = prefix_len ? 0xFFFFFFFFu << (32 - prefix_len) : 0;
+    rule->net = ip & rule->mask;
+    rule->prefix_len = prefix_len;
+    rule->allow = tok[0] == '+';
+    return true;
+}
+
+/** Insert a rule keeping longer prefixes first, so the first match is the most specific; false if full */
+static inline bool acl_insert_rule(acl_rule_t *rules, int *count, int max, const acl_rule_t *rule)
+{
+    if (*count >= max) return false;
+    int pos = *count;
+    while (pos > 0 && rules[pos - 1].prefix_len < rule->prefix_len) {
+        rules[pos] = rules[pos - 1];
+        pos--;
+    }
+    rules[pos] = *rule;
+    (*count)++;
+    return true;
+}
+
+/** Index of the most specific rule matching a host-order IPv4 address, or -1 */
+static inline int acl_match(const acl_rule_t *rules, int count, uint32_t ip)
+{
+    for (int i = 0; i < count; i++) {
+        if ((ip & rules[i].mask) == rules[i].net) return i;
+    }
+    return -1;
+}
+
+// ===== Request Log Query =====
+// Request log export filters (all optional)
+typedef struct {
+    uint32_t cursor;        // Only entries after this position (see request_log_read)
+    int64_t since;          // Only entries at or after this time (see request_log_read)
+    char ip[20];            // Exact source address as formatted by format_log_source
+    int result;             // -1 = any, else 0=ok, 1=timeout, 2=error
+    uint16_t min_ttfb;      // Only entries with at least this TTFB (ms)
+} request_filter_t;
+
+static const char *const request_result_names[3] = {"ok", "timeout", "error"};
+
+/** Parse a decimal number in [0, max]; false on anything else (sign, junk, overflow) */
+static inline bool parse_uint(const char *s, uint32_t max, uint32_t *out)
+{
+    if (*s < '0' || *s > '9') return false;
+    uint64_t v = 0;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') return false;
+        v = v * 10 + (*s - '0');
+        if (v > max) return false;
+    }
+    *out = (uint32_t)v;
+    return true;
+}
+
+// Query parameter lookup with httpd_query_key_value()'s contract: 0 when `key` is present
+typedef int (*query_value_fn)(const char *query, const char *key, char *value, size_t len);
+
+/**
+ * Parse the request log query shared by /api/requests/export and /api/history: format, cursor,
+ * limit (1-1000), since, ip, result and min_ttfb. Fields not in the query keep the caller's
+ * defaults. Returns NULL, or the message for a 400 response.
+ */
+static inline const char *parse_request_query(query_value_fn get, const char *query, request_filter_t *filter,
+                                              int *limit, bool *csv)
+{
+    char value[24];
+    uint32_t n;
+    if (get(query, "format", value, sizeof(value)) == 0) {
+        if (strcmp(value, "csv") == 0) {
+            *csv = true;
+        } else if (strcmp(value, "ndjson") == 0) {
+            *csv = false;
+        } else {
+            return "format must be ndjson or csv";
+        }
+    }
+    if (get(query, "cursor", value, sizeof(value)) == 0) {
+        if (!parse_uint(value, UINT32_MAX, &n)) return "cursor must be a number";
+        filter->cursor = n;
+    }
+    if (get(query, "limit", value, sizeof(value)) == 0) {
+        if (!parse_uint(value, 1000, &n) || n < 1) return "limit must be 1-1000";
+        *limit = n;
+    }
+    if (get(query, "since", value, sizeof(value)) == 0) {
+        if (!parse_uint(value, UINT32_MAX, &n)) return "since must be a number of seconds";
+        filter->since = n;
+    }
+    get(query, "ip", filter->ip, sizeof(filter->ip));
+    if (get(query, "result", value, sizeof(value)) == 0) {
+        filter->result = -1;
+        for (int i = 0; i < 3; i++) {
+            if (strcmp(value, request_result_names[i]) == 0) filter->result = i;
+        }
+        if (filter->result < 0) return "result must be ok, timeout or error";
+    }
+    if (get(query, "min_ttfb", value, sizeof(value)) == 0) {
+        if (!parse_uint(value, UINT16_MAX, &n)) return "min_ttfb must be 0-65535";
+        filter->min_ttfb = n;
+    }
+    return NULL;
+}
+
+// ===== Connection Pool Planner =====
+// Per-connection overheads the planner adds to the configured stack and buffer sizes
+#define POOL_TASK_OVERHEAD 512      // TCB and allocator headers for the client task
+#define POOL_SOCKET_OVERHEAD 384    // tcp_pcb, netconn and socket entry per leg
+
+// Build-time settings the plan is computed against (config.h and sdkconfig values)
+typedef struct {
+    uint32_t task_stack;        // Client task stack (SSL_PASSTHROUGH_TASK_STACK_SIZE)
+    uint32_t slot_bytes;        // One buffer pool slot (sizeof(buffer_pair_t))
+    uint32_t tcp_buffer_bytes;  // TCP send buffer + receive window of one socket
+    int lwip_buffer_pct;        // POOL_LWIP_BUFFER_PCT
+    int safety_pct;             // POOL_SAFETY_PCT
+    uint32_t heap_reserve;      // POOL_HEAP_RESERVE
+    int max_sockets;            // CONFIG_LWIP_MAX_SOCKETS
+    int max_active_tcp;         // CONFIG_LWIP_MAX_ACTIVE_TCP
+    int socket_reserve;         // POOL_SOCKET_RESERVE
+    int max_clients;            // MAX_CONCURRENT_CLIENTS
+    int min_clients;            // POOL_MIN_CLIENTS
+} pool_config_t;
+
+// Inputs and result of the boot-time pool sizing (reported by /api/memory)
+typedef struct {
+    uint32_t internal_free;     // Free internal heap when planned
+    uint32_t internal_largest;  // Largest free internal block
+    uint32_t psram_free;        // Free PSRAM (0 without PSRAM)
+    uint32_t psram_largest;
+    uint32_t stack_bytes;       // Per connection: client task stack + TCB
+    uint32_t buffer_bytes;      // Per connection: slot (both forwarding buffers + state)
+    uint32_t lwip_bytes;        // Per connection: two PCBs/sockets + budgeted TCP buffering
+    uint32_t conn_internal;     // Per connection internal heap, including the safety margin
+    int sockets_used;           // lwIP sockets already open when planned
+    int pcbs_used;              // Active TCP PCBs when planned
+    int service_sockets;        // Sockets the services started after the plan will hold
+    int service_pcbs;           // Active PCBs among those (probes; listeners use listen PCBs)
+    int by_heap;                // Connections the internal heap allows
+    int by_block;               // Connections the pool's contiguous allocation allows
+    int by_sockets;             // Connections the lwIP socket / PCB limits allow
+    int slots;                  // Pool size chosen
+    const char *limit;          // Binding constraint
+    bool buffers_in_psram;
+} pool_plan_t;
+
+/**
+ * Size the connection pool from the measured inputs in p (heap, PSRAM, sockets and PCBs in use,
+ * service sockets/PCBs): each connection needs a client task stack, a buffer slot (in PSRAM
+ * when a slot fits there) and two lwIP sockets with their TCP buffering. Fills in the
+ * per-connection costs, each limit, the slot count and the binding constraint.
+ */
+static inline void pool_plan_compute(pool_plan_t *p, const pool_config_t *c)
+{
+    p->buffers_in_psram = p->psram_largest >= c->slot_bytes;
+    p->stack_bytes = c->task_stack + POOL_TASK_OVERHEAD;
+    p->buffer_bytes = c->slot_bytes;
+    p->lwip_bytes = 2 * (POOL_SOCKET_OVERHEAD + c->tcp_buffer_bytes * c->lwip_buffer_pct / 100);
+    uint32_t internal = p->stack_bytes + p->lwip_bytes + (p->buffers_in_psram ? 0 : p->buffer_bytes);
+    p->conn_internal = internal * (100 + c->safety_pct) / 100;
+
+    uint32_t budget = p->internal_free > c->heap_reserve ? p->internal_free - c->heap_reserve : 0;
+    p->by_heap = budget / p->conn_internal;
+    p->by_block = (p->buffers_in_psram ? p->psram_largest : p->internal_largest) / p->buffer_bytes;
+
+    // Each connection holds two sockets and two active PCBs; besides what is open now and what
+    // the services will open, keep a few for httpd clients
+    int by_fds = (c->max_sockets - p->sockets_used - p->service_sockets - c->socket_reserve) / 2;
+    int by_pcbs = (c->max_active_tcp - p->pcbs_used - p->service_pcbs - c->socket_reserve) / 2;
+    p->by_sockets = by_fds < by_pcbs ? by_fds : by_pcbs;
+
+    p->slots = c->max_clients;
+    p->limit = "max";
+    if (p->by_heap < p->slots) {
+        p->slots = p->by_heap;
+        p->limit = "heap";
+    }
+    if (p->by_block < p->slots) {
+        p->slots = p->by_block;
+        p->limit = "largest_block";
+    }
+    if (p->by_sockets < p->slots) {
+        p->slots = p->by_sockets;
+        p->limit = "sockets";
+    }
+    if (p->slots < c->min_clients) {
+        p->slots = c->min_clients;
+        p->limit = "min";
+    }
+}
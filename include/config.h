@@ -6,12 +6,28 @@
 #define WIFI_SSID "TeslaPowerwall"
 #define WIFI_PASSWORD ""
 
-// Powerwall IP address on the WiFi network
-#define POWERWALL_IP_ADDR1 192
-#define POWERWALL_IP_ADDR2 168
-#define POWERWALL_IP_ADDR3 91
-#define POWERWALL_IP_ADDR4 1
+// Powerwall IP address on the WiFi network. The Powerwall is its own access point, so the
+// upstream is taken from the WiFi DHCP gateway; this address is used until a lease arrives,
+// or always when POWERWALL_IP_OVERRIDE is 1.
 #define POWERWALL_IP_STR "192.168.91.1"
+#define POWERWALL_IP_OVERRIDE 0
+
+// Ordered upstream endpoints for the Powerwall route: "host:port@wifi" or "host:port@eth",
+// where host "gateway" is the address above. When the Powerwall's AP is flaky, add its wired
+// address as a fallback, e.g. "gateway:443@wifi,192.168.1.50:443@eth".
+#define UPSTREAM_ENDPOINTS "gateway:443@wifi"
+#define UPSTREAM_MAX_ENDPOINTS 4
+#define UPSTREAM_PROBE_INTERVAL_SEC 10   // Health probe (TCP connect) of every endpoint
+#define UPSTREAM_HEALTHY_SCORE 40        // Score 0-100: halves per failure, recovers per success
+#define UPSTREAM_ORDER_BIAS_MS 20        // Cost added per list position (prefers earlier entries)
+#define UPSTREAM_SWITCH_MARGIN_MS 50     // A healthy endpoint must be this much cheaper to switch
+
+// Upstream ARP: keep every on-link upstream endpoint's MAC resolved so the first connection
+// after idle doesn't wait on an ARP exchange (lwIP ARP entries otherwise expire after 5
+// minutes). A pin is dropped and relearned when the endpoint's connections only failed
+// since the last pass; no extra connections are made to check it.
+#define ARP_REFRESH_INTERVAL_SEC 60
+#define ARP_PIN_UPSTREAM 1  // Pin as a static entry (needs lwIP ETHARP_SUPPORT_STATIC_ENTRIES)
 
 // ===== W5500 SPI Pin Configuration =====
 // These are the correct pins for ESP32-S3-POE-ETH (Waveshare)
@@ -21,12 +37,59 @@
 #define W5500_SCK_GPIO  13
 #define W5500_CS_GPIO   14
 
+// Ethernet addressing: 0 = DHCP, 1 = static (ETH_STATIC_*), 2 = fast DHCP (start on the last
+// lease cached in NVS, renew with DHCP in the background)
+#define ETH_IP_MODE 2
+#define ETH_STATIC_IP "192.168.1.50"
+#define ETH_STATIC_NETMASK "255.255.255.0"
+#define ETH_STATIC_GATEWAY "192.168.1.1"
+
+// W5500 RX servicing: 0 = interrupt (INT pin), 1 = polling, 2 = hybrid (interrupts when idle,
+// plus tight polling of the RX buffer while a traffic burst lasts). /api/ethernet compares them.
+#define W5500_RX_MODE 2
+#define W5500_POLL_PERIOD_MS 1          // Mode 1 poll period
+#define W5500_BURST_POLL_US 250         // Mode 2 poll period during a burst
+#define W5500_BURST_ENTER_FPS 400       // Mode 2: start polling at this RX frame rate
+#define W5500_BURST_EXIT_FPS 100        // Mode 2: back to interrupts below this rate...
+#define W5500_BURST_HOLD_MS 300         // ...sustained for this long
+#define W5500_RATE_WINDOW_MS 100        // Frame rate measurement window
+#define ETH_STATS_INTERVAL_SEC 60       // Link/error history interval (30 intervals kept)
+
 // ===== Proxy Server Configuration =====
 #define PROXY_PORT 443
-#define PROXY_TIMEOUT_MS 60000  // 60 seconds (increased from 30)
+#define PROXY_TIMEOUT_MS 60000  // Idle timeout: 60 seconds without traffic in either direction
+#define PROXY_CONNECT_TIMEOUT_MS 3000       // Upstream TCP connect
+#define PROXY_FIRST_BYTE_TIMEOUT_MS 5000    // Client must start talking (e.g. ClientHello)
+#define PROXY_HANDSHAKE_TIMEOUT_MS 10000    // First response byte must reach the client
+#define PROXY_MAX_LIFETIME_MS 3600000       // Absolute connection lifetime (0 = unlimited)
+#define PROXY_MIN_CLIENT_RATE_BPS 100       // Slow sender: trickling below this with the upstream waiting
+#define PROXY_MIN_RATE_WINDOW_MS 10000      // Window for the slow-sender rule
+
+// TCP keepalive on both legs of a proxied connection, so a silently vanished peer (e.g. the
+// Powerwall AP rebooting without a deauth) is detected in idle + intvl * cnt seconds
+// instead of by the idle timeout. Set KEEPALIVE_IDLE_SEC to 0 to disable.
+#define KEEPALIVE_IDLE_SEC 10     // Idle time before the first probe
+#define KEEPALIVE_INTVL_SEC 2     // Time between probes
+#define KEEPALIVE_CNT 3           // Unanswered probes before the connection is dropped
 #define PROXY_BUFFER_SIZE 4096  // Buffer size for forwarding encrypted data (larger = fewer syscalls)
 #define SSL_PASSTHROUGH_TASK_STACK_SIZE 6144  // Stack size per client task (reduced from 8192)
-#define MAX_CONCURRENT_CLIENTS 4  // Maximum simultaneous proxy connections (each uses 2 buffers)
+#define MAX_CONCURRENT_CLIENTS 8  // Upper bound on simultaneous proxy connections (pool planner sizes the pool at boot; lwIP limits in sdkconfig.defaults)
+#define CONN_STUCK_THRESHOLD_MS 30000  // Watchdog: force-close a connection with no progress this long (0 = off)
+#define PROXY_IPV6_ENABLED 1      // Dual-stack listener (IPv4 + IPv6 via SLAAC); needs CONFIG_LWIP_IPV6
+#define PROXY_LISTEN_BACKLOG 8    // Pending connections lwIP queues per listener before dropping SYNs
+#define ACCEPT_RATE_PER_SEC 20    // Token bucket: sustained accepts per second (0 = unlimited)
+#define ACCEPT_BURST 10           // Token bucket: accepts allowed back-to-back
+#define ACCEPT_BACKOFF_MIN_MS 10  // First delay after an accept() error, doubled on each repeat
+#define ACCEPT_BACKOFF_MAX_MS 1000
+
+// ===== Source ACL =====
+// Client prefixes checked right after accept(), longest prefix wins: "+net/len" allows,
+// "-net/len" denies (no /len means a single host). Denied clients are reset and counted.
+// Example: "+192.168.0.0/16,-192.168.1.66,+10.0.0.0/8" with SOURCE_ACL_DEFAULT_ALLOW 0
+#define SOURCE_ACL ""
+#define SOURCE_ACL_DEFAULT_ALLOW 1   // Verdict when no rule matches
+#define SOURCE_ACL_ALLOW_IPV6 1      // Verdict for native IPv6 clients (rules are IPv4)
+#define SOURCE_ACL_MAX_RULES 16
 
 // ===== TTL Configuration =====
 // TTL (Time-To-Live) value to set on outgoing packets to hide external origin
@@ -39,6 +102,85 @@
 #define MDNS_SERVICE "_powerwall"
 #define MDNS_PROTOCOL "_tcp"
 
+// Advertise live load (free_slots, ttfb_p95, rssi) in the _powerwall._tcp TXT record
+// so discovery-aware clients can pick the least loaded bridge
+#define MDNS_LOAD_TXT_ENABLED 1
+#define MDNS_TXT_CHECK_INTERVAL_SEC 5     // How often load is sampled
+#define MDNS_TXT_MIN_INTERVAL_SEC 30      // Minimum time between TXT announcements
+#define MDNS_TXT_RSSI_HYSTERESIS 3        // dB change needed to re-announce
+#define MDNS_TXT_TTFB_HYSTERESIS_PCT 20   // p95 TTFB change (%) needed to re-announce
+
+// ===== High Availability (active/standby pair) =====
+// Two bridges on the same Ethernet subnet share a virtual IP. The active one owns it;
+// the standby claims it (gratuitous ARP) when heartbeats stop. Clients use the VIP.
+#define HA_ENABLED 0
+#define HA_VIRTUAL_IP_STR "192.168.1.250"  // Shared address, must be in the Ethernet subnet
+#define HA_PORT 18443                      // UDP heartbeat port
+#define HA_GROUP_ID 1                      // Pair identifier (distinct per pair on one LAN)
+#define HA_PRIORITY 100                    // Higher priority stays active if both claim the VIP
+#define HA_HEARTBEAT_INTERVAL_MS 200
+#define HA_DEAD_INTERVAL_MS 600            // Missed heartbeats before the standby takes over
+#define HA_STARTUP_LISTEN_MS 1500          // Listen for an active peer before claiming at boot
+
+// ===== HTTP CONNECT Tunnel (optional) =====
+// Lets clients reach other devices on the Powerwall WiFi (e.g. Wall Connectors) through
+// the bridge. Only allow-listed targets are tunnelled: "ip:port" or "ip:port=max_concurrent".
+#define CONNECT_TUNNEL_ENABLED 0
+#define CONNECT_PORT 3128
+#define CONNECT_ALLOWLIST "192.168.91.1:443=2"
+#define CONNECT_MAX_TARGETS 8
+#define CONNECT_DEFAULT_TARGET_LIMIT 1     // Concurrent tunnels per target when "=n" is omitted
+#define CONNECT_HEADER_TIMEOUT_MS 5000     // Time allowed for the CONNECT request head
+#define CONNECT_KEEPALIVE_IDLE_SEC 30      // Keepalive for the tunnel route (see KEEPALIVE_*)
+#define CONNECT_KEEPALIVE_INTVL_SEC 5
+#define CONNECT_KEEPALIVE_CNT 3
+
+// ===== Connection Pool Planner =====
+// Once WiFi, lwIP, httpd and mDNS are up, the connection pool is sized from the heap that is
+// actually free: per connection a client task stack, a buffer slot and two lwIP sockets with
+// their TCP buffering, plus a safety margin. Result and inputs are reported by /api/memory.
+#define POOL_MIN_CLIENTS 1          // Always allocate at least this many slots
+#define POOL_HEAP_RESERVE 65536     // Internal heap kept free (service tasks started later, httpd, OTA)
+#define POOL_SAFETY_PCT 20          // Margin added to the per-connection cost (%)
+#define POOL_LWIP_BUFFER_PCT 50     // Share of each socket's TCP send buffer + window budgeted (%)
+#define POOL_SOCKET_RESERVE 4       // lwIP sockets/PCBs kept for httpd clients (listeners and probes are counted)
+
+// ===== Persistent Request Log =====
+// Request records and periodic metric snapshots are appended to a ring in the "reqlog" data
+// partition (partitions.csv) and survive reboots; read them back with /api/history.
+// Records are written in batches by a background task, so up to FLASH_LOG_BATCH records
+// (or FLASH_LOG_FLUSH_SEC of history) can be lost on power loss.
+#define FLASH_LOG_ENABLED 1
+#define FLASH_LOG_PARTITION "reqlog"
+#define FLASH_LOG_BATCH 8                   // Records per flash write (at most 8 x 32 bytes = one 256-byte page)
+#define FLASH_LOG_FLUSH_SEC 30              // Write a partial batch after this long
+#define FLASH_LOG_QUEUE_LEN 32              // Records waiting for the writer (overflow is counted and dropped)
+#define FLASH_LOG_METRIC_INTERVAL_SEC 60    // Heap/connection/CPU snapshot interval (0 = requests only)
+
+// ===== CPU Profiler =====
+// On-demand sampling profiler (POST /api/profile?seconds=N, then GET /api/profile; see profile.sh).
+// Samples every FreeRTOS tick on both cores, or every Nth tick when the window would not fit
+// in PROFILER_MAX_SAMPLES. The buffer (12 bytes/sample) is allocated per profile, preferring
+// PSRAM, and freed once downloaded; from internal RAM it must leave POOL_HEAP_RESERVE free.
+#define PROFILER_ENABLED 1
+#define PROFILER_MAX_SAMPLES 8192
+
+// ===== Scheduling Trace =====
+// FreeRTOS trace hooks (task switches, queue blocks, W5500 interrupt) recorded into a ring
+// in internal RAM (16 bytes/event); GET /api/trace?ms=N exports the last N ms as Chrome /
+// Perfetto trace JSON. CMakeLists.txt wires the hooks into the kernel when this is 1.
+// A busy bridge records a few thousand events per second.
+#define TRACE_ENABLED 0
+#define TRACE_RING_EVENTS 4096
+
+// ===== Graceful Drain =====
+// Before a reboot, OTA, rollback or WiFi change, new connections are refused and open ones
+// are closed as soon as their current exchange completes, up to this deadline.
+#define DRAIN_TIMEOUT_MS 10000
+// A connection counts as between exchanges once both directions have been quiet this long
+// after the last response byte
+#define DRAIN_QUIET_MS 1000
+
 // ===== WiFi Quality Monitoring =====
 // Interval for logging WiFi connection quality (in seconds)
 #define WIFI_QUALITY_LOG_INTERVAL_SEC 30  // Log every 30 seconds
@@ -47,6 +189,12 @@
 // Interval for logging system metrics (CPU load, etc.) in seconds
 #define SYSTEM_MONITOR_INTERVAL_SEC 30  // Log every 30 seconds
 
+// ===== Self-Check (leak / drift detection) =====
+// Interval for checking that slots, sockets and heap return to their idle baseline
+#define SELFCHECK_INTERVAL_SEC 60
+// Allowed shrink of the largest free heap block before it is reported as drift
+#define SELFCHECK_HEAP_DRIFT_BYTES 8192
+
 // ===== Debug Configuration =====
 // Enable DEBUG_MODE to show encrypted packet forwarding details
 #define DEBUG_MODE 0  // Set to 1 to enable debug logging
@@ -0,0 +1,26 @@
+// FreeRTOS trace hook definitions for the scheduling trace (TRACE_ENABLED in config.h).
+// CMakeLists.txt force-includes this header into every component when tracing is enabled,
+// so the kernel's tasks.c and queue.c pick up these macros instead of the empty defaults.
+// The recorders live in src/main.c ("Scheduling Trace").
+#pragma once
+
+#ifndef __ASSEMBLER__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void trace_task_switched_in(void);
+void trace_task_switched_out(void);
+void trace_queue_block(void *queue, int sending);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define traceTASK_SWITCHED_IN() trace_task_switched_in()
+#define traceTASK_SWITCHED_OUT() trace_task_switched_out()
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue) trace_queue_block((void *)(pxQueue), 0)
+#define traceBLOCKING_ON_QUEUE_SEND(pxQueue) trace_queue_block((void *)(pxQueue), 1)
+
+#endif
@@ -0,0 +1,211 @@
+#!/bin/bash
+#
+# ESP32 WiFi Bridge - CPU Profiler
+#
+# Runs an on-demand sampling profile on a bridge (/api/profile), downloads the binary
+# dump and symbolises it against the firmware ELF. Output is one folded stack per line
+# ("task;caller;function count"), ready for flamegraph.pl or speedscope.
+#
+
+# Configuration
+OTA_PORT=8080
+SECONDS_TO_PROFILE=5
+ELF_FILE=".pio/build/esp32-s3-devkitc-1/firmware.elf"
+ADDR2LINE="${ADDR2LINE:-xtensa-esp32s3-elf-addr2line}"
+
+# Dump layout (see profile_header_t / profile_sample_t in src/main.c)
+HEADER_SIZE=56
+TASK_NAME_SIZE=16
+SAMPLE_SIZE=12
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+print_status() { echo -e "${BLUE}[*]${NC} $1" >&2; }
+print_success() { echo -e "${GREEN}[✓]${NC} $1" >&2; }
+print_warning() { echo -e "${YELLOW}[!]${NC} $1" >&2; }
+print_error() { echo -e "${RED}[✗]${NC} $1" >&2; }
+
+usage() {
+    echo "Usage: $0 -i ADDRESS [OPTIONS]"
+    echo ""
+    echo "Options:"
+    echo "  -i, --ip ADDRESS       Bridge IP address (required)"
+    echo "  -t, --seconds N        Profile duration, 1-30 (default: ${SECONDS_TO_PROFILE})"
+    echo "  -e, --elf FILE         Firmware ELF (default: ${ELF_FILE})"
+    echo "  -d, --dump FILE        Symbolise an existing dump instead of profiling"
+    echo "  -o, --output FILE      Write folded stacks to FILE (default: stdout)"
+    echo "  -h, --help             Show this help message"
+    echo ""
+    echo "Examples:"
+    echo "  $0 -i 192.168.1.100 -t 10 -o profile.folded"
+    echo "  flamegraph.pl profile.folded > profile.svg"
+}
+
+DEVICE_IP=""
+DUMP_FILE=""
+OUTPUT=""
+
+while [[ $# -gt 0 ]]; do
+    case $1 in
+        -i|--ip)
+            DEVICE_IP="$2"
+            shift 2
+            ;;
+        -t|--seconds)
+            SECONDS_TO_PROFILE="$2"
+            shift 2
+            ;;
+        -e|--elf)
+            ELF_FILE="$2"
+            shift 2
+            ;;
+        -d|--dump)
+            DUMP_FILE="$2"
+            shift 2
+            ;;
+        -o|--output)
+            OUTPUT="$2"
+            shift 2
+            ;;
+        -h|--help)
+            usage
+            exit 0
+            ;;
+        *)
+            print_error "Unknown option: $1"
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+if [[ -z "$DEVICE_IP" && -z "$DUMP_FILE" ]]; then
+    print_error "Device IP or dump file is required"
+    usage
+    exit 1
+fi
+
+if [[ ! -f "$ELF_FILE" ]]; then
+    print_error "ELF not found: ${ELF_FILE}"
+    exit 1
+fi
+
+if ! command -v "$ADDR2LINE" &> /dev/null; then
+    print_error "${ADDR2LINE} not found (set ADDR2LINE or add the Xtensa toolchain to PATH)"
+    exit 1
+fi
+
+# Unsigned 32-bit little-endian value at a byte offset
+read_u32() {
+    od -An -v -tu4 -j "$2" -N 4 "$1" | tr -d ' '
+}
+
+# Unsigned 16-bit little-endian value at a byte offset
+read_u16() {
+    od -An -v -tu2 -j "$2" -N 2 "$1" | tr -d ' '
+}
+
+# Start a profile, wait for it and download the dump
+capture_profile() {
+    local dump="$1"
+    local base="http://${DEVICE_IP}:${OTA_PORT}/api/profile"
+
+    local response
+    response=$(curl -s --connect-timeout 5 -X POST "${base}?seconds=${SECONDS_TO_PROFILE}")
+    if [[ "$response" != *'"started":true'* ]]; then
+        print_error "Profile did not start: ${response:-no response}"
+        exit 1
+    fi
+    print_status "Profiling ${DEVICE_IP} for ${SECONDS_TO_PROFILE}s..."
+    sleep $((SECONDS_TO_PROFILE + 1))
+
+    # The dump is freed on download; retry briefly if the window has not closed yet
+    local attempt code
+    for attempt in 1 2 3 4 5; do
+        code=$(curl -s --connect-timeout 5 --max-time 30 -o "$dump" -w '%{http_code}' "$base")
+        [[ "$code" == "200" ]] && return
+        sleep 1
+    done
+    print_error "Download failed (HTTP ${code})"
+    exit 1
+}
+
+main() {
+    local tmp_dir
+    tmp_dir=$(mktemp -d)
+    trap 'rm -rf "$tmp_dir"' EXIT
+
+    local dump="${DUMP_FILE:-${tmp_dir}/profile.bin}"
+    [[ -z "$DUMP_FILE" ]] && capture_profile "$dump"
+
+    if [[ "$(head -c 4 "$dump")" != "PRF1" ]]; then
+        print_error "Not a profile dump: ${dump}"
+        exit 1
+    fi
+
+    local task_count sample_count rate duration dropped
+    task_count=$(read_u16 "$dump" 6)
+    sample_count=$(read_u32 "$dump" 8)
+    rate=$(read_u32 "$dump" 12)
+    duration=$(read_u32 "$dump" 16)
+    dropped=$(read_u32 "$dump" 20)
+    print_status "${sample_count} samples over ${duration} ms at ${rate} Hz/core, ${task_count} tasks, ${dropped} dropped"
+    [[ "$dropped" -gt 0 ]] && print_warning "Sample buffer filled - raise PROFILER_MAX_SAMPLES or profile for less time"
+
+    # Symbols are only meaningful for the exact build that produced the dump
+    local device_sha elf_sha
+    device_sha=$(od -An -v -tx1 -j 24 -N 32 "$dump" | tr -d ' \n')
+    elf_sha=$(sha256sum "$ELF_FILE" | cut -d' ' -f1)
+    if [[ "$device_sha" != "$elf_sha" ]]; then
+        print_warning "ELF SHA-256 does not match the running firmware - symbols may be wrong"
+        print_warning "  device: ${device_sha}"
+        print_warning "  elf:    ${elf_sha}"
+    fi
+
+    # Task table: one NUL-padded name per line
+    local i
+    for ((i = 0; i < task_count; i++)); do
+        dd if="$dump" bs=1 skip=$((HEADER_SIZE + i * TASK_NAME_SIZE)) count=$TASK_NAME_SIZE 2>/dev/null | tr -d '\0'
+        echo ""
+    done > "${tmp_dir}/tasks"
+
+    # Samples as "pc caller core task"; a windowed a0 keeps the call increment in its top
+    # two bits, so restore the region from the PC and step back to the call instruction
+    od -An -v -tu4 -j $((HEADER_SIZE + task_count * TASK_NAME_SIZE)) -N $((sample_count * SAMPLE_SIZE)) "$dump" |
+        tr -s ' ' '\n' | grep -v '^$' |
+        awk '{w[++n] = $1} n == 3 {
+                pc = w[1]; a0 = w[2]
+                caller = a0 ? (a0 % 1073741824) + (pc - pc % 1073741824) - 3 : 0
+                printf "0x%08x 0x%08x %d %d\n", pc, caller, w[3] % 256, int(w[3] / 256) % 256
+                n = 0
+             }' > "${tmp_dir}/samples"
+
+    # Symbolise every distinct address in one addr2line pass
+    awk '{print $1; if ($2 != "0x00000000") print $2}' "${tmp_dir}/samples" | sort -u > "${tmp_dir}/addrs"
+    "$ADDR2LINE" -f -a -e "$ELF_FILE" < "${tmp_dir}/addrs" |
+        awk 'NR % 3 == 1 {addr = $1} NR % 3 == 2 {print addr, $1}' > "${tmp_dir}/symbols"
+
+    local out="${OUTPUT:-/dev/stdout}"
+    awk 'FILENAME == ARGV[1] {task[FNR - 1] = $0; next}
+         FILENAME == ARGV[2] {sym[$1] = ($2 == "??" ? $1 : $2); next}
+         {
+             name = ($4 in task) ? task[$4] : "unknown"
+             gsub(/[; ]/, "_", name)
+             stack = name ";"
+             if ($2 != "0x00000000") stack = stack sym[$2] ";"
+             count[stack sym[$1]]++
+         }
+         END {for (s in count) print s, count[s]}' \
+        "${tmp_dir}/tasks" "${tmp_dir}/symbols" "${tmp_dir}/samples" | sort -k2,2nr > "$out"
+
+    if [[ -n "$OUTPUT" ]]; then
+        print_success "Folded stacks written to ${OUTPUT}"
+    fi
+}
+
+main
@@ -0,0 +1,165 @@
+#!/bin/bash
+#
+# ESP32 WiFi Bridge - Soak Test
+#
+# Cycles proxied connections through the bridge for a long period and watches the
+# device's self-check (/api/selfcheck) for slot leaks, socket leaks and heap drift.
+# The load pauses periodically so the device can sample its idle baseline.
+#
+
+# Configuration
+OTA_PORT=8080
+PROXY_PORT=443
+DURATION_MIN=60
+CONCURRENCY=2
+BURST_SEC=45
+PAUSE_SEC=20
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+print_status() { echo -e "${BLUE}[*]${NC} $1"; }
+print_success() { echo -e "${GREEN}[✓]${NC} $1"; }
+print_warning() { echo -e "${YELLOW}[!]${NC} $1"; }
+print_error() { echo -e "${RED}[✗]${NC} $1"; }
+
+usage() {
+    echo "Usage: $0 -i ADDRESS [OPTIONS]"
+    echo ""
+    echo "Options:"
+    echo "  -i, --ip ADDRESS       Bridge IP address (required)"
+    echo "  -t, --duration MIN     Soak duration in minutes (default: ${DURATION_MIN})"
+    echo "  -c, --concurrency N    Parallel connection loops (default: ${CONCURRENCY})"
+    echo "  -h, --help             Show this help message"
+    echo ""
+    echo "Examples:"
+    echo "  $0 -i 192.168.1.100            # 1 hour soak"
+    echo "  $0 -i 192.168.1.100 -t 4320    # 3 day soak"
+}
+
+DEVICE_IP=""
+
+while [[ $# -gt 0 ]]; do
+    case $1 in
+        -i|--ip)
+            DEVICE_IP="$2"
+            shift 2
+            ;;
+        -t|--duration)
+            DURATION_MIN="$2"
+            shift 2
+            ;;
+        -c|--concurrency)
+            CONCURRENCY="$2"
+            shift 2
+            ;;
+        -h|--help)
+            usage
+            exit 0
+            ;;
+        *)
+            print_error "Unknown option: $1"
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+if [[ -z "$DEVICE_IP" ]]; then
+    print_error "Device IP is required"
+    usage
+    exit 1
+fi
+
+# Extract a numeric field from the self-check JSON (first match)
+json_num() {
+    echo "$1" | grep -oE "\"$2\":-?[0-9]+" | head -1 | cut -d: -f2
+}
+
+# Total violation count across all types
+violation_total() {
+    local violations
+    violations=$(echo "$1" | grep -oE '"violations":\{[^}]*\}')
+    echo "$violations" | grep -oE ':[0-9]+' | tr -d ':' | awk '{s+=$1} END {print s+0}'
+}
+
+# Open and close proxied connections until the stop file appears
+connection_loop() {
+    local stop_file="$1"
+    while [[ ! -f "$stop_file" ]]; do
+        curl -sk --connect-timeout 5 --max-time 15 -o /dev/null "https://${DEVICE_IP}:${PROXY_PORT}/" 2>/dev/null || :
+    done
+}
+
+main() {
+    echo "========================================"
+    echo "  ESP32 WiFi Bridge - Soak Test"
+    echo "========================================"
+    echo ""
+
+    local selfcheck
+    selfcheck=$(curl -s --connect-timeout 5 "http://${DEVICE_IP}:${OTA_PORT}/api/selfcheck")
+    if [[ -z "$selfcheck" ]]; then
+        print_error "Cannot read /api/selfcheck from ${DEVICE_IP}:${OTA_PORT}"
+        exit 1
+    fi
+
+    local start_violations start_heap
+    start_violations=$(violation_total "$selfcheck")
+    start_heap=$(json_num "$selfcheck" "largest_block")
+    print_status "Soaking ${DEVICE_IP} for ${DURATION_MIN} min (${CONCURRENCY} loops, ${BURST_SEC}s on / ${PAUSE_SEC}s idle)"
+    print_status "Starting violations: ${start_violations}, largest free block: ${start_heap} bytes"
+
+    local end_time=$(( $(date +%s) + DURATION_MIN * 60 ))
+    local stop_file
+    stop_file=$(mktemp -u)
+    trap 'touch "$stop_file"; wait; rm -f "$stop_file"; exit 130' INT TERM
+
+    local cycle=0 violations=$start_violations
+    while [[ $(date +%s) -lt $end_time ]]; do
+        ((cycle++))
+        rm -f "$stop_file"
+        for ((n = 0; n < CONCURRENCY; n++)); do
+            connection_loop "$stop_file" &
+        done
+        sleep "$BURST_SEC"
+        touch "$stop_file"
+        wait
+
+        # Idle window lets the device compare against its baseline
+        sleep "$PAUSE_SEC"
+
+        selfcheck=$(curl -s --connect-timeout 5 "http://${DEVICE_IP}:${OTA_PORT}/api/selfcheck")
+        if [[ -z "$selfcheck" ]]; then
+            print_warning "Cycle ${cycle}: device did not respond"
+            continue
+        fi
+
+        local now_violations free_slots sockets largest
+        now_violations=$(violation_total "$selfcheck")
+        free_slots=$(json_num "$(echo "$selfcheck" | grep -oE '"current":\{[^}]*\}')" "free_slots")
+        sockets=$(json_num "$(echo "$selfcheck" | grep -oE '"current":\{[^}]*\}')" "sockets")
+        largest=$(json_num "$(echo "$selfcheck" | grep -oE '"current":\{[^}]*\}')" "largest_block")
+
+        if [[ "$now_violations" -gt "$violations" ]]; then
+            print_error "Cycle ${cycle}: new self-check violation(s) - $(echo "$selfcheck" | grep -oE '"violations":\{[^}]*\}')"
+            violations=$now_violations
+        else
+            print_status "Cycle ${cycle}: slots free ${free_slots}, sockets ${sockets}, largest block ${largest} bytes"
+        fi
+    done
+
+    rm -f "$stop_file"
+    echo ""
+    if [[ "$violations" -gt "$start_violations" ]]; then
+        print_error "Soak finished with $((violations - start_violations)) new violation(s)"
+        exit 1
+    fi
+    print_success "Soak finished after ${cycle} cycles with no new violations"
+}
+
+main
@@ -9,6 +9,8 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdatomic.h>
+#include <stdarg.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -33,8 +35,22 @@
 #include "esp_http_server.h"
 #include "esp_app_format.h"
 #include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_freertos_hooks.h"
+#include "esp_netif_net_stack.h"
+#include "lwip/etharp.h"
+#include "lwip/tcpip.h"
+#include "lwip/dhcp.h"
+#include "lwip/priv/tcp_priv.h"
 
 #include "config.h"
+#include "bridge_logic.h"
+#if TRACE_ENABLED
+#include "trace_hooks.h"
+#endif
 
 static const char *TAG = "wifi-eth-bridge";
 
@@ -51,37 +67,91 @@ static char wifi_password[65] = WIFI_PASSWORD;
 static volatile bool powerwall_reachable = false;
 static volatile int64_t last_powerwall_check = 0;
 
+// Upstream (Powerwall) address, parsed once. Only sin_addr changes after boot (single word
+// store from the WiFi IP event), so tasks copy the struct instead of locking.
+static struct sockaddr_in upstream_addr = {.sin_family = AF_INET};
+static volatile bool upstream_from_dhcp = false;
+
 // ===== Request Log =====
 // Tracks individual request/response exchanges through the proxy
 #define REQUEST_LOG_SIZE 10
 
 typedef struct {
+    uint32_t seq;           // Monotonic sequence number (export cursor), starts at 1
     int64_t timestamp;      // Seconds since boot
-    uint32_t source_ip;     // Source IP (network byte order)
+    uint32_t source_ip;     // Source IPv4 (network byte order), or a hash of an IPv6 source
     uint32_t bytes_in;      // Request bytes (client -> powerwall)
     uint32_t bytes_out;     // Response bytes (powerwall -> client)
     uint16_t ttfb_ms;       // Time to first byte from Powerwall
     uint16_t ttlb_ms;       // Time to last byte (full response duration)
     uint8_t result;         // 0=success, 1=timeout, 2=error
+    bool source_v6;         // Source was a native IPv6 client
     bool valid;
 } request_log_entry_t;
 
 static request_log_entry_t request_log[REQUEST_LOG_SIZE];
 static int request_log_index = 0;
+static uint32_t request_log_seq = 0;
 static SemaphoreHandle_t request_log_mutex = NULL;
 
 // Running average TTFB (exponential moving average)
 static uint32_t avg_ttfb_ms = 0;
 static uint32_t ttfb_sample_count = 0;
 
+// Recent TTFB samples for percentiles (the request log is too short for a useful p95)
+#define TTFB_WINDOW_SIZE 64
+static uint16_t ttfb_window[TTFB_WINDOW_SIZE];
+static int ttfb_window_index = 0;
+static int ttfb_window_count = 0;
+
+#if FLASH_LOG_ENABLED
+// Persistent log record (see "Persistent Request Log"): 32 bytes, 8 per 256-byte flash page
+typedef struct __attribute__((packed)) {
+    uint32_t time;          // Log clock seconds (queued as uptime; the writer adds the base)
+    uint16_t boot;          // Boot number
+    uint8_t type;           // FLASH_REC_*
+    uint8_t flags;          // Request: result (bits 0-1), IPv6 source (bit 7)
+    union {
+        struct __attribute__((packed)) {
+            uint32_t source_ip;
+            uint32_t bytes_in;
+            uint32_t bytes_out;
+            uint16_t ttfb_ms;
+            uint16_t ttlb_ms;
+        } req;
+        struct __attribute__((packed)) {
+            uint32_t free_heap;
+            uint32_t min_free_heap;
+            uint32_t rejected;      // Connections refused since boot
+            uint16_t active;        // Proxied connections in flight
+            uint8_t cpu;            // CPU usage (%)
+            uint8_t reserved;
+        } metric;
+    };
+    uint8_t reserved[6];
+    uint16_t crc;           // CRC-16 of the preceding bytes
+} flash_log_record_t;
+
+#define FLASH_REC_REQUEST 1
+#define FLASH_REC_METRIC 2
+#define FLASH_REC_RESULT_MASK 0x03
+#define FLASH_REC_V6 0x80
+
+// log_request() only queues records; flash_log_task does all flash I/O
+static QueueHandle_t flash_log_queue = NULL;
+static atomic_uint flash_log_queue_drops = 0;
+#endif
+
 /** Log a completed request/response exchange */
-static void log_request(uint32_t source_ip, uint32_t bytes_in, uint32_t bytes_out, uint16_t ttfb_ms, uint16_t ttlb_ms, uint8_t result)
+static void log_request(uint32_t source_ip, bool source_v6, uint32_t bytes_in, uint32_t bytes_out, uint16_t ttfb_ms, uint16_t ttlb_ms, uint8_t result)
 {
     if (!request_log_mutex) return;
     if (xSemaphoreTake(request_log_mutex, pdMS_TO_TICKS(50)) == pdTRUE) {
         request_log_entry_t *entry = &request_log[request_log_index];
+        entry->seq = ++request_log_seq;
         entry->timestamp = esp_timer_get_time() / 1000000;
         entry->source_ip = source_ip;
+        entry->source_v6 = source_v6;
         entry->bytes_in = bytes_in;
         entry->bytes_out = bytes_out;
         entry->ttfb_ms = ttfb_ms;
@@ -98,10 +168,64 @@ static void log_request(uint32_t source_ip, uint32_t bytes_in, uint32_t bytes_ou
                 avg_ttfb_ms = (avg_ttfb_ms * 4 + ttfb_ms) / 5;
             }
             ttfb_sample_count++;
+
+            ttfb_window[ttfb_window_index] = ttfb_ms;
+            ttfb_window_index = (ttfb_window_index + 1) % TTFB_WINDOW_SIZE;
+            if (ttfb_window_count < TTFB_WINDOW_SIZE) ttfb_window_count++;
+        }
+
+        xSemaphoreGive(request_log_mutex);
+    }
+
+    #if FLASH_LOG_ENABLED
+    if (flash_log_queue) {
+        flash_log_record_t rec = {
+            .time = esp_timer_get_time() / 1000000,
+            .type = FLASH_REC_REQUEST,
+            .flags = (result & FLASH_REC_RESULT_MASK) | (source_v6 ? FLASH_REC_V6 : 0),
+            .req = {
+                .source_ip = source_ip,
+                .bytes_in = bytes_in,
+                .bytes_out = bytes_out,
+                .ttfb_ms = ttfb_ms,
+                .ttlb_ms = ttlb_ms,
+            },
+        };
+        if (xQueueSend(flash_log_queue, &rec, 0) != pdTRUE) {
+            atomic_fetch_add(&flash_log_queue_drops, 1);
         }
+    }
+    #endif
+}
+
+/** TTFB percentile (0-100) over the recent sample window. Returns 0 if no samples */
+static uint16_t ttfb_percentile(int pct)
+{
+    uint16_t sorted[TTFB_WINDOW_SIZE];
+    int n = 0;
 
+    if (!request_log_mutex) return 0;
+    if (xSemaphoreTake(request_log_mutex, pdMS_TO_TICKS(50)) == pdTRUE) {
+        n = ttfb_window_count;
+        memcpy(sorted, ttfb_window, n * sizeof(sorted[0]));
         xSemaphoreGive(request_log_mutex);
     }
+    if (n == 0) return 0;
+
+    // Insertion sort - at most 64 samples
+    for (int i = 1; i < n; i++) {
+        uint16_t v = sorted[i];
+        int j = i - 1;
+        while (j >= 0 && sorted[j] > v) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+
+    int rank = (pct * n + 99) / 100;  // Nearest-rank method
+    if (rank < 1) rank = 1;
+    return sorted[rank - 1];
 }
 
 // Event group for WiFi and Ethernet status
@@ -124,30 +248,164 @@ static int server_socket = -1;
 // OTA HTTP server handle
 static httpd_handle_t ota_server = NULL;
 
+/** Format a log entry's source address (IPv6 sources show as "v6:" and their 32-bit hash) */
+static void format_log_source(const request_log_entry_t *e, char *out, size_t len)
+{
+    const uint8_t *ip = (const uint8_t *)&e->source_ip;
+    if (e->source_v6) {
+        snprintf(out, len, "v6:%08lx", (unsigned long)e->source_ip);
+    } else {
+        snprintf(out, len, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+    }
+}
+
 // ===== Buffer Pool =====
-// Preallocated buffers to avoid malloc/free overhead per connection
+// Preallocated buffers to avoid malloc/free overhead per connection. Each slot also carries
+// the owning connection's phase and progress for the connection watchdog.
+typedef enum {
+    CONN_FREE = 0,
+    CONN_SETUP,         // Accepted, slot taken (CONNECT: reading the request head)
+    CONN_CONNECTING,    // Connecting upstream
+    CONN_HANDSHAKE,     // Forwarding, no response byte yet
+    CONN_STREAMING,     // Forwarding
+    CONN_CLOSING,       // Forwarding ended, cleaning up
+    CONN_PHASE_COUNT
+} conn_phase_t;
+
+static const char *conn_phase_names[CONN_PHASE_COUNT] = {
+    "free", "setup", "connecting", "handshake", "streaming", "closing"
+};
+
 typedef struct {
     uint8_t client_buffer[PROXY_BUFFER_SIZE];
     uint8_t powerwall_buffer[PROXY_BUFFER_SIZE];
     bool in_use;
+    volatile conn_phase_t phase;
+    volatile bool force_closed;         // Watchdog shut the sockets down
+    volatile int client_sock;
+    volatile int upstream_sock;
+    TaskHandle_t task;
+    int64_t started_us;
+    volatile TickType_t last_progress;  // Last forwarding loop pass / phase change
+    volatile uint32_t bytes_in;
+    volatile uint32_t bytes_out;
+    volatile uint32_t pending_send;     // Bytes read but not yet sent on
+    uint32_t source_ip;
+    bool source_v6;
 } buffer_pair_t;
 
-static buffer_pair_t buffer_pool[MAX_CONCURRENT_CLIENTS];
+// Sized at boot by plan_buffer_pool() (at most MAX_CONCURRENT_CLIENTS slots)
+static buffer_pair_t *buffer_pool = NULL;
+static int buffer_pool_size = 0;
 static SemaphoreHandle_t buffer_pool_mutex = NULL;
 
-/** Initialize the buffer pool */
-static void init_buffer_pool(void)
+// Boot-time pool sizing (reported by /api/memory); the arithmetic is pool_plan_compute()
+static pool_plan_t pool_plan;
+
+/** Count open lwIP sockets (fcntl fails with EBADF on unused descriptors) */
+static int count_lwip_sockets(void)
+{
+    int used = 0;
+    for (int fd = LWIP_SOCKET_OFFSET; fd < LWIP_SOCKET_OFFSET + CONFIG_LWIP_MAX_SOCKETS; fd++) {
+        if (fcntl(fd, F_GETFL, 0) >= 0) used++;
+    }
+    return used;
+}
+
+// Active PCB count, filled in by the tcpip thread
+typedef struct {
+    int count;
+    SemaphoreHandle_t done;
+} pcb_count_t;
+
+/** tcpip-thread callback: count active TCP PCBs (connected or connecting) */
+static void count_tcp_pcbs_cb(void *ctx)
+{
+    pcb_count_t *c = (pcb_count_t *)ctx;
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        c->count++;
+    }
+    xSemaphoreGive(c->done);
+}
+
+/** Count active TCP PCBs (0 if the tcpip thread cannot be asked) */
+static int count_tcp_pcbs(void)
+{
+    pcb_count_t c = {.count = 0, .done = xSemaphoreCreateBinary()};
+    if (!c.done) return 0;
+    if (tcpip_callback(count_tcp_pcbs_cb, &c) == ERR_OK) {
+        xSemaphoreTake(c.done, portMAX_DELAY);
+    }
+    vSemaphoreDelete(c.done);
+    return c.count;
+}
+
+/**
+ * Size the connection pool from what is actually free once WiFi, lwIP, httpd and mDNS are up:
+ * each connection needs a client task stack, a buffer slot and two lwIP sockets with their
+ * TCP buffering. POOL_HEAP_RESERVE stays free for the service tasks started after the pool
+ * and for everything else that allocates at runtime; service_sockets / service_pcbs are the
+ * listeners and probes those tasks will open.
+ */
+static void plan_buffer_pool(int service_sockets, int service_pcbs)
+{
+    static const pool_config_t config = {
+        .task_stack = SSL_PASSTHROUGH_TASK_STACK_SIZE,
+        .slot_bytes = sizeof(buffer_pair_t),
+        .tcp_buffer_bytes = CONFIG_LWIP_TCP_SND_BUF_DEFAULT + CONFIG_LWIP_TCP_WND_DEFAULT,
+        .lwip_buffer_pct = POOL_LWIP_BUFFER_PCT,
+        .safety_pct = POOL_SAFETY_PCT,
+        .heap_reserve = POOL_HEAP_RESERVE,
+        .max_sockets = CONFIG_LWIP_MAX_SOCKETS,
+        .max_active_tcp = CONFIG_LWIP_MAX_ACTIVE_TCP,
+        .socket_reserve = POOL_SOCKET_RESERVE,
+        .max_clients = MAX_CONCURRENT_CLIENTS,
+        .min_clients = POOL_MIN_CLIENTS,
+    };
+    pool_plan_t *p = &pool_plan;
+    memset(p, 0, sizeof(*p));
+    p->internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    p->internal_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    p->psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    p->psram_largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+    p->sockets_used = count_lwip_sockets();
+    p->pcbs_used = count_tcp_pcbs();
+    p->service_sockets = service_sockets;
+    p->service_pcbs = service_pcbs;
+    pool_plan_compute(p, &config);
+
+    ESP_LOGI(TAG, "Pool plan: internal %lu free (largest %lu), PSRAM %lu free; %lu bytes internal per connection",
+             (unsigned long)p->internal_free, (unsigned long)p->internal_largest,
+             (unsigned long)p->psram_free, (unsigned long)p->conn_internal);
+    ESP_LOGI(TAG, "Pool plan: heap allows %d, largest block %d, sockets %d (%d in use + %d for services, "
+             "%d PCBs in use) -> %d slots (limit: %s)",
+             p->by_heap, p->by_block, p->by_sockets, p->sockets_used, service_sockets, p->pcbs_used,
+             p->slots, p->limit);
+}
+
+/** Initialize the buffer pool (sized by the planner; see plan_buffer_pool for the arguments) */
+static void init_buffer_pool(int service_sockets, int service_pcbs)
 {
     buffer_pool_mutex = xSemaphoreCreateMutex();
     request_log_mutex = xSemaphoreCreateMutex();
-    for (int i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
-        buffer_pool[i].in_use = false;
-    }
     for (int i = 0; i < REQUEST_LOG_SIZE; i++) {
         request_log[i].valid = false;
     }
-    ESP_LOGI(TAG, "Buffer pool initialized: %d slots, %d bytes each",
-             MAX_CONCURRENT_CLIENTS, PROXY_BUFFER_SIZE * 2);
+
+    plan_buffer_pool(service_sockets, service_pcbs);
+    uint32_t caps = pool_plan.buffers_in_psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    int slots = pool_plan.slots;
+    while (slots > 0 && !(buffer_pool = heap_caps_calloc(slots, sizeof(buffer_pair_t), caps))) {
+        slots--;
+    }
+    if (slots != pool_plan.slots) {
+        ESP_LOGW(TAG, "Buffer pool allocation fell short: %d of %d slots", slots, pool_plan.slots);
+        pool_plan.slots = slots;
+        pool_plan.limit = "allocation";
+    }
+    buffer_pool_size = slots;
+    ESP_LOGI(TAG, "Buffer pool initialized: %d slots, %u bytes each (%s)",
+             buffer_pool_size, (unsigned)sizeof(buffer_pair_t), pool_plan.buffers_in_psram ? "PSRAM" : "internal");
 }
 
 /** Acquire a buffer pair from the pool. Returns index or -1 if none available */
@@ -155,28 +413,2488 @@ static int acquire_buffer_pair(void)
 {
     int index = -1;
     if (xSemaphoreTake(buffer_pool_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        for (int i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
+        for (int i = 0; i < buffer_pool_size; i++) {
             if (!buffer_pool[i].in_use) {
-                buffer_pool[i].in_use = true;
+                buffer_pair_t *slot = &buffer_pool[i];
+                slot->in_use = true;
+                slot->phase = CONN_SETUP;
+                slot->force_closed = false;
+                slot->client_sock = -1;
+                slot->upstream_sock = -1;
+                slot->task = xTaskGetCurrentTaskHandle();
+                slot->started_us = esp_timer_get_time();
+                slot->last_progress = xTaskGetTickCount();
+                slot->bytes_in = 0;
+                slot->bytes_out = 0;
+                slot->pending_send = 0;
                 index = i;
                 break;
             }
         }
         xSemaphoreGive(buffer_pool_mutex);
     }
-    return index;
+    return index;
+}
+
+// Count of failed releases (slot stays marked in_use - a leak the self-check will report)
+static volatile uint32_t slot_release_failures = 0;
+
+/** Release a buffer pair back to the pool */
+static void release_buffer_pair(int index)
+{
+    if (index >= 0 && index < buffer_pool_size) {
+        if (xSemaphoreTake(buffer_pool_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+            buffer_pool[index].in_use = false;
+            buffer_pool[index].phase = CONN_FREE;
+            xSemaphoreGive(buffer_pool_mutex);
+        } else {
+            slot_release_failures++;
+            ESP_LOGE(TAG, "Failed to release buffer slot %d (mutex timeout)", index);
+        }
+    }
+}
+
+/** Record the connection's sockets and source on its slot (sock < 0 leaves a leg unchanged) */
+static void conn_set_sockets(int index, int client_sock, int upstream_sock)
+{
+    if (client_sock >= 0) buffer_pool[index].client_sock = client_sock;
+    if (upstream_sock >= 0) buffer_pool[index].upstream_sock = upstream_sock;
+}
+
+/** Note progress (a loop pass or phase change) on a slot for the connection watchdog */
+static inline void conn_progress(int index, conn_phase_t phase)
+{
+    buffer_pool[index].phase = phase;
+    buffer_pool[index].last_progress = xTaskGetTickCount();
+}
+
+/** Count buffer pairs currently free */
+static int count_free_slots(void)
+{
+    int free_slots = 0;
+    if (xSemaphoreTake(buffer_pool_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        for (int i = 0; i < buffer_pool_size; i++) {
+            if (!buffer_pool[i].in_use) free_slots++;
+        }
+        xSemaphoreGive(buffer_pool_mutex);
+    } else {
+        return -1;
+    }
+    return free_slots;
+}
+
+// ===== Socket / Connection Accounting =====
+// Every socket the proxy opens is counted so fd leaks show up as drift from the idle baseline
+static atomic_int open_sockets = 0;
+static atomic_int active_connections = 0;
+static atomic_uint rejected_connections = 0;  // Refused because every buffer slot was in use
+
+// Why proxied connections end; timeouts are split by cause so useless connections show up
+typedef enum {
+    CLOSE_CLIENT = 0,           // Client closed
+    CLOSE_UPSTREAM,             // Upstream closed
+    CLOSE_ERROR,                // Socket error or stalled send
+    CLOSE_DRAIN,                // Closed between exchanges for a restart
+    CLOSE_CONNECT_FAILED,       // Upstream refused / unreachable
+    CLOSE_CONNECT_TIMEOUT,      // Upstream connect exceeded PROXY_CONNECT_TIMEOUT_MS
+    CLOSE_FIRST_BYTE_TIMEOUT,   // Client sent nothing within PROXY_FIRST_BYTE_TIMEOUT_MS
+    CLOSE_HANDSHAKE_TIMEOUT,    // No response byte within PROXY_HANDSHAKE_TIMEOUT_MS
+    CLOSE_IDLE_TIMEOUT,         // No traffic for PROXY_TIMEOUT_MS
+    CLOSE_LIFETIME,             // Open longer than PROXY_MAX_LIFETIME_MS
+    CLOSE_SLOW_CLIENT,          // Trickled a request below PROXY_MIN_CLIENT_RATE_BPS
+    CLOSE_DEAD_CLIENT,          // Client stopped answering keepalive probes / retransmissions
+    CLOSE_DEAD_UPSTREAM,        // Upstream stopped answering keepalive probes / retransmissions
+    CLOSE_STUCK,                // Force-closed by the connection watchdog
+    CLOSE_REASON_COUNT
+} close_reason_t;
+
+static const char *close_reason_names[CLOSE_REASON_COUNT] = {
+    "client", "upstream", "error", "drain", "connect_failed", "connect_timeout",
+    "first_byte_timeout", "handshake_timeout", "idle_timeout", "lifetime", "slow_client",
+    "dead_client", "dead_upstream", "stuck"
+};
+
+// TCP keepalive settings for one route (applied to both its client and upstream legs)
+typedef struct {
+    int idle_sec;       // 0 disables keepalive
+    int intvl_sec;
+    int cnt;
+} keepalive_cfg_t;
+
+static const keepalive_cfg_t powerwall_keepalive = {KEEPALIVE_IDLE_SEC, KEEPALIVE_INTVL_SEC, KEEPALIVE_CNT};
+static atomic_uint close_counts[CLOSE_REASON_COUNT];
+
+/** Record a newly opened socket (call after socket()/accept() succeeds) */
+static void socket_opened(void)
+{
+    atomic_fetch_add(&open_sockets, 1);
+}
+
+/** Close a socket previously recorded with socket_opened() */
+static void close_socket(int sock)
+{
+    if (sock >= 0) {
+        close(sock);
+        atomic_fetch_sub(&open_sockets, 1);
+    }
+}
+
+/** Enable TCP keepalive on a socket with a route's idle/interval/count */
+static void apply_keepalive(int sock, const keepalive_cfg_t *ka)
+{
+    if (ka->idle_sec <= 0) return;
+    int on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) < 0) {
+        ESP_LOGW(TAG, "Failed to enable keepalive: %d", errno);
+        return;
+    }
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &ka->idle_sec, sizeof(ka->idle_sec));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &ka->intvl_sec, sizeof(ka->intvl_sec));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &ka->cnt, sizeof(ka->cnt));
+}
+
+/** True if a socket error means the peer stopped answering (keepalive or retransmit timeout) */
+static bool is_dead_peer_error(int err)
+{
+    // lwIP aborts the pcb on keepalive/retransmit expiry, reported as ECONNABORTED
+    return err == ECONNABORTED || err == ETIMEDOUT;
+}
+
+/** Close a socket with RST instead of FIN, e.g. for clients that should not linger in TIME_WAIT */
+static void reset_socket(int sock)
+{
+    struct linger lg = {.l_onoff = 1, .l_linger = 0};
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close_socket(sock);
+}
+
+/**
+ * Extract a client's IPv4 address (plain or v4-mapped IPv6). Native IPv6 clients get an FNV-1a
+ * hash of the whole address instead: log records only have 32 bits, and the low 32 bits alone
+ * collide between prefixes and look like an IPv4 address.
+ */
+static uint32_t sockaddr_source(const struct sockaddr_storage *addr, bool *is_v6)
+{
+    *is_v6 = false;
+    if (addr->ss_family == AF_INET) {
+        return ((const struct sockaddr_in *)addr)->sin_addr.s_addr;
+    }
+    #if PROXY_IPV6_ENABLED
+    if (addr->ss_family == AF_INET6) {
+        const uint8_t *b = ((const struct sockaddr_in6 *)addr)->sin6_addr.s6_addr;
+        static const uint8_t v4mapped_prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+        if (memcmp(b, v4mapped_prefix, sizeof(v4mapped_prefix)) == 0) {
+            uint32_t v4;
+            memcpy(&v4, b + 12, sizeof(v4));
+            return v4;
+        }
+        uint32_t hash = 2166136261u;
+        for (int i = 0; i < 16; i++) {
+            hash = (hash ^ b[i]) * 16777619u;
+        }
+        *is_v6 = true;
+        return hash;
+    }
+    #endif
+    return 0;
+}
+
+/** Format a socket address as text ("a.b.c.d" or IPv6, v4-mapped shown as IPv4) */
+static void format_sockaddr(const struct sockaddr_storage *addr, char *out, size_t len)
+{
+    bool is_v6;
+    uint32_t ip = sockaddr_source(addr, &is_v6);
+    #if PROXY_IPV6_ENABLED
+    if (is_v6) {
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)addr)->sin6_addr, out, len);
+        return;
+    }
+    #endif
+    inet_ntop(AF_INET, &ip, out, len);
+}
+
+#if FLASH_LOG_ENABLED
+// ===== Persistent Request Log =====
+// Append-only ring of 32-byte records in the FLASH_LOG_PARTITION data partition. Every 4 KB
+// sector ends with a header slot holding a sequence number, so record slots line up with
+// 256-byte flash pages. Sectors are filled in order and the oldest one is erased when the
+// ring wraps, so wear is spread evenly over the partition. There is no wall clock, so records
+// carry a log clock: seconds that continue from the newest record found at mount (downtime is
+// not counted). flash_log_task batches records into page writes; log_request() only queues.
+// A sector erase stalls both cores' flash cache (forwarding and WiFi included) for tens of
+// ms, so the writer erases the next sector ahead of time while the proxy is idle.
+#define FLASH_LOG_SECTOR_SIZE 4096
+#define FLASH_LOG_PAGE_SIZE 256
+#define FLASH_LOG_SLOTS (FLASH_LOG_SECTOR_SIZE / sizeof(flash_log_record_t))
+#define FLASH_LOG_HEADER_SLOT (FLASH_LOG_SLOTS - 1)                             // Last slot is the header
+#define FLASH_LOG_PAGE_RECORDS (FLASH_LOG_PAGE_SIZE / sizeof(flash_log_record_t))
+#define FLASH_LOG_READ_SLOTS 8                                                  // Records per read
+#define FLASH_LOG_MAGIC 0x324F4C52  // "RLO2" (v1 kept the header in slot 0)
+
+_Static_assert(FLASH_LOG_BATCH * sizeof(flash_log_record_t) <= FLASH_LOG_PAGE_SIZE,
+               "FLASH_LOG_BATCH must fit in one flash page");
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t seq;           // Sector sequence number, increases by one per sector started
+    uint8_t reserved[24];
+} flash_log_sector_t;
+
+static const esp_partition_t *flash_log_part = NULL;
+static SemaphoreHandle_t flash_log_mutex = NULL;    // Serialises flash access between writer and readers
+static uint32_t flash_log_sectors = 0;
+static uint32_t flash_log_sector = 0;               // Sector being filled
+static uint32_t flash_log_seq = 0;                  // Its sequence number
+static uint32_t flash_log_slot = 0;                 // Next free slot in it
+static uint32_t flash_log_spare = UINT32_MAX;       // Next sector, if already erased while idle
+static uint32_t flash_log_clock_base = 0;           // Log clock at uptime 0
+static uint16_t flash_log_boot = 0;                 // Boot number stamped on this boot's records
+static uint32_t flash_log_records = 0;              // Records written this boot
+static uint32_t flash_log_page_writes = 0;
+static uint32_t flash_log_erases = 0;
+static uint32_t flash_log_inline_erases = 0;        // Erases that could not be done ahead of time
+static uint32_t flash_log_errors = 0;
+
+/** Current log clock (seconds) */
+static uint32_t flash_log_clock(void)
+{
+    return flash_log_clock_base + (uint32_t)(esp_timer_get_time() / 1000000);
+}
+
+/** CRC over everything but the CRC field */
+static uint16_t flash_log_crc(const flash_log_record_t *rec)
+{
+    return esp_rom_crc16_le(0, (const uint8_t *)rec, offsetof(flash_log_record_t, crc));
+}
+
+/** Slot holds a complete record (not erased, not torn by a reset mid-write) */
+static bool flash_log_valid(const flash_log_record_t *rec)
+{
+    return rec->time != 0xFFFFFFFF && rec->crc == flash_log_crc(rec);
+}
+
+/** Slot was never written since the sector was erased */
+static bool flash_log_erased(const flash_log_record_t *rec)
+{
+    const uint8_t *b = (const uint8_t *)rec;
+    for (size_t i = 0; i < sizeof(*rec); i++) {
+        if (b[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+/** Read slots [slot, slot + count) of a sector */
+static esp_err_t flash_log_read_slots(uint32_t sector, uint32_t slot, flash_log_record_t *out, uint32_t count)
+{
+    return esp_partition_read(flash_log_part, sector * FLASH_LOG_SECTOR_SIZE + slot * sizeof(flash_log_record_t),
+                              out, count * sizeof(flash_log_record_t));
+}
+
+/** Sequence number of a sector, or 0 if it holds no log data */
+static uint32_t flash_log_sector_seq(uint32_t sector)
+{
+    flash_log_sector_t hdr;
+    if (flash_log_read_slots(sector, FLASH_LOG_HEADER_SLOT, (flash_log_record_t *)&hdr, 1) != ESP_OK) return 0;
+    return (hdr.magic == FLASH_LOG_MAGIC && hdr.seq != 0xFFFFFFFF) ? hdr.seq : 0;
+}
+
+/** Erase a sector (flash cache is disabled on both cores while this runs) */
+static esp_err_t flash_log_erase(uint32_t sector)
+{
+    flash_log_erases++;
+    return esp_partition_erase_range(flash_log_part, sector * FLASH_LOG_SECTOR_SIZE, FLASH_LOG_SECTOR_SIZE);
+}
+
+/** Stamp a sector's header and make it the write target, erasing it unless done ahead of time */
+static void flash_log_start_sector(uint32_t sector, uint32_t seq)
+{
+    flash_log_sector_t hdr;
+    memset(&hdr, 0xFF, sizeof(hdr));
+    hdr.magic = FLASH_LOG_MAGIC;
+    hdr.seq = seq;
+
+    esp_err_t err = ESP_OK;
+    if (sector != flash_log_spare) {
+        flash_log_inline_erases++;
+        err = flash_log_erase(sector);
+    }
+    flash_log_spare = UINT32_MAX;
+    if (err == ESP_OK) {
+        err = esp_partition_write(flash_log_part, sector * FLASH_LOG_SECTOR_SIZE +
+                                  FLASH_LOG_HEADER_SLOT * sizeof(flash_log_record_t), &hdr, sizeof(hdr));
+    }
+    if (err != ESP_OK) {
+        flash_log_errors++;
+        ESP_LOGW(TAG, "Request log: starting sector %lu failed: %s", (unsigned long)sector, esp_err_to_name(err));
+    }
+    flash_log_sector = sector;
+    flash_log_seq = seq;
+    flash_log_slot = 0;
+}
+
+/** Erase the sector after the write target ahead of time (drops the oldest sector early) */
+static void flash_log_prepare_next(void)
+{
+    uint32_t next = (flash_log_sector + 1) % flash_log_sectors;
+    if (flash_log_spare == next) return;
+
+    xSemaphoreTake(flash_log_mutex, portMAX_DELAY);
+    if (flash_log_erase(next) == ESP_OK) {
+        flash_log_spare = next;
+    } else {
+        flash_log_errors++;
+    }
+    xSemaphoreGive(flash_log_mutex);
+}
+
+/** Scan a sector: returns the first never-written slot; *last gets the newest valid record */
+static uint32_t flash_log_scan(uint32_t sector, flash_log_record_t *last, bool *found)
+{
+    flash_log_record_t recs[FLASH_LOG_READ_SLOTS];
+    for (uint32_t slot = 0; slot < FLASH_LOG_HEADER_SLOT; slot += FLASH_LOG_READ_SLOTS) {
+        uint32_t n = FLASH_LOG_HEADER_SLOT - slot < FLASH_LOG_READ_SLOTS ? FLASH_LOG_HEADER_SLOT - slot : FLASH_LOG_READ_SLOTS;
+        if (flash_log_read_slots(sector, slot, recs, n) != ESP_OK) return FLASH_LOG_HEADER_SLOT;
+        for (uint32_t i = 0; i < n; i++) {
+            if (flash_log_erased(&recs[i])) return slot + i;
+            if (flash_log_valid(&recs[i])) {
+                *last = recs[i];
+                *found = true;
+            }
+        }
+    }
+    return FLASH_LOG_HEADER_SLOT;
+}
+
+/** Records that fit before the end of the current flash page (or sector) */
+static uint32_t flash_log_page_room(void)
+{
+    uint32_t slot = flash_log_slot >= FLASH_LOG_HEADER_SLOT ? 0 : flash_log_slot;
+    uint32_t room = FLASH_LOG_PAGE_RECORDS - slot % FLASH_LOG_PAGE_RECORDS;
+    if (room > FLASH_LOG_HEADER_SLOT - slot) room = FLASH_LOG_HEADER_SLOT - slot;
+    return room;
+}
+
+/** Append records one page program at a time, moving on to the next sector as each one fills */
+static void flash_log_write(const flash_log_record_t *recs, uint32_t count)
+{
+    xSemaphoreTake(flash_log_mutex, portMAX_DELAY);
+    while (count > 0) {
+        if (flash_log_slot >= FLASH_LOG_HEADER_SLOT) {
+            flash_log_start_sector((flash_log_sector + 1) % flash_log_sectors, flash_log_seq + 1);
+        }
+        uint32_t room = flash_log_page_room();
+        uint32_t n = room < count ? room : count;
+        esp_err_t err = esp_partition_write(flash_log_part,
+                                            flash_log_sector * FLASH_LOG_SECTOR_SIZE + flash_log_slot * sizeof(flash_log_record_t),
+                                            recs, n * sizeof(flash_log_record_t));
+        if (err != ESP_OK) flash_log_errors++;
+        flash_log_page_writes++;
+        flash_log_slot += n;
+        flash_log_records += n;
+        recs += n;
+        count -= n;
+    }
+    xSemaphoreGive(flash_log_mutex);
+}
+
+// Record position: sector sequence number x record slots + slot. Positions only grow, across
+// reboots and ring wraps, so they serve as export cursors.
+#define FLASH_LOG_POS(seq, slot) ((seq) * (uint32_t)FLASH_LOG_HEADER_SLOT + (slot))
+
+/** Callback for flash_log_read_range (pos is the record position); return false to stop reading */
+typedef bool (*flash_log_reader_t)(const flash_log_record_t *rec, uint32_t pos, void *ctx);
+
+/**
+ * Read records with a log time in [from, to] and a position above `after`, oldest first.
+ * Sectors that end before `from` are skipped by peeking at the next sector's first record, and
+ * sectors whose last position is at or below `after` by their sequence number. The mutex is
+ * only held for each small read, so the callback may block (e.g. on a socket). Returns the
+ * records delivered.
+ */
+static uint32_t flash_log_read_range(uint32_t from, uint32_t to, uint32_t after, flash_log_reader_t cb, void *ctx)
+{
+    if (!flash_log_part) return 0;
+
+    uint32_t delivered = 0;
+    uint32_t last_time = 0;
+    uint32_t head = flash_log_sector;
+    flash_log_record_t recs[FLASH_LOG_READ_SLOTS];
+
+    // Oldest sector is the one after the write target (unused sectors are skipped)
+    for (uint32_t i = 1; i <= flash_log_sectors; i++) {
+        uint32_t sector = (head + i) % flash_log_sectors;
+
+        xSemaphoreTake(flash_log_mutex, portMAX_DELAY);
+        uint32_t seq = flash_log_sector_seq(sector);
+        uint32_t head_seq = flash_log_seq;
+        bool skip = seq == 0 || seq > head_seq || FLASH_LOG_POS(seq, FLASH_LOG_HEADER_SLOT - 1) <= after;
+        if (!skip && sector != head) {
+            uint32_t next = (sector + 1) % flash_log_sectors;
+            flash_log_record_t first;
+            skip = flash_log_sector_seq(next) == seq + 1 &&
+                   flash_log_read_slots(next, 0, &first, 1) == ESP_OK &&
+                   flash_log_valid(&first) && first.time < from;
+        }
+        xSemaphoreGive(flash_log_mutex);
+        if (skip) continue;
+
+        for (uint32_t slot = 0; slot < FLASH_LOG_HEADER_SLOT; slot += FLASH_LOG_READ_SLOTS) {
+            uint32_t n = FLASH_LOG_HEADER_SLOT - slot < FLASH_LOG_READ_SLOTS ? FLASH_LOG_HEADER_SLOT - slot : FLASH_LOG_READ_SLOTS;
+            xSemaphoreTake(flash_log_mutex, portMAX_DELAY);
+            // The writer may have wrapped onto this sector since it was checked
+            bool ok = flash_log_sector_seq(sector) == seq && flash_log_read_slots(sector, slot, recs, n) == ESP_OK;
+            xSemaphoreGive(flash_log_mutex);
+            if (!ok) break;
+
+            for (uint32_t r = 0; r < n; r++) {
+                if (flash_log_erased(&recs[r])) break;
+                if (!flash_log_valid(&recs[r]) || recs[r].time < last_time) continue;
+                if (recs[r].time > to) return delivered;
+                last_time = recs[r].time;
+                uint32_t pos = FLASH_LOG_POS(seq, slot + r);
+                if (recs[r].time < from || pos <= after) continue;
+                delivered++;
+                if (!cb(&recs[r], pos, ctx)) return delivered;
+            }
+        }
+    }
+    return delivered;
+}
+
+/** Stamp a queued record with the log clock, boot number and CRC */
+static void flash_log_seal(flash_log_record_t *rec)
+{
+    rec->time += flash_log_clock_base;  // Queued with uptime seconds
+    rec->boot = flash_log_boot;
+    memset(rec->reserved, 0, sizeof(rec->reserved));
+    rec->crc = flash_log_crc(rec);
+}
+
+/** Background writer: batches queued records (plus periodic metric snapshots) into page writes.
+ *  A batch is flushed when it reaches the end of the current flash page, so writes stay aligned. */
+static void flash_log_task(void *pvParameters)
+{
+    flash_log_record_t batch[FLASH_LOG_BATCH];
+    uint32_t pending = 0;
+    int64_t first_pending_us = 0;
+    #if FLASH_LOG_METRIC_INTERVAL_SEC > 0
+    int64_t next_metric_us = esp_timer_get_time() + FLASH_LOG_METRIC_INTERVAL_SEC * 1000000LL;
+    #endif
+
+    while (1) {
+        flash_log_record_t rec;
+        bool have = xQueueReceive(flash_log_queue, &rec, pdMS_TO_TICKS(1000)) == pdTRUE;
+        int64_t now = esp_timer_get_time();
+
+        if (have) {
+            flash_log_seal(&rec);
+            if (pending == 0) first_pending_us = now;
+            batch[pending++] = rec;
+            if (pending >= FLASH_LOG_BATCH || pending >= flash_log_page_room()) {
+                flash_log_write(batch, pending);
+                pending = 0;
+            }
+        }
+
+        #if FLASH_LOG_METRIC_INTERVAL_SEC > 0
+        if (now >= next_metric_us) {
+            memset(&rec, 0, sizeof(rec));
+            rec.time = now / 1000000;
+            rec.type = FLASH_REC_METRIC;
+            rec.metric.free_heap = esp_get_free_heap_size();
+            rec.metric.min_free_heap = esp_get_minimum_free_heap_size();
+            rec.metric.rejected = atomic_load(&rejected_connections);
+            rec.metric.active = atomic_load(&active_connections);
+            rec.metric.cpu = cpu_usage_percent;
+            flash_log_seal(&rec);
+            if (pending == 0) first_pending_us = now;
+            batch[pending++] = rec;
+            next_metric_us += FLASH_LOG_METRIC_INTERVAL_SEC * 1000000LL;
+        }
+        #endif
+
+        if (pending >= FLASH_LOG_BATCH || (pending > 0 && pending >= flash_log_page_room()) ||
+            (pending > 0 && now - first_pending_us >= FLASH_LOG_FLUSH_SEC * 1000000LL)) {
+            flash_log_write(batch, pending);
+            pending = 0;
+        }
+
+        // Erase the next sector now, while nothing is being forwarded, rather than on the
+        // write that fills the current one
+        if (!have && atomic_load(&active_connections) == 0) {
+            flash_log_prepare_next();
+        }
+    }
+}
+
+/** Mount the ring (find the newest sector and the write position) and start the writer */
+static void init_flash_log(void)
+{
+    flash_log_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FLASH_LOG_PARTITION);
+    if (!flash_log_part) {
+        ESP_LOGW(TAG, "No '%s' partition - persistent request log disabled (flash the partition table over USB)",
+                 FLASH_LOG_PARTITION);
+        return;
+    }
+    flash_log_sectors = flash_log_part->size / FLASH_LOG_SECTOR_SIZE;
+    flash_log_mutex = xSemaphoreCreateMutex();
+    flash_log_queue = xQueueCreate(FLASH_LOG_QUEUE_LEN, sizeof(flash_log_record_t));
+    if (!flash_log_mutex || !flash_log_queue || flash_log_sectors < 2) {
+        ESP_LOGE(TAG, "Persistent request log disabled (setup failed)");
+        flash_log_part = NULL;
+        flash_log_queue = NULL;
+        return;
+    }
+
+    uint32_t newest = 0, newest_seq = 0;
+    for (uint32_t s = 0; s < flash_log_sectors; s++) {
+        uint32_t seq = flash_log_sector_seq(s);
+        if (seq > newest_seq) {
+            newest = s;
+            newest_seq = seq;
+        }
+    }
+
+    if (newest_seq == 0) {
+        flash_log_start_sector(0, 1);
+        ESP_LOGI(TAG, "Request log: formatted %lu sectors in '%s'", (unsigned long)flash_log_sectors, FLASH_LOG_PARTITION);
+    } else {
+        flash_log_record_t last;
+        bool found = false;
+        flash_log_sector = newest;
+        flash_log_seq = newest_seq;
+        flash_log_slot = flash_log_scan(newest, &last, &found);
+        if (!found) {
+            uint32_t prev = (newest + flash_log_sectors - 1) % flash_log_sectors;
+            if (flash_log_sector_seq(prev) == newest_seq - 1) flash_log_scan(prev, &last, &found);
+        }
+        if (found) {
+            flash_log_clock_base = last.time + 1;
+            flash_log_boot = last.boot + 1;
+        }
+    }
+
+    ESP_LOGI(TAG, "Request log: sector %lu slot %lu, boot %u, clock %lu s (%lu records capacity)",
+             (unsigned long)flash_log_sector, (unsigned long)flash_log_slot, flash_log_boot,
+             (unsigned long)flash_log_clock_base, (unsigned long)((flash_log_sectors - 1) * FLASH_LOG_HEADER_SLOT));
+    xTaskCreate(flash_log_task, "flash_log", 3072, NULL, 2, NULL);
+}
+#endif
+
+// ===== Source ACL =====
+// Longest-prefix match over SOURCE_ACL, evaluated right after accept() so denied clients
+// never get a task or buffer slot. Rules are kept sorted by prefix length (longest first);
+// parsing and matching live in bridge_logic.h.
+static acl_rule_t acl_rules[SOURCE_ACL_MAX_RULES];
+static atomic_uint acl_hits[SOURCE_ACL_MAX_RULES];
+static int acl_rule_count = 0;
+static atomic_uint acl_default_hits = 0;
+static atomic_uint acl_denied = 0;
+
+/** Parse SOURCE_ACL ("+net/len,-net/len,...") into the sorted rule table */
+static void init_source_acl(void)
+{
+    char list[] = SOURCE_ACL;
+    char *save = NULL;
+    for (char *tok = strtok_r(list, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        acl_rule_t rule;
+        if (!acl_parse_rule(tok, &rule)) {
+            ESP_LOGW(TAG, "Invalid ACL rule: %s", tok);
+            continue;
+        }
+        if (!acl_insert_rule(acl_rules, &acl_rule_count, SOURCE_ACL_MAX_RULES, &rule)) {
+            ESP_LOGW(TAG, "ACL full - ignoring %s", tok);
+        }
+    }
+
+    ESP_LOGI(TAG, "Source ACL: %d rule(s), default %s", acl_rule_count,
+             SOURCE_ACL_DEFAULT_ALLOW ? "allow" : "deny");
+}
+
+/** Check an accepted client's address against the ACL (counts the verdict) */
+static bool source_acl_allows(const struct sockaddr_storage *addr)
+{
+    bool is_v6;
+    uint32_t ip = ntohl(sockaddr_source(addr, &is_v6));
+    bool allowed = SOURCE_ACL_DEFAULT_ALLOW;
+
+    if (is_v6) {
+        allowed = SOURCE_ACL_ALLOW_IPV6;
+    } else {
+        int i = acl_match(acl_rules, acl_rule_count, ip);
+        if (i >= 0) {
+            atomic_fetch_add(&acl_hits[i], 1);
+            allowed = acl_rules[i].allow;
+        } else {
+            atomic_fetch_add(&acl_default_hits, 1);
+        }
+    }
+
+    if (!allowed) {
+        atomic_fetch_add(&acl_denied, 1);
+    }
+    return allowed;
+}
+
+// ===== Accept Control =====
+// Each listener takes a token per admitted connection (sustained ACCEPT_RATE_PER_SEC, bursts of
+// ACCEPT_BURST) so a connection storm queues in the backlog instead of spawning tasks; clients
+// the source ACL denies are reset without taking one. The listener also backs off
+// exponentially when accept() itself keeps failing (e.g. out of sockets).
+typedef struct {
+    int64_t last_refill_us;
+    uint32_t tokens_milli;  // Tokens x 1000
+} accept_bucket_t;
+
+static atomic_uint accept_total = 0;
+static atomic_uint accept_throttled = 0;      // Accepts delayed waiting for a token
+static atomic_uint accept_errors = 0;
+static atomic_uint accept_backlog_full = 0;   // Queue reached PROXY_LISTEN_BACKLOG (lwIP drops further SYNs)
+static atomic_uint accept_latency_avg_us = 0; // Listener readable -> connection accepted (EWMA)
+static atomic_uint accept_latency_max_us = 0;
+
+#if ACCEPT_RATE_PER_SEC > 0
+/** Take one accept token; returns 0, or the milliseconds until the next token */
+static uint32_t accept_bucket_take(accept_bucket_t *b)
+{
+    int64_t now_us = esp_timer_get_time();
+    uint64_t tokens = b->tokens_milli + (uint64_t)(now_us - b->last_refill_us) * ACCEPT_RATE_PER_SEC / 1000;
+    b->tokens_milli = tokens > ACCEPT_BURST * 1000 ? ACCEPT_BURST * 1000 : (uint32_t)tokens;
+    b->last_refill_us = now_us;
+
+    if (b->tokens_milli >= 1000) {
+        b->tokens_milli -= 1000;
+        return 0;
+    }
+    return (1000 - b->tokens_milli) / ACCEPT_RATE_PER_SEC + 1;
+}
+#endif
+
+/** Record the time a ready connection waited before being accepted */
+static void record_accept_latency(uint32_t latency_us)
+{
+    uint32_t avg = atomic_load(&accept_latency_avg_us);
+    atomic_store(&accept_latency_avg_us, avg ? avg - avg / 8 + latency_us / 8 : latency_us);
+    if (latency_us > atomic_load(&accept_latency_max_us)) {
+        atomic_store(&accept_latency_max_us, latency_us);
+    }
+}
+
+/** Wait up to timeout_ms for a pending connection on a listening socket */
+static bool listener_ready(int listen_sock, uint32_t timeout_ms)
+{
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(listen_sock, &read_fds);
+    struct timeval tv = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+    return select(listen_sock + 1, &read_fds, NULL, NULL, &tv) > 0;
+}
+
+// ===== Connection Watchdog =====
+// Flags connections that made no progress (no forwarding loop pass or phase change) for
+// CONN_STUCK_THRESHOLD_MS, records diagnostics and force-closes them: both sockets are shut
+// down so the owning task's blocked call fails and it unwinds, freeing its slot normally.
+#define STUCK_LOG_SIZE 8
+
+typedef struct {
+    int64_t timestamp;          // Seconds since boot
+    uint32_t source_ip;
+    uint32_t age_ms;
+    uint32_t stalled_ms;
+    uint32_t bytes_in;
+    uint32_t bytes_out;
+    uint32_t pending_send;
+    int client_err;             // SO_ERROR per leg (-1 = no socket)
+    int upstream_err;
+    int client_rx_queued;       // FIONREAD per leg (-1 = unavailable)
+    int upstream_rx_queued;
+    uint32_t stack_free;        // Task stack high-water mark (bytes)
+    uint32_t recovered_ms;      // Force close -> slot freed (0 = not yet)
+    TaskHandle_t task;
+    uint8_t slot;
+    uint8_t phase;
+    bool source_v6;
+    bool valid;
+} stuck_incident_t;
+
+static stuck_incident_t stuck_log[STUCK_LOG_SIZE];
+static int stuck_log_index = 0;
+static atomic_uint stuck_flagged = 0;
+static atomic_uint stuck_recovered = 0;
+static atomic_uint stuck_unrecovered = 0;  // Task still held its slot a full threshold after the force close
+
+/** Socket error and receive queue depth for a diagnostic dump */
+static void sock_diag(int sock, int *err, int *rx_queued)
+{
+    *err = -1;
+    *rx_queued = -1;
+    if (sock < 0) return;
+
+    socklen_t len = sizeof(*err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, err, &len) != 0) *err = errno;
+    int queued = 0;
+    if (ioctl(sock, FIONREAD, &queued) == 0) *rx_queued = queued;
+}
+
+/** Record diagnostics for a stalled slot and shut its sockets down (buffer pool mutex held) */
+static void flag_stuck_connection(int i, uint32_t stalled_ms)
+{
+    buffer_pair_t *slot = &buffer_pool[i];
+    stuck_incident_t *inc = &stuck_log[stuck_log_index];
+    memset(inc, 0, sizeof(*inc));
+    inc->timestamp = esp_timer_get_time() / 1000000;
+    inc->slot = i;
+    inc->phase = slot->phase;
+    inc->task = slot->task;
+    inc->source_ip = slot->source_ip;
+    inc->source_v6 = slot->source_v6;
+    inc->age_ms = (uint32_t)((esp_timer_get_time() - slot->started_us) / 1000);
+    inc->stalled_ms = stalled_ms;
+    inc->bytes_in = slot->bytes_in;
+    inc->bytes_out = slot->bytes_out;
+    inc->pending_send = slot->pending_send;
+    sock_diag(slot->client_sock, &inc->client_err, &inc->client_rx_queued);
+    sock_diag(slot->upstream_sock, &inc->upstream_err, &inc->upstream_rx_queued);
+    inc->stack_free = uxTaskGetStackHighWaterMark(slot->task);  // Bytes on ESP-IDF
+    inc->valid = true;
+    stuck_log_index = (stuck_log_index + 1) % STUCK_LOG_SIZE;
+    atomic_fetch_add(&stuck_flagged, 1);
+
+    ESP_LOGE(TAG, "Stuck connection in slot %d (%s, task %s): no progress for %lu ms, age %lu ms, "
+             "%lu/%lu bytes, %lu pending, sock err %d/%d, rx queued %d/%d, stack free %lu",
+             i, conn_phase_names[inc->phase], pcTaskGetName(slot->task), (unsigned long)stalled_ms,
+             (unsigned long)inc->age_ms, (unsigned long)inc->bytes_in, (unsigned long)inc->bytes_out,
+             (unsigned long)inc->pending_send, inc->client_err, inc->upstream_err,
+             inc->client_rx_queued, inc->upstream_rx_queued, (unsigned long)inc->stack_free);
+
+    // Sockets are closed only after the slot is released, so they are still ours here
+    slot->force_closed = true;
+    if (slot->client_sock >= 0) shutdown(slot->client_sock, SHUT_RDWR);
+    if (slot->upstream_sock >= 0) shutdown(slot->upstream_sock, SHUT_RDWR);
+}
+
+/** Connection watchdog task - checks every slot's progress once per second */
+static void conn_watchdog_task(void *pvParameters)
+{
+    const TickType_t threshold = pdMS_TO_TICKS(CONN_STUCK_THRESHOLD_MS);
+    bool unrecovered_reported[MAX_CONCURRENT_CLIENTS] = {false};
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        if (xSemaphoreTake(buffer_pool_mutex, pdMS_TO_TICKS(100)) != pdTRUE) continue;
+
+        TickType_t now = xTaskGetTickCount();
+        for (int i = 0; i < buffer_pool_size; i++) {
+            buffer_pair_t *slot = &buffer_pool[i];
+            if (!slot->in_use || !slot->force_closed) unrecovered_reported[i] = false;
+            if (!slot->in_use || now - slot->last_progress <= threshold) continue;
+
+            if (!slot->force_closed) {
+                flag_stuck_connection(i, (now - slot->last_progress) * portTICK_PERIOD_MS);
+            } else if (now - slot->last_progress > 2 * threshold && !unrecovered_reported[i]) {
+                // Shutdown did not unwind it; leave the task alone (it may hold locks) but report once
+                ESP_LOGE(TAG, "Stuck connection in slot %d did not exit after force close", i);
+                atomic_fetch_add(&stuck_unrecovered, 1);
+                unrecovered_reported[i] = true;
+            }
+        }
+
+        // Incidents whose task has since released its slot count as recovered
+        int64_t now_s = esp_timer_get_time() / 1000000;
+        for (int n = 0; n < STUCK_LOG_SIZE; n++) {
+            stuck_incident_t *inc = &stuck_log[n];
+            if (!inc->valid || inc->recovered_ms || !inc->task) continue;
+            buffer_pair_t *slot = &buffer_pool[inc->slot];
+            if (!slot->in_use || slot->task != inc->task) {
+                inc->recovered_ms = (uint32_t)((now_s - inc->timestamp) * 1000) + 1;
+                inc->task = NULL;
+                atomic_fetch_add(&stuck_recovered, 1);
+            }
+        }
+        xSemaphoreGive(buffer_pool_mutex);
+    }
+}
+
+// ===== Self-Check =====
+// Asserts that free slots, open sockets and the largest free heap block return to their
+// idle baseline. Violations are kept in a small ring and reported via /api/selfcheck.
+#define SELFCHECK_LOG_SIZE 8
+
+typedef enum {
+    SELFCHECK_SLOT_LEAK = 0,
+    SELFCHECK_SOCKET_LEAK,
+    SELFCHECK_HEAP_DRIFT,
+    SELFCHECK_RELEASE_FAIL,
+    SELFCHECK_TYPE_COUNT
+} selfcheck_type_t;
+
+static const char *selfcheck_names[SELFCHECK_TYPE_COUNT] = {"slot_leak", "socket_leak", "heap_drift", "release_fail"};
+
+typedef struct {
+    int64_t timestamp;      // Seconds since boot
+    int32_t expected;       // Baseline value
+    int32_t actual;         // Observed value
+    uint8_t type;           // selfcheck_type_t
+    bool valid;
+} selfcheck_violation_t;
+
+static selfcheck_violation_t selfcheck_log[SELFCHECK_LOG_SIZE];
+static int selfcheck_log_index = 0;
+static uint32_t selfcheck_counts[SELFCHECK_TYPE_COUNT];
+static uint32_t selfcheck_runs = 0;
+static uint32_t selfcheck_busy_skips = 0;
+static bool selfcheck_last_ok = true;
+static int selfcheck_baseline_sockets = -1;
+static uint32_t selfcheck_baseline_block = 0;
+static SemaphoreHandle_t selfcheck_mutex = NULL;
+
+/** Record a self-check violation */
+static void selfcheck_report(selfcheck_type_t type, int32_t expected, int32_t actual)
+{
+    ESP_LOGW(TAG, "Self-check violation: %s (expected %ld, actual %ld)",
+             selfcheck_names[type], (long)expected, (long)actual);
+    if (xSemaphoreTake(selfcheck_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        selfcheck_violation_t *v = &selfcheck_log[selfcheck_log_index];
+        v->timestamp = esp_timer_get_time() / 1000000;
+        v->expected = expected;
+        v->actual = actual;
+        v->type = type;
+        v->valid = true;
+        selfcheck_log_index = (selfcheck_log_index + 1) % SELFCHECK_LOG_SIZE;
+        selfcheck_counts[type]++;
+        xSemaphoreGive(selfcheck_mutex);
+    }
+}
+
+/** Wait (bounded) for a moment with no proxied connections. Returns true if idle */
+static bool selfcheck_wait_idle(int max_wait_ms)
+{
+    for (int waited = 0; waited < max_wait_ms; waited += 100) {
+        if (atomic_load(&active_connections) == 0) return true;
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    return atomic_load(&active_connections) == 0;
+}
+
+/** Self-check task - periodically verifies slots, sockets and heap return to baseline when idle */
+static void selfcheck_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "Self-check started (interval: %d seconds)", SELFCHECK_INTERVAL_SEC);
+    selfcheck_mutex = xSemaphoreCreateMutex();
+    uint32_t prev_release_failures = 0;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(SELFCHECK_INTERVAL_SEC * 1000));
+
+        // Release failures are reported regardless of load
+        uint32_t release_failures = slot_release_failures;
+        bool ok = true;
+        if (release_failures != prev_release_failures) {
+            selfcheck_report(SELFCHECK_RELEASE_FAIL, prev_release_failures, release_failures);
+            prev_release_failures = release_failures;
+            ok = false;
+        }
+
+        // Leak invariants only hold while no connection is in flight
+        if (!selfcheck_wait_idle(10000)) {
+            selfcheck_busy_skips++;
+            if (!ok) selfcheck_last_ok = false;
+            continue;
+        }
+
+        int sockets = atomic_load(&open_sockets);
+        uint32_t largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+        // First idle sample defines the baseline
+        if (selfcheck_baseline_sockets < 0) {
+            selfcheck_baseline_sockets = sockets;
+            selfcheck_baseline_block = largest_block;
+            ESP_LOGI(TAG, "Self-check baseline: %d sockets, largest free block %lu bytes",
+                     sockets, (unsigned long)largest_block);
+            selfcheck_runs++;
+            continue;
+        }
+
+        int free_slots = count_free_slots();
+        if (free_slots != buffer_pool_size || sockets != selfcheck_baseline_sockets) {
+            // Connectivity checks briefly hold a socket - confirm after they would have finished
+            vTaskDelay(pdMS_TO_TICKS(3000));
+            if (!selfcheck_wait_idle(100)) {
+                selfcheck_busy_skips++;
+                continue;
+            }
+            free_slots = count_free_slots();
+            sockets = atomic_load(&open_sockets);
+            if (free_slots != buffer_pool_size) {
+                selfcheck_report(SELFCHECK_SLOT_LEAK, buffer_pool_size, free_slots);
+                ok = false;
+            }
+            if (sockets != selfcheck_baseline_sockets) {
+                selfcheck_report(SELFCHECK_SOCKET_LEAK, selfcheck_baseline_sockets, sockets);
+                ok = false;
+            }
+        }
+
+        if (largest_block + SELFCHECK_HEAP_DRIFT_BYTES < selfcheck_baseline_block) {
+            selfcheck_report(SELFCHECK_HEAP_DRIFT, selfcheck_baseline_block, largest_block);
+            ok = false;
+        }
+
+        selfcheck_runs++;
+        selfcheck_last_ok = ok;
+    }
+}
+
+// ===== Upstream Address =====
+
+/** Parse the configured Powerwall address (the only inet_pton for the upstream) */
+static void init_upstream_addr(void)
+{
+    upstream_addr.sin_family = AF_INET;
+    upstream_addr.sin_port = htons(443);
+    inet_pton(AF_INET, POWERWALL_IP_STR, &upstream_addr.sin_addr);
+}
+
+/** Format the current upstream IP into buf (at least 16 bytes) */
+static const char *upstream_ip_string(char *buf, size_t len)
+{
+    struct in_addr addr = {.s_addr = upstream_addr.sin_addr.s_addr};
+    inet_ntoa_r(addr, buf, len);
+    return buf;
+}
+
+/** Adopt the WiFi gateway as upstream (unless overridden); ip in network byte order */
+static void set_upstream_from_gateway(uint32_t gw)
+{
+    if (POWERWALL_IP_OVERRIDE || gw == 0) return;
+    upstream_from_dhcp = true;
+    if (gw == upstream_addr.sin_addr.s_addr) return;
+
+    upstream_addr.sin_addr.s_addr = gw;
+    char ip_str[16];
+    upstream_ip_string(ip_str, sizeof(ip_str));
+    ESP_LOGI(TAG, "Upstream set to WiFi gateway %s", ip_str);
+    mdns_service_txt_item_set(MDNS_SERVICE, MDNS_PROTOCOL, "target", ip_str);
+}
+
+// ===== Upstream Endpoints =====
+// Ordered list of ways to reach the Powerwall (UPSTREAM_ENDPOINTS), each over WiFi or Ethernet.
+// Every connect and periodic probe updates a 0-100 health score and a connect-latency EWMA;
+// new connections use the cheapest healthy endpoint and switchovers are logged.
+#define UPSTREAM_SWITCH_LOG_SIZE 8
+
+typedef struct {
+    struct sockaddr_in addr;    // Ignored for the gateway entry (follows upstream_addr)
+    bool use_gateway;
+    bool via_eth;
+    uint8_t score;              // Health 0-100
+    uint16_t latency_ms;        // Connect time EWMA
+    uint32_t successes;
+    uint32_t failures;
+    // ARP state, maintained by arp_refresh_task
+    uint8_t mac[6];
+    bool mac_valid;
+    bool arp_pinned;
+    uint32_t pinned_ip;         // Address the static entry was added for
+    uint32_t arp_successes;     // successes / failures at the last ARP pass
+    uint32_t arp_failures;
+} upstream_endpoint_t;
+
+typedef struct {
+    int64_t timestamp;          // Seconds since boot
+    uint8_t from;
+    uint8_t to;
+    bool unhealthy;             // Switched because the previous endpoint failed (else: cheaper)
+    bool valid;
+} upstream_switch_t;
+
+static upstream_endpoint_t upstream_endpoints[UPSTREAM_MAX_ENDPOINTS];
+static int upstream_endpoint_count = 0;
+static int upstream_active = 0;
+static upstream_switch_t upstream_switch_log[UPSTREAM_SWITCH_LOG_SIZE];
+static int upstream_switch_index = 0;
+static uint32_t upstream_switches = 0;
+static SemaphoreHandle_t upstream_mutex = NULL;
+
+/** Parse UPSTREAM_ENDPOINTS ("host:port@wifi|eth,...") into the endpoint list */
+static void init_upstream_endpoints(void)
+{
+    upstream_mutex = xSemaphoreCreateMutex();
+
+    char list[] = UPSTREAM_ENDPOINTS;
+    char *save = NULL;
+    for (char *tok = strtok_r(list, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (upstream_endpoint_count >= UPSTREAM_MAX_ENDPOINTS) {
+            ESP_LOGW(TAG, "Upstream list full - ignoring %s", tok);
+            continue;
+        }
+
+        char host[16], via[8] = "wifi";
+        unsigned int port = 0;
+        upstream_endpoint_t *ep = &upstream_endpoints[upstream_endpoint_count];
+        memset(ep, 0, sizeof(*ep));
+        if (sscanf(tok, "%15[^:]:%u@%7s", host, &port, via) < 2 || port == 0 || port > 65535 ||
+            (strcmp(via, "wifi") != 0 && strcmp(via, "eth") != 0)) {
+            ESP_LOGW(TAG, "Invalid upstream endpoint: %s", tok);
+            continue;
+        }
+        ep->use_gateway = strcmp(host, "gateway") == 0;
+        if (!ep->use_gateway && inet_pton(AF_INET, host, &ep->addr.sin_addr) != 1) {
+            ESP_LOGW(TAG, "Invalid upstream endpoint: %s", tok);
+            continue;
+        }
+        ep->addr.sin_family = AF_INET;
+        ep->addr.sin_port = htons(port);
+        ep->via_eth = strcmp(via, "eth") == 0;
+        ep->score = 100;
+        upstream_endpoint_count++;
+    }
+
+    // Never run without an upstream
+    if (upstream_endpoint_count == 0) {
+        upstream_endpoint_t *ep = &upstream_endpoints[0];
+        memset(ep, 0, sizeof(*ep));
+        ep->use_gateway = true;
+        ep->addr.sin_family = AF_INET;
+        ep->addr.sin_port = htons(443);
+        ep->score = 100;
+        upstream_endpoint_count = 1;
+    }
+    ESP_LOGI(TAG, "%d upstream endpoint(s) configured", upstream_endpoint_count);
+}
+
+/** Resolve an endpoint's current address; returns the netif to bind to */
+static esp_netif_t *upstream_endpoint_target(int i, struct sockaddr_in *addr)
+{
+    const upstream_endpoint_t *ep = &upstream_endpoints[i];
+    *addr = ep->addr;
+    if (ep->use_gateway) {
+        addr->sin_addr.s_addr = upstream_addr.sin_addr.s_addr;
+    }
+    return ep->via_eth ? eth_netif : wifi_netif;
+}
+
+/** Format an endpoint as "ip:port@wifi|eth" */
+static void upstream_endpoint_label(int i, char *buf, size_t len)
+{
+    struct sockaddr_in addr;
+    upstream_endpoint_target(i, &addr);
+    char ip_str[16];
+    inet_ntoa_r(addr.sin_addr, ip_str, sizeof(ip_str));
+    snprintf(buf, len, "%s:%u@%s", ip_str, ntohs(addr.sin_port), upstream_endpoints[i].via_eth ? "eth" : "wifi");
+}
+
+/** Relative cost of an endpoint (lower is better): latency, lost health and list position */
+static uint32_t upstream_endpoint_cost(int i)
+{
+    const upstream_endpoint_t *ep = &upstream_endpoints[i];
+    return ep->latency_ms + (100 - ep->score) * 10 + i * UPSTREAM_ORDER_BIAS_MS;
+}
+
+/** Pick the endpoint for a new connection, switching (and logging it) if needed.
+ *  Endpoints in failed_mask (just failed for this connection) are treated as unhealthy. */
+static int select_upstream(uint32_t failed_mask)
+{
+    if (upstream_endpoint_count == 1 || !upstream_mutex) return 0;
+    xSemaphoreTake(upstream_mutex, portMAX_DELAY);
+
+    int current = upstream_active;
+    bool current_healthy = upstream_endpoints[current].score >= UPSTREAM_HEALTHY_SCORE &&
+                           !(failed_mask & (1u << current));
+    int best = -1;
+    for (int i = 0; i < upstream_endpoint_count; i++) {
+        if (upstream_endpoints[i].score < UPSTREAM_HEALTHY_SCORE || (failed_mask & (1u << i))) continue;
+        if (best < 0 || upstream_endpoint_cost(i) < upstream_endpoint_cost(best)) best = i;
+    }
+    // Nothing healthy: fall back to the highest-scoring endpoint rather than refuse
+    if (best < 0) {
+        best = current;
+        for (int i = 0; i < upstream_endpoint_count; i++) {
+            if (failed_mask & (1u << i)) continue;
+            if ((failed_mask & (1u << best)) || upstream_endpoints[i].score > upstream_endpoints[best].score) best = i;
+        }
+    }
+
+    if (best != current &&
+        (!current_healthy || upstream_endpoint_cost(best) + UPSTREAM_SWITCH_MARGIN_MS < upstream_endpoint_cost(current))) {
+        upstream_switch_t *sw = &upstream_switch_log[upstream_switch_index];
+        sw->timestamp = esp_timer_get_time() / 1000000;
+        sw->from = current;
+        sw->to = best;
+        sw->unhealthy = !current_healthy;
+        sw->valid = true;
+        upstream_switch_index = (upstream_switch_index + 1) % UPSTREAM_SWITCH_LOG_SIZE;
+        upstream_switches++;
+        upstream_active = best;
+
+        char from_str[32], to_str[32];
+        upstream_endpoint_label(current, from_str, sizeof(from_str));
+        upstream_endpoint_label(best, to_str, sizeof(to_str));
+        ESP_LOGW(TAG, "Upstream switch %s -> %s (%s)", from_str, to_str, current_healthy ? "cheaper" : "unhealthy");
+    }
+
+    int selected = upstream_active;
+    xSemaphoreGive(upstream_mutex);
+    return selected;
+}
+
+/** Update an endpoint's health from a connect attempt */
+static void record_upstream_result(int i, bool ok, uint32_t latency_ms)
+{
+    if (!upstream_mutex) return;
+    xSemaphoreTake(upstream_mutex, portMAX_DELAY);
+    upstream_endpoint_t *ep = &upstream_endpoints[i];
+    if (ok) {
+        ep->successes++;
+        ep->score += (100 - ep->score + 3) / 4;
+        if (latency_ms > 65535) latency_ms = 65535;
+        ep->latency_ms = ep->latency_ms ? (ep->latency_ms * 3 + latency_ms) / 4 : latency_ms;
+    } else {
+        ep->failures++;
+        ep->score /= 2;
+    }
+    xSemaphoreGive(upstream_mutex);
+}
+
+/** Bind a socket to one interface so an endpoint is reached over the path it names */
+static void bind_to_netif(int sock, esp_netif_t *netif)
+{
+    if (!netif) return;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    if (esp_netif_get_netif_impl_name(netif, ifr.ifr_name) == ESP_OK) {
+        setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, &ifr, sizeof(ifr));
+    }
+}
+
+/** Connect with a deadline; returns 0, ETIMEDOUT or the socket error (sock stays blocking) */
+static int connect_with_timeout(int sock, const struct sockaddr_in *addr, int timeout_ms)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    int err = 0;
+    if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) != 0) {
+        err = errno;
+        if (err == EINPROGRESS) {
+            fd_set write_fds;
+            FD_ZERO(&write_fds);
+            FD_SET(sock, &write_fds);
+            struct timeval tv = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+            int ready = select(sock + 1, NULL, &write_fds, NULL, &tv);
+            if (ready == 0) {
+                err = ETIMEDOUT;
+            } else {
+                socklen_t err_len = sizeof(err);
+                if (ready < 0 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0) {
+                    err = errno;
+                }
+            }
+        }
+    }
+    fcntl(sock, F_SETFL, flags);
+    return err;
+}
+
+/** Upstream health task - probes every endpoint so idle or failed ones keep a current score */
+static void upstream_health_task(void *pvParameters)
+{
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(UPSTREAM_PROBE_INTERVAL_SEC * 1000));
+
+        for (int i = 0; i < upstream_endpoint_count; i++) {
+            struct sockaddr_in addr;
+            esp_netif_t *netif = upstream_endpoint_target(i, &addr);
+            int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (sock < 0) continue;
+            socket_opened();
+            bind_to_netif(sock, netif);
+
+            int64_t start_us = esp_timer_get_time();
+            int err = connect_with_timeout(sock, &addr, PROXY_CONNECT_TIMEOUT_MS);
+            record_upstream_result(i, err == 0, (uint32_t)((esp_timer_get_time() - start_us) / 1000));
+            reset_socket(sock);
+        }
+        // Re-evaluate now so a recovered or degraded endpoint takes effect without traffic
+        select_upstream(0);
+    }
+}
+
+// ===== ARP =====
+
+/** tcpip-thread callback: announce the netif's current IPv4 address */
+static void gratuitous_arp_cb(void *ctx)
+{
+    etharp_gratuitous((struct netif *)ctx);
+}
+
+/** Broadcast a gratuitous ARP so LAN clients relearn our MAC for the current address */
+static void send_gratuitous_arp(esp_netif_t *netif)
+{
+    struct netif *lwip_netif = esp_netif_get_netif_impl(netif);
+    if (lwip_netif) {
+        tcpip_callback(gratuitous_arp_cb, lwip_netif);
+    }
+}
+
+typedef struct {
+    struct netif *netif;
+    ip4_addr_t ip;
+    struct eth_addr mac;
+    bool found;
+    bool pin;           // Add as static entry instead of looking up
+    bool unpin;         // Remove the static entry
+    SemaphoreHandle_t done;
+} arp_op_t;
+
+/** tcpip-thread callback: ARP request / lookup / pin / unpin for one address */
+static void arp_op_cb(void *ctx)
+{
+    arp_op_t *op = (arp_op_t *)ctx;
+    #if ETHARP_SUPPORT_STATIC_ENTRIES
+    if (op->unpin) {
+        etharp_remove_static_entry(&op->ip);
+    } else if (op->pin) {
+        op->found = etharp_add_static_entry(&op->ip, &op->mac) == ERR_OK;
+    } else
+    #endif
+    {
+        struct eth_addr *mac = NULL;
+        const ip4_addr_t *ip = NULL;
+        if (etharp_find_addr(op->netif, &op->ip, &mac, &ip) >= 0 && mac) {
+            op->mac = *mac;
+            op->found = true;
+        } else {
+            op->found = false;
+        }
+        // Always (re)request so the dynamic entry is refreshed before it ages out
+        etharp_request(op->netif, &op->ip);
+    }
+    xSemaphoreGive(op->done);
+}
+
+/**
+ * Run an ARP operation in the tcpip thread and wait for it. Once queued the callback always
+ * runs and writes into `op` (on the caller's stack), so this must not give up early.
+ */
+static bool run_arp_op(arp_op_t *op)
+{
+    op->done = xSemaphoreCreateBinary();
+    if (!op->done) return false;
+    bool ok = tcpip_callback(arp_op_cb, op) == ERR_OK;
+    if (ok) {
+        xSemaphoreTake(op->done, portMAX_DELAY);
+    }
+    vSemaphoreDelete(op->done);
+    return ok;
+}
+
+// ===== Ethernet Addressing =====
+// ETH_IP_MODE picks DHCP, a static address, or fast DHCP: the last lease (kept in NVS) is
+// applied at boot so the OTA server and proxy listen as soon as the link is up, and DHCP then
+// confirms or replaces it. In fast mode lwIP's DHCP client is driven directly rather than
+// through esp_netif, whose dhcpc_start clears the address until the ACK. Boot milestones are
+// recorded so the gain can be measured.
+#define ETH_IP_DHCP 0
+#define ETH_IP_STATIC 1
+#define ETH_IP_FAST_DHCP 2
+#define NVS_ETH_NAMESPACE "eth_config"
+#define NVS_KEY_LEASE "lease"
+
+static const char *eth_address_source = "dhcp";    // "dhcp", "static" or "cached"
+static volatile bool eth_dhcp_deferred = false;     // Cached lease applied, DHCP not started yet
+static volatile bool eth_dhcp_direct = false;       // lwIP DHCP client running outside esp_netif
+static volatile bool eth_dhcp_bound = false;        // Set by the lwIP callback, consumed by GOT_IP
+static bool eth_cached_confirmed = false;           // First lease matched the cached one
+static esp_netif_ip_info_t eth_saved_lease;
+static uint32_t boot_eth_ip_ms = 0;                 // First usable Ethernet address
+static uint32_t boot_dhcp_ms = 0;                   // First DHCP lease (what plain DHCP waits for)
+static uint32_t boot_ota_listen_ms = 0;
+static uint32_t boot_proxy_listen_ms = 0;
+
+/** Milliseconds since the app started */
+static uint32_t boot_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+#if ETH_IP_MODE == ETH_IP_FAST_DHCP
+/** Load the last DHCP lease from NVS */
+static bool load_eth_lease(esp_netif_ip_info_t *info)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_ETH_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        return false;
+    }
+    size_t len = sizeof(*info);
+    esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_LEASE, info, &len);
+    nvs_close(nvs_handle);
+    return err == ESP_OK && len == sizeof(*info) && info->ip.addr != 0;
+}
+
+/** Save a DHCP lease to NVS (only when it differs from the stored one, to spare flash) */
+static void save_eth_lease(const esp_netif_ip_info_t *info)
+{
+    if (memcmp(info, &eth_saved_lease, sizeof(*info)) == 0) return;
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_ETH_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs_handle, NVS_KEY_LEASE, info, sizeof(*info));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    if (err == ESP_OK) {
+        eth_saved_lease = *info;
+        ESP_LOGI(TAG, "Ethernet lease cached: " IPSTR, IP2STR(&info->ip));
+    } else {
+        ESP_LOGW(TAG, "Failed to cache Ethernet lease: %s", esp_err_to_name(err));
+    }
+}
+#endif
+
+#if ETH_IP_MODE == ETH_IP_FAST_DHCP
+/** lwIP DHCP callback (tcpip thread): publish a bound lease through esp_netif */
+static void eth_dhcp_bound_cb(struct netif *netif)
+{
+    if (!dhcp_supplied_address(netif)) return;
+
+    esp_netif_ip_info_t info = {
+        .ip.addr = netif_ip4_addr(netif)->addr,
+        .netmask.addr = netif_ip4_netmask(netif)->addr,
+        .gw.addr = netif_ip4_gw(netif)->addr,
+    };
+    // esp_netif's DHCP client is stopped, so this only syncs its copy and posts GOT_IP
+    eth_dhcp_bound = true;
+    esp_netif_set_ip_info(eth_netif, &info);
+}
+
+/** tcpip-thread callback: start lwIP's DHCP client on the current (cached) address */
+static void eth_dhcp_start_cb(void *ctx)
+{
+    struct netif *netif = (struct netif *)ctx;
+    dhcp_set_cb(netif, eth_dhcp_bound_cb);
+    if (dhcp_start(netif) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to start DHCP on the cached lease");
+    }
+}
+
+/** tcpip-thread callback: stop lwIP's DHCP client */
+static void eth_dhcp_stop_cb(void *ctx)
+{
+    dhcp_stop((struct netif *)ctx);
+}
+#endif
+
+/** Stop whichever DHCP client currently owns the Ethernet interface */
+static void eth_dhcp_stop(void)
+{
+    #if ETH_IP_MODE == ETH_IP_FAST_DHCP
+    if (eth_dhcp_direct) {
+        eth_dhcp_direct = false;
+        struct netif *lwip_netif = esp_netif_get_netif_impl(eth_netif);
+        if (lwip_netif) {
+            tcpip_callback(eth_dhcp_stop_cb, lwip_netif);
+        }
+    }
+    #endif
+    esp_netif_dhcpc_stop(eth_netif);
+}
+
+/** Put the interface on a fixed address (DHCP client stopped; GOT_IP fires on link up) */
+static esp_err_t apply_eth_address(const esp_netif_ip_info_t *info)
+{
+    eth_dhcp_stop();
+    return esp_netif_set_ip_info(eth_netif, info);
+}
+
+/**
+ * First time the OTA server was reachable: listening on an address DHCP did not take away.
+ * A cached lease that DHCP confirmed counts from when it was applied; one it replaced only
+ * counts from the new lease. 0 until known.
+ */
+static uint32_t boot_reachable_ms(void)
+{
+    if (boot_ota_listen_ms == 0) return 0;
+    uint32_t address_ms = boot_eth_ip_ms;
+    if (strcmp(eth_address_source, "cached") == 0 && !eth_cached_confirmed) {
+        address_ms = boot_dhcp_ms;
+    }
+    if (address_ms == 0) return 0;
+    return address_ms > boot_ota_listen_ms ? address_ms : boot_ota_listen_ms;
+}
+
+/** Configure Ethernet addressing before the driver starts */
+static void init_eth_addressing(void)
+{
+    #if ETH_IP_MODE == ETH_IP_STATIC
+    esp_netif_ip_info_t info = {0};
+    if (esp_netif_str_to_ip4(ETH_STATIC_IP, &info.ip) != ESP_OK ||
+        esp_netif_str_to_ip4(ETH_STATIC_NETMASK, &info.netmask) != ESP_OK ||
+        esp_netif_str_to_ip4(ETH_STATIC_GATEWAY, &info.gw) != ESP_OK ||
+        apply_eth_address(&info) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid static Ethernet address - falling back to DHCP");
+        esp_netif_dhcpc_start(eth_netif);
+        return;
+    }
+    eth_address_source = "static";
+    ESP_LOGI(TAG, "Ethernet static address: %s", ETH_STATIC_IP);
+    #elif ETH_IP_MODE == ETH_IP_FAST_DHCP
+    if (load_eth_lease(&eth_saved_lease) && apply_eth_address(&eth_saved_lease) == ESP_OK) {
+        eth_address_source = "cached";
+        eth_dhcp_deferred = true;
+        ESP_LOGI(TAG, "Ethernet using cached lease " IPSTR " until DHCP renews", IP2STR(&eth_saved_lease.ip));
+    }
+    #endif
+}
+
+/** Track a new Ethernet address: boot milestones, lease caching and the deferred DHCP start */
+static void eth_address_changed(const esp_netif_ip_info_t *ip_info)
+{
+    esp_netif_dhcp_status_t dhcp_status = ESP_NETIF_DHCP_STOPPED;
+    esp_netif_dhcpc_get_status(eth_netif, &dhcp_status);
+    bool from_dhcp = dhcp_status == ESP_NETIF_DHCP_STARTED || eth_dhcp_bound;
+    eth_dhcp_bound = false;
+
+    if (boot_eth_ip_ms == 0) {
+        boot_eth_ip_ms = boot_ms();
+    }
+    if (from_dhcp) {
+        if (boot_dhcp_ms == 0) {
+            boot_dhcp_ms = boot_ms();
+            eth_cached_confirmed = ip_info->ip.addr == eth_saved_lease.ip.addr;
+        }
+        #if ETH_IP_MODE == ETH_IP_FAST_DHCP
+        save_eth_lease(ip_info);
+        #endif
+    }
+    #if ETH_IP_MODE == ETH_IP_FAST_DHCP
+    else if (eth_dhcp_deferred) {
+        // Cached lease is up and services can start; renew it in the background without
+        // giving up the address (INIT-REBOOT for the same IP)
+        eth_dhcp_deferred = false;
+        struct netif *lwip_netif = esp_netif_get_netif_impl(eth_netif);
+        if (lwip_netif) {
+            eth_dhcp_direct = true;
+            tcpip_callback(eth_dhcp_start_cb, lwip_netif);
+        }
+    }
+    #endif
+}
+
+#if HA_ENABLED
+// ===== High Availability (active/standby pair) =====
+// Two bridges exchange UDP heartbeats on the Ethernet subnet. The active one moves its
+// Ethernet address to the shared virtual IP; the standby keeps its DHCP lease and claims
+// the VIP (with gratuitous ARP) when heartbeats stop or the active resigns before a reboot.
+#define HA_MAGIC 0x50574841  // "PWHA"
+
+typedef enum {
+    HA_STATE_INIT = 0,
+    HA_STATE_STANDBY,
+    HA_STATE_ACTIVE,
+    HA_STATE_RESIGN,    // Active is about to reboot - standby should take over now
+} ha_state_t;
+
+static const char *ha_state_names[] = {"init", "standby", "active", "resign"};
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t node_id;
+    uint32_t seq;
+    uint8_t group;
+    uint8_t state;
+    uint8_t priority;
+    uint8_t reserved;
+} ha_heartbeat_t;
+
+static volatile ha_state_t ha_state = HA_STATE_INIT;
+static uint32_t ha_node_id = 0;
+static uint32_t ha_vip = 0;                       // Virtual IP (network byte order)
+static esp_netif_ip_info_t ha_lease = {0};        // Our own DHCP lease (restored on standby)
+static volatile bool ha_lease_valid = false;
+static volatile bool ha_vip_held = false;
+static int ha_sock = -1;
+
+// Peer tracking and statistics
+static volatile ha_state_t ha_peer_state = HA_STATE_INIT;
+static volatile uint32_t ha_peer_ip = 0;
+static volatile int64_t ha_peer_last_seen_us = 0;
+static volatile uint32_t ha_heartbeats_sent = 0;
+static volatile uint32_t ha_heartbeats_received = 0;
+static volatile uint32_t ha_takeovers = 0;
+static volatile uint32_t ha_last_failover_ms = 0;
+static volatile int64_t ha_last_takeover_us = 0;
+
+/** Remember our DHCP lease (ignored while the VIP is configured) */
+static void ha_record_lease(const esp_netif_ip_info_t *ip_info)
+{
+    if (!ha_vip_held) {
+        ha_lease = *ip_info;
+        ha_lease_valid = true;
+    }
+}
+
+/** Move the Ethernet interface onto the virtual IP and announce it; true once the VIP is held */
+static bool ha_claim_vip(void)
+{
+    if (ha_vip_held) return true;
+    if (!ha_lease_valid) return false;
+
+    esp_netif_ip_info_t info = ha_lease;
+    info.ip.addr = ha_vip;
+
+    eth_dhcp_stop();
+    ha_vip_held = true;
+    if (esp_netif_set_ip_info(eth_netif, &info) != ESP_OK) {
+        ESP_LOGE(TAG, "HA: failed to configure virtual IP");
+        ha_vip_held = false;
+        esp_netif_dhcpc_start(eth_netif);
+        return false;
+    }
+    send_gratuitous_arp(eth_netif);
+    ESP_LOGW(TAG, "HA: claimed virtual IP %s", HA_VIRTUAL_IP_STR);
+    return true;
+}
+
+/** Give the virtual IP back and return to our own DHCP lease */
+static void ha_release_vip(void)
+{
+    if (!ha_vip_held) return;
+
+    #if ETH_IP_MODE == ETH_IP_STATIC
+    ha_vip_held = false;
+    apply_eth_address(&ha_lease);
+    #else
+    esp_netif_ip_info_t info = {0};
+    esp_netif_set_ip_info(eth_netif, &info);
+    ha_vip_held = false;
+    esp_netif_dhcpc_start(eth_netif);
+    #endif
+    ESP_LOGW(TAG, "HA: released virtual IP %s", HA_VIRTUAL_IP_STR);
+}
+
+/** Send one heartbeat to the Ethernet subnet broadcast address */
+static void ha_send_heartbeat(ha_state_t state)
+{
+    if (ha_sock < 0 || !ha_lease_valid) return;
+
+    static uint32_t seq = 0;
+    ha_heartbeat_t hb = {
+        .magic = htonl(HA_MAGIC),
+        .node_id = htonl(ha_node_id),
+        .seq = htonl(++seq),
+        .group = HA_GROUP_ID,
+        .state = state,
+        .priority = HA_PRIORITY,
+    };
+
+    // Subnet-directed broadcast so lwIP routes it out of the Ethernet interface
+    struct sockaddr_in dest = {
+        .sin_family = AF_INET,
+        .sin_port = htons(HA_PORT),
+        .sin_addr.s_addr = ha_lease.ip.addr | ~ha_lease.netmask.addr,
+    };
+    if (sendto(ha_sock, &hb, sizeof(hb), 0, (struct sockaddr *)&dest, sizeof(dest)) == sizeof(hb)) {
+        ha_heartbeats_sent++;
+    }
+}
+
+/** Announce that this (active) bridge is going away, so the standby takes over immediately */
+static void ha_resign(void)
+{
+    if (ha_state != HA_STATE_ACTIVE) return;
+    ESP_LOGW(TAG, "HA: resigning active role");
+    ha_state = HA_STATE_RESIGN;
+    for (int i = 0; i < 3; i++) {
+        ha_send_heartbeat(HA_STATE_RESIGN);
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+}
+
+/** Become active: take the VIP and record how long the service was without an owner */
+static void ha_become_active(const char *reason)
+{
+    int64_t now_us = esp_timer_get_time();
+    if (ha_peer_last_seen_us > 0) {
+        ha_last_failover_ms = (uint32_t)((now_us - ha_peer_last_seen_us) / 1000);
+    }
+    ha_state = HA_STATE_ACTIVE;
+    ha_takeovers++;
+    ha_last_takeover_us = now_us;
+    if (!ha_claim_vip()) {
+        ESP_LOGW(TAG, "HA: virtual IP not claimed yet%s - retrying", ha_lease_valid ? "" : " (no lease)");
+    }
+    ha_send_heartbeat(HA_STATE_ACTIVE);
+    ESP_LOGW(TAG, "HA: now ACTIVE (%s), failover %lu ms", reason, (unsigned long)ha_last_failover_ms);
+}
+
+/** Handle a heartbeat received from the peer */
+static void ha_handle_heartbeat(const ha_heartbeat_t *hb, uint32_t from_ip)
+{
+    if (ntohl(hb->magic) != HA_MAGIC || hb->group != HA_GROUP_ID) return;
+    uint32_t peer_id = ntohl(hb->node_id);
+    if (peer_id == ha_node_id) return;
+
+    ha_heartbeats_received++;
+    ha_peer_state = (ha_state_t)hb->state;
+    ha_peer_ip = from_ip;
+
+    if (hb->state == HA_STATE_RESIGN) {
+        // Peer is rebooting: failover time counts from its resignation
+        ha_peer_last_seen_us = esp_timer_get_time();
+        if (ha_state == HA_STATE_STANDBY || ha_state == HA_STATE_INIT) {
+            ha_become_active("peer resigned");
+        }
+        return;
+    }
+    ha_peer_last_seen_us = esp_timer_get_time();
+
+    if (hb->state == HA_STATE_ACTIVE) {
+        if (ha_state == HA_STATE_INIT) {
+            ha_state = HA_STATE_STANDBY;
+            ESP_LOGI(TAG, "HA: active peer found, starting as STANDBY");
+        } else if (ha_state == HA_STATE_ACTIVE) {
+            // Split brain - higher priority wins, node ID breaks ties
+            if (hb->priority > HA_PRIORITY || (hb->priority == HA_PRIORITY && peer_id > ha_node_id)) {
+                ESP_LOGW(TAG, "HA: peer has precedence, yielding to STANDBY");
+                ha_state = HA_STATE_STANDBY;
+                ha_release_vip();
+            }
+        }
+    }
+}
+
+/** HA task - heartbeat exchange and failover state machine */
+static void ha_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "HA: starting (VIP %s, priority %d, heartbeat %d ms, dead %d ms)",
+             HA_VIRTUAL_IP_STR, HA_PRIORITY, HA_HEARTBEAT_INTERVAL_MS, HA_DEAD_INTERVAL_MS);
+
+    ha_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (ha_sock < 0) {
+        ESP_LOGE(TAG, "HA: unable to create socket");
+        vTaskDelete(NULL);
+        return;
+    }
+    int opt = 1;
+    setsockopt(ha_sock, SOL_SOCKET, SO_BROADCAST, &opt, sizeof(opt));
+    setsockopt(ha_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in bind_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(HA_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(ha_sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) != 0) {
+        ESP_LOGE(TAG, "HA: bind failed");
+        close(ha_sock);
+        ha_sock = -1;
+        vTaskDelete(NULL);
+        return;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    int64_t last_sent_us = 0;
+
+    while (1) {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(ha_sock, &read_fds);
+        struct timeval tv = {.tv_sec = 0, .tv_usec = 50000};  // 50ms
+
+        if (select(ha_sock + 1, &read_fds, NULL, NULL, &tv) > 0 && FD_ISSET(ha_sock, &read_fds)) {
+            ha_heartbeat_t hb;
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            int len = recvfrom(ha_sock, &hb, sizeof(hb), 0, (struct sockaddr *)&from, &from_len);
+            if (len == sizeof(hb)) {
+                ha_handle_heartbeat(&hb, from.sin_addr.s_addr);
+            }
+        }
+
+        int64_t now_us = esp_timer_get_time();
+
+        switch (ha_state) {
+        case HA_STATE_INIT:
+            // Listen for an existing active peer before claiming the VIP at boot
+            if (now_us - start_us > (int64_t)HA_STARTUP_LISTEN_MS * 1000) {
+                ha_become_active("no active peer at startup");
+            }
+            break;
+        case HA_STATE_STANDBY:
+            if (now_us - ha_peer_last_seen_us > (int64_t)HA_DEAD_INTERVAL_MS * 1000) {
+                ha_become_active("peer heartbeats missed");
+            }
+            break;
+        default:
+            break;
+        }
+
+        if (now_us - last_sent_us >= (int64_t)HA_HEARTBEAT_INTERVAL_MS * 1000) {
+            // Active without the VIP (no lease yet, or configuring it failed): try again
+            if (ha_state == HA_STATE_ACTIVE && !ha_vip_held) {
+                ha_claim_vip();
+            }
+            ha_send_heartbeat(ha_state);
+            last_sent_us = now_us;
+        }
+    }
+}
+#endif
+
+#if CONNECT_TUNNEL_ENABLED
+// ===== HTTP CONNECT Tunnel =====
+// Allow-listed targets on the WiFi side, each with its own concurrency limit. Tunnels share
+// the buffer pool, forwarding loop, TTL rewrite and request log with the Powerwall proxy.
+typedef struct {
+    struct sockaddr_in addr;
+    char label[24];             // "a.b.c.d:port"
+    int limit;                  // Max concurrent tunnels to this target
+    atomic_int active;
+    atomic_uint total;          // Tunnels established
+    atomic_uint refused;        // Refused because the target was at its limit
+    atomic_uint failed;         // Upstream connect failures
+} connect_target_t;
+
+static connect_target_t connect_targets[CONNECT_MAX_TARGETS];
+static int connect_target_count = 0;
+static atomic_uint connect_denied = 0;  // Malformed requests or targets not on the allow-list
+static const keepalive_cfg_t connect_keepalive = {CONNECT_KEEPALIVE_IDLE_SEC, CONNECT_KEEPALIVE_INTVL_SEC, CONNECT_KEEPALIVE_CNT};
+
+/** Parse CONNECT_ALLOWLIST ("ip:port[=limit],...") into the target table */
+static void init_connect_targets(void)
+{
+    char list[] = CONNECT_ALLOWLIST;
+    char *save = NULL;
+    for (char *tok = strtok_r(list, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (connect_target_count >= CONNECT_MAX_TARGETS) {
+            ESP_LOGW(TAG, "CONNECT allow-list full - ignoring %s", tok);
+            continue;
+        }
+
+        char ip[16];
+        unsigned int port = 0;
+        int limit = CONNECT_DEFAULT_TARGET_LIMIT;
+        connect_target_t *t = &connect_targets[connect_target_count];
+        if (sscanf(tok, "%15[0-9.]:%u=%d", ip, &port, &limit) < 2 || port == 0 || port > 65535 ||
+            limit < 1 || inet_pton(AF_INET, ip, &t->addr.sin_addr) != 1) {
+            ESP_LOGW(TAG, "Invalid CONNECT allow-list entry: %s", tok);
+            continue;
+        }
+        t->addr.sin_family = AF_INET;
+        t->addr.sin_port = htons(port);
+        t->limit = limit;
+        snprintf(t->label, sizeof(t->label), "%s:%u", ip, port);
+        ESP_LOGI(TAG, "CONNECT target %s (max %d concurrent)", t->label, limit);
+        connect_target_count++;
+    }
+}
+
+/** Look up an allow-listed target by its "ip:port" authority (NULL if not allowed) */
+static connect_target_t *find_connect_target(const char *authority)
+{
+    char ip[16];
+    unsigned int port = 0;
+    struct in_addr addr;
+    if (sscanf(authority, "%15[0-9.]:%u", ip, &port) != 2 || inet_pton(AF_INET, ip, &addr) != 1) {
+        return NULL;
+    }
+    for (int i = 0; i < connect_target_count; i++) {
+        connect_target_t *t = &connect_targets[i];
+        if (t->addr.sin_addr.s_addr == addr.s_addr && ntohs(t->addr.sin_port) == port) {
+            return t;
+        }
+    }
+    return NULL;
+}
+#endif
+
+// ===== Graceful Drain =====
+// Reboot, OTA, rollback and WiFi changes first drain the proxy: listeners reset new clients
+// and forwarding loops close once their exchange is done. The outcome survives the restart.
+#define DRAIN_REPORT_MAGIC 0x4452414E  // "DRAN"
+
+typedef struct {
+    uint32_t magic;
+    char reason[12];
+    uint16_t drained;       // Connections that finished their exchange in time
+    uint16_t cut;           // Connections still open at the deadline
+    uint32_t duration_ms;
+} drain_report_t;
+
+typedef void (*drain_action_t)(void);
+
+static atomic_bool draining = false;
+static _Atomic(drain_action_t) drain_action = NULL;  // NULL once the running drain has finished its actions
+static atomic_uint drain_refused = 0;               // New connections reset while draining
+static RTC_NOINIT_ATTR drain_report_t last_drain;   // Kept across esp_restart()
+
+/** Restart once drained, handing the virtual IP to the standby first */
+static void drain_restart(void)
+{
+    #if HA_ENABLED
+    ha_resign();
+    #endif
+    esp_restart();
+}
+
+/** Run the drain's follow-up action, then any restart that replaced it meanwhile, and leave drain mode */
+static void run_drain_actions(void)
+{
+    drain_action_t action = atomic_load(&drain_action);
+    while (true) {
+        action();
+        // Unchanged: done. Otherwise start_drain() swapped in a restart while action ran
+        if (atomic_compare_exchange_strong(&drain_action, &action, NULL)) break;
+    }
+    atomic_store(&draining, false);
+}
+
+/** Wait for in-flight exchanges (up to DRAIN_TIMEOUT_MS), then run the follow-up action */
+static void drain_task(void *pvParameters)
+{
+    int64_t start_us = esp_timer_get_time();
+    int at_start = atomic_load(&active_connections);
+
+    ESP_LOGW(TAG, "Draining %d connection(s) before %s (up to %d ms)", at_start, last_drain.reason, DRAIN_TIMEOUT_MS);
+    while (atomic_load(&active_connections) > 0 &&
+           esp_timer_get_time() - start_us < (int64_t)DRAIN_TIMEOUT_MS * 1000) {
+        vTaskDelay(pdMS_TO_TICKS(50));
+    }
+
+    int cut = atomic_load(&active_connections);
+    last_drain.drained = at_start > cut ? at_start - cut : 0;
+    last_drain.cut = cut;
+    last_drain.duration_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    last_drain.magic = DRAIN_REPORT_MAGIC;
+    ESP_LOGW(TAG, "Drain done in %lu ms: %u finished, %u cut",
+             (unsigned long)last_drain.duration_ms, last_drain.drained, last_drain.cut);
+
+    run_drain_actions();
+    vTaskDelete(NULL);
+}
+
+/** Enter drain mode and run action afterwards (a restart replaces the action of a running drain) */
+static void start_drain(const char *reason, drain_action_t action)
+{
+    while (true) {
+        bool idle = false;
+        if (atomic_compare_exchange_strong(&draining, &idle, true)) break;
+        if (action != drain_restart) return;
+
+        // Replace the running drain's action; NULL means it just finished, so wait and start anew
+        drain_action_t current = atomic_load(&drain_action);
+        if (current && atomic_compare_exchange_strong(&drain_action, &current, action)) {
+            strncpy(last_drain.reason, reason, sizeof(last_drain.reason) - 1);
+            last_drain.reason[sizeof(last_drain.reason) - 1] = '\0';
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    strncpy(last_drain.reason, reason, sizeof(last_drain.reason) - 1);
+    last_drain.reason[sizeof(last_drain.reason) - 1] = '\0';
+    last_drain.magic = 0;
+    atomic_store(&drain_action, action);
+    if (xTaskCreate(drain_task, "drain", 3072, NULL, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create drain task - running %s now", reason);
+        run_drain_actions();
+    }
+}
+
+#if TRACE_ENABLED
+// ===== Scheduling Trace =====
+// FreeRTOS trace hooks (see include/trace_hooks.h) record task switches, queue blocks and the
+// W5500 interrupt into a lock-free ring: writers claim a slot with an atomic increment and
+// publish it by storing its sequence number last, so readers can skip torn or overwritten
+// entries. /api/trace pauses recording while it streams a window as Chrome trace JSON.
+typedef enum {
+    TRACE_SWITCH_IN = 1,
+    TRACE_SWITCH_OUT,
+    TRACE_QUEUE_BLOCK_RECV,
+    TRACE_QUEUE_BLOCK_SEND,
+    TRACE_ISR_ENTER,
+    TRACE_ISR_EXIT,
+} trace_type_t;
+
+typedef struct {
+    volatile uint32_t seq;  // Claimed index + 1, written last (0 = never written)
+    uint32_t ts_us;         // esp_timer time, low 32 bits
+    uint32_t arg;           // Task handle, queue handle or ISR id
+    uint8_t type;
+    uint8_t core;
+    uint16_t reserved;
+} trace_event_t;
+
+#define TRACE_ISR_W5500 1
+
+static trace_event_t *trace_ring = NULL;
+static atomic_uint trace_head = 0;
+static volatile bool trace_paused = false;
+static atomic_uint trace_dropped = 0;
+
+/** Append one event (task, ISR or scheduler context; never blocks) */
+static void IRAM_ATTR trace_record(trace_type_t type, uint32_t arg)
+{
+    if (!trace_ring) return;
+    if (trace_paused) {
+        atomic_fetch_add_explicit(&trace_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    uint32_t idx = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+    trace_event_t *ev = &trace_ring[idx % TRACE_RING_EVENTS];
+    ev->seq = 0;
+    atomic_thread_fence(memory_order_release);
+    ev->ts_us = (uint32_t)esp_timer_get_time();
+    ev->arg = arg;
+    ev->type = type;
+    ev->core = xPortGetCoreID();
+    atomic_thread_fence(memory_order_release);
+    ev->seq = idx + 1;
+}
+
+void IRAM_ATTR trace_task_switched_in(void)
+{
+    trace_record(TRACE_SWITCH_IN, (uint32_t)xTaskGetCurrentTaskHandleForCore(xPortGetCoreID()));
+}
+
+void IRAM_ATTR trace_task_switched_out(void)
+{
+    trace_record(TRACE_SWITCH_OUT, (uint32_t)xTaskGetCurrentTaskHandleForCore(xPortGetCoreID()));
+}
+
+void IRAM_ATTR trace_queue_block(void *queue, int sending)
+{
+    trace_record(sending ? TRACE_QUEUE_BLOCK_SEND : TRACE_QUEUE_BLOCK_RECV, (uint32_t)queue);
+}
+
+/** Allocate the ring (internal RAM: hooks also run while the flash cache is disabled) */
+static void init_trace(void)
+{
+    trace_ring = heap_caps_calloc(TRACE_RING_EVENTS, sizeof(trace_event_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!trace_ring) {
+        ESP_LOGE(TAG, "Scheduling trace disabled: no memory for %d events", TRACE_RING_EVENTS);
+        return;
+    }
+    ESP_LOGI(TAG, "Scheduling trace recording (%d events, %u bytes)", TRACE_RING_EVENTS,
+             (unsigned)(TRACE_RING_EVENTS * sizeof(trace_event_t)));
+}
+#endif
+
+// ===== W5500 RX Mode =====
+// W5500_RX_MODE picks how the driver task learns about received frames: the INT pin, a poll
+// timer, or both (hybrid: interrupts when idle, tight polling of the RX buffer during bursts).
+// Frame latency (INT edge -> frame handed to lwIP) and SPI bus time are measured per mode.
+#define W5500_RX_MODE_INTERRUPT 0
+#define W5500_RX_MODE_POLL 1
+#define W5500_RX_MODE_HYBRID 2
+#define W5500_DRIVER_TASK_NAME "w5500_tsk"  // Task created by the IDF W5500 MAC driver
+
+typedef struct {
+    uint64_t time_us;           // Time spent in this mode
+    uint64_t spi_busy_us;       // SPI transaction time (pre_cb -> post_cb)
+    uint32_t spi_transactions;
+    uint32_t frames;
+    uint32_t bytes;
+    uint64_t latency_sum_us;
+    uint32_t latency_samples;
+    uint32_t latency_max_us;
+} w5500_mode_stats_t;
+
+static w5500_mode_stats_t w5500_stats[2];   // [0] = interrupt, [1] = polling
+static volatile int w5500_mode_now = W5500_RX_MODE == W5500_RX_MODE_POLL ? 1 : 0;
+static int64_t w5500_mode_since_us = 0;
+static uint32_t w5500_bursts = 0;           // Hybrid: interrupt -> polling switches
+static volatile uint32_t w5500_int_edge_us = 0;  // Oldest unserviced INT edge (0 = none)
+static volatile uint32_t w5500_spi_start_us = 0;
+static TaskHandle_t w5500_task = NULL;
+static esp_timer_handle_t w5500_poll_timer = NULL;
+static atomic_uint eth_stack_drops = 0;     // Frames lwIP refused (e.g. no pbuf)
+
+/** SPI pre-transaction callback: stamp the start (runs for every W5500 register/buffer access) */
+static void IRAM_ATTR w5500_spi_pre_cb(spi_transaction_t *t)
+{
+    w5500_spi_start_us = (uint32_t)esp_timer_get_time();
+}
+
+/** SPI post-transaction callback: charge the bus time to the current mode */
+static void IRAM_ATTR w5500_spi_post_cb(spi_transaction_t *t)
+{
+    w5500_mode_stats_t *st = &w5500_stats[w5500_mode_now];
+    st->spi_busy_us += (uint32_t)esp_timer_get_time() - w5500_spi_start_us;
+    st->spi_transactions++;
+}
+
+/** INT pin ISR (replaces the driver's): stamp the edge, then wake the driver task as it would */
+static void IRAM_ATTR w5500_int_isr(void *arg)
+{
+    #if TRACE_ENABLED
+    trace_record(TRACE_ISR_ENTER, TRACE_ISR_W5500);
+    #endif
+    if (w5500_int_edge_us == 0) {
+        w5500_int_edge_us = (uint32_t)esp_timer_get_time() | 1;
+    }
+    if (W5500_RX_MODE != W5500_RX_MODE_POLL && w5500_task) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(w5500_task, &woken);
+        #if TRACE_ENABLED
+        trace_record(TRACE_ISR_EXIT, TRACE_ISR_W5500);
+        #endif
+        portYIELD_FROM_ISR(woken);
+        return;
+    }
+    #if TRACE_ENABLED
+    trace_record(TRACE_ISR_EXIT, TRACE_ISR_W5500);
+    #endif
+}
+
+/** Ethernet input path: measure frame latency, then hand the frame to lwIP like the netif glue */
+static esp_err_t w5500_rx_input(esp_eth_handle_t handle, uint8_t *buffer, uint32_t length, void *priv)
+{
+    w5500_mode_stats_t *st = &w5500_stats[w5500_mode_now];
+    uint32_t edge = w5500_int_edge_us;
+    if (edge) {
+        w5500_int_edge_us = 0;
+        uint32_t latency = (uint32_t)esp_timer_get_time() - edge;
+        st->latency_sum_us += latency;
+        st->latency_samples++;
+        if (latency > st->latency_max_us) st->latency_max_us = latency;
+    }
+    st->frames++;
+    st->bytes += length;
+    esp_err_t err = esp_netif_receive((esp_netif_t *)priv, buffer, length, NULL);
+    if (err != ESP_OK) {
+        atomic_fetch_add(&eth_stack_drops, 1);
+    }
+    return err;
+}
+
+/** Account the time spent in the current mode and switch */
+static void w5500_set_mode(int mode)
+{
+    int64_t now = esp_timer_get_time();
+    w5500_stats[w5500_mode_now].time_us += now - w5500_mode_since_us;
+    w5500_mode_since_us = now;
+    w5500_mode_now = mode;
+}
+
+#if W5500_RX_MODE == W5500_RX_MODE_HYBRID
+/** Burst poll tick: wake the driver task to drain the RX buffer without waiting for INT */
+static void w5500_poll_cb(void *arg)
+{
+    xTaskNotifyGive(w5500_task);
+}
+
+/** Hybrid mode task - starts burst polling above W5500_BURST_ENTER_FPS, stops once quiet */
+static void w5500_mode_task(void *pvParameters)
+{
+    uint32_t last_frames = 0;
+    int quiet_ms = 0;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(W5500_RATE_WINDOW_MS));
+
+        uint32_t frames = w5500_stats[0].frames + w5500_stats[1].frames;
+        uint32_t fps = (frames - last_frames) * 1000 / W5500_RATE_WINDOW_MS;
+        last_frames = frames;
+
+        if (w5500_mode_now == 0 && fps >= W5500_BURST_ENTER_FPS) {
+            w5500_set_mode(1);
+            esp_timer_start_periodic(w5500_poll_timer, W5500_BURST_POLL_US);
+            w5500_bursts++;
+            quiet_ms = 0;
+        } else if (w5500_mode_now == 1) {
+            quiet_ms = fps < W5500_BURST_EXIT_FPS ? quiet_ms + W5500_RATE_WINDOW_MS : 0;
+            if (quiet_ms >= W5500_BURST_HOLD_MS) {
+                esp_timer_stop(w5500_poll_timer);
+                w5500_set_mode(0);
+            }
+        }
+    }
+}
+#endif
+
+/** Hook the W5500 INT pin and input path for measurement and start hybrid polling (after attach) */
+static void init_w5500_rx_mode(void)
+{
+    w5500_mode_since_us = esp_timer_get_time();
+
+    // Our input path replaces the one esp_netif_attach() installed (same behaviour, plus counters)
+    esp_eth_update_input_path(eth_handle, w5500_rx_input, eth_netif);
+
+    if (W5500_RX_MODE != W5500_RX_MODE_POLL) {
+        w5500_task = xTaskGetHandle(W5500_DRIVER_TASK_NAME);
+        if (!w5500_task) {
+            ESP_LOGW(TAG, "W5500 driver task not found - keeping driver ISR, no latency or burst polling");
+            return;
+        }
+        gpio_isr_handler_remove(W5500_INT_GPIO);
+    } else {
+        // Polling driver leaves the INT pin alone; watch it only to time frame arrival
+        gpio_config_t io_conf = {
+            .pin_bit_mask = 1ULL << W5500_INT_GPIO,
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_ENABLE,
+            .intr_type = GPIO_INTR_NEGEDGE,
+        };
+        gpio_config(&io_conf);
+        gpio_install_isr_service(0);
+    }
+    gpio_isr_handler_add(W5500_INT_GPIO, w5500_int_isr, NULL);
+
+    #if W5500_RX_MODE == W5500_RX_MODE_HYBRID
+    esp_timer_create_args_t timer_args = {
+        .callback = w5500_poll_cb,
+        .name = "w5500_poll",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &w5500_poll_timer));
+    xTaskCreate(w5500_mode_task, "w5500_mode", 2048, NULL, 3, NULL);
+    #endif
+    ESP_LOGI(TAG, "W5500 RX mode: %s", W5500_RX_MODE == W5500_RX_MODE_HYBRID ? "hybrid" :
+             W5500_RX_MODE == W5500_RX_MODE_POLL ? "polling" : "interrupt");
+}
+
+// ===== Ethernet Link Stats =====
+// Link flaps, negotiated speed/duplex, the W5500 PHY status register and driver errors, with a
+// per-interval history. Errors are counted on the driver path: the MAC's receive and PHY register
+// methods are wrapped, so a failed frame read is an RX error and a failed register access (the
+// PHY driver polls the link every second) an SPI error. Errors the driver only logs, such as the
+// bad frame lengths RX buffer overruns cause, are counted by a log hook that checks the tag
+// argument first, so other log lines are not formatted.
+#define ETH_HISTORY_SIZE 30
+#define W5500_REG_PHYCFGR (0x002E << 16)    // Common register block, addressed as the IDF driver does
+#define W5500_PHYCFGR_LNK BIT0
+#define W5500_PHYCFGR_SPD BIT1              // 1 = 100 Mbps
+#define W5500_PHYCFGR_DPX BIT2              // 1 = full duplex
+
+typedef struct {
+    int64_t timestamp;      // Seconds since boot (end of interval)
+    uint32_t frames;        // RX frames in the interval
+    uint16_t link_downs;
+    uint16_t rx_errors;
+    uint16_t spi_errors;
+    uint16_t stack_drops;
+    uint8_t phycfgr;        // PHY status at the end of the interval
+    bool valid;
+} eth_history_t;
+
+static volatile bool eth_link_up = false;
+static eth_speed_t eth_speed = ETH_SPEED_10M;
+static eth_duplex_t eth_duplex = ETH_DUPLEX_HALF;
+static volatile int64_t eth_link_changed_us = 0;
+static atomic_uint eth_link_ups = 0;
+static atomic_uint eth_link_downs = 0;
+static atomic_uint w5500_rx_errors = 0;        // Failed frame reads
+static atomic_uint w5500_spi_errors = 0;       // Failed PHY register accesses
+static atomic_uint w5500_logged_errors = 0;    // Error lines logged by the driver
+static char w5500_last_error[64] = "";
+static volatile int64_t w5500_last_error_us = 0;
+static volatile uint8_t w5500_phycfgr = 0;
+static eth_history_t eth_history[ETH_HISTORY_SIZE];
+static int eth_history_index = 0;
+static vprintf_like_t eth_prev_vprintf = NULL;
+
+// The W5500 MAC's own methods, called by the wrappers below
+static esp_err_t (*w5500_mac_receive)(esp_eth_mac_t *mac, uint8_t *buf, uint32_t *length);
+static esp_err_t (*w5500_mac_read_phy_reg)(esp_eth_mac_t *mac, uint32_t phy_addr, uint32_t phy_reg, uint32_t *reg_value);
+static esp_err_t (*w5500_mac_write_phy_reg)(esp_eth_mac_t *mac, uint32_t phy_addr, uint32_t phy_reg, uint32_t reg_value);
+
+/** MAC receive wrapper: count frames the driver failed to read out of the W5500 */
+static esp_err_t w5500_counted_receive(esp_eth_mac_t *mac, uint8_t *buf, uint32_t *length)
+{
+    esp_err_t err = w5500_mac_receive(mac, buf, length);
+    if (err != ESP_OK) atomic_fetch_add(&w5500_rx_errors, 1);
+    return err;
+}
+
+/** MAC PHY register read wrapper: count failed SPI register accesses */
+static esp_err_t w5500_counted_read_phy_reg(esp_eth_mac_t *mac, uint32_t phy_addr, uint32_t phy_reg, uint32_t *reg_value)
+{
+    esp_err_t err = w5500_mac_read_phy_reg(mac, phy_addr, phy_reg, reg_value);
+    if (err != ESP_OK) atomic_fetch_add(&w5500_spi_errors, 1);
+    return err;
+}
+
+/** MAC PHY register write wrapper: count failed SPI register accesses */
+static esp_err_t w5500_counted_write_phy_reg(esp_eth_mac_t *mac, uint32_t phy_addr, uint32_t phy_reg, uint32_t reg_value)
+{
+    esp_err_t err = w5500_mac_write_phy_reg(mac, phy_addr, phy_reg, reg_value);
+    if (err != ESP_OK) atomic_fetch_add(&w5500_spi_errors, 1);
+    return err;
+}
+
+/** Log hook: count and keep error lines from the W5500 driver, then print as before */
+static int eth_log_vprintf(const char *fmt, va_list args)
+{
+    // ESP_LOGE formats start "E (%lu) %s: " after an optional colour code, so the tag is the
+    // second argument (the timestamp is a string with system-time timestamps)
+    const char *p = fmt;
+    if (p[0] == '\033') {
+        p = strchr(p, 'm');
+        if (!p) return eth_prev_vprintf(fmt, args);
+        p++;
+    }
+    if (strncmp(p, "E (%", 4) != 0) return eth_prev_vprintf(fmt, args);
+
+    va_list copy;
+    va_copy(copy, args);
+    if (p[4] == 's') {
+        (void)va_arg(copy, const char *);
+    } else {
+        (void)va_arg(copy, uint32_t);
+    }
+    const char *tag = va_arg(copy, const char *);
+    va_end(copy);
+
+    if (tag && strncmp(tag, "w5500", 5) == 0) {
+        char line[96];
+        va_copy(copy, args);
+        vsnprintf(line, sizeof(line), fmt, copy);
+        va_end(copy);
+
+        const char *msg = strstr(line, ": ");
+        msg = msg ? msg + 2 : line;
+        atomic_fetch_add(&w5500_logged_errors, 1);
+        strncpy(w5500_last_error, msg, sizeof(w5500_last_error) - 1);
+        w5500_last_error[strcspn(w5500_last_error, "\033\n")] = '\0';
+        w5500_last_error_us = esp_timer_get_time();
+    }
+    return eth_prev_vprintf(fmt, args);
+}
+
+/** Read the W5500 PHY configuration/status register */
+static bool read_w5500_phycfgr(uint8_t *value)
+{
+    uint32_t reg = 0;
+    esp_eth_phy_reg_rw_data_t rw = {.reg_addr = W5500_REG_PHYCFGR, .reg_value_p = &reg};
+    if (esp_eth_ioctl(eth_handle, ETH_CMD_READ_PHY_REG, &rw) != ESP_OK) {
+        return false;
+    }
+    *value = (uint8_t)reg;
+    return true;
+}
+
+/** Record a link change (called from the Ethernet event handler) */
+static void eth_link_changed(bool up)
+{
+    eth_link_up = up;
+    eth_link_changed_us = esp_timer_get_time();
+    if (up) {
+        atomic_fetch_add(&eth_link_ups, 1);
+        esp_eth_ioctl(eth_handle, ETH_CMD_G_SPEED, &eth_speed);
+        esp_eth_ioctl(eth_handle, ETH_CMD_G_DUPLEX_MODE, &eth_duplex);
+        ESP_LOGI(TAG, "Ethernet link: %s Mbps %s duplex", eth_speed == ETH_SPEED_100M ? "100" : "10",
+                 eth_duplex == ETH_DUPLEX_FULL ? "full" : "half");
+    } else {
+        atomic_fetch_add(&eth_link_downs, 1);
+    }
+}
+
+/** Ethernet stats task - samples the PHY and closes one history interval per period */
+static void eth_stats_task(void *pvParameters)
+{
+    uint32_t last_frames = 0, last_downs = 0, last_rx_errors = 0, last_spi_errors = 0, last_drops = 0;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(ETH_STATS_INTERVAL_SEC * 1000));
+
+        uint8_t phycfgr;
+        if (read_w5500_phycfgr(&phycfgr)) {
+            w5500_phycfgr = phycfgr;
+            if (!(phycfgr & W5500_PHYCFGR_LNK) && eth_link_up) {
+                ESP_LOGW(TAG, "W5500 PHY reports link down (PHYCFGR 0x%02x)", phycfgr);
+            }
+        }
+
+        uint32_t frames = w5500_stats[0].frames + w5500_stats[1].frames;
+        uint32_t downs = atomic_load(&eth_link_downs);
+        uint32_t rx_errors = atomic_load(&w5500_rx_errors);
+        uint32_t spi_errors = atomic_load(&w5500_spi_errors);
+        uint32_t drops = atomic_load(&eth_stack_drops);
+
+        eth_history_t *h = &eth_history[eth_history_index];
+        h->timestamp = esp_timer_get_time() / 1000000;
+        h->frames = frames - last_frames;
+        h->link_downs = downs - last_downs;
+        h->rx_errors = rx_errors - last_rx_errors;
+        h->spi_errors = spi_errors - last_spi_errors;
+        h->stack_drops = drops - last_drops;
+        h->phycfgr = w5500_phycfgr;
+        h->valid = true;
+        eth_history_index = (eth_history_index + 1) % ETH_HISTORY_SIZE;
+
+        if (h->link_downs || h->rx_errors || h->spi_errors || h->stack_drops) {
+            ESP_LOGW(TAG, "Ethernet last %ds: %u link down(s), %u RX error(s), %u SPI error(s), %u drop(s)",
+                     ETH_STATS_INTERVAL_SEC, h->link_downs, h->rx_errors, h->spi_errors, h->stack_drops);
+        }
+
+        last_frames = frames;
+        last_downs = downs;
+        last_rx_errors = rx_errors;
+        last_spi_errors = spi_errors;
+        last_drops = drops;
+    }
+}
+
+/** Wrap the MAC's receive and PHY register methods, hook driver error logging and start link stats sampling */
+static void init_eth_stats(esp_eth_mac_t *mac)
+{
+    w5500_mac_receive = mac->receive;
+    w5500_mac_read_phy_reg = mac->read_phy_reg;
+    w5500_mac_write_phy_reg = mac->write_phy_reg;
+    mac->receive = w5500_counted_receive;
+    mac->read_phy_reg = w5500_counted_read_phy_reg;
+    mac->write_phy_reg = w5500_counted_write_phy_reg;
+    eth_prev_vprintf = esp_log_set_vprintf(eth_log_vprintf);
+    xTaskCreate(eth_stats_task, "eth_stats", 2560, NULL, 2, NULL);
+}
+
+#if PROFILER_ENABLED
+// ===== CPU Profiler =====
+// On-demand sampling profiler: while a profile runs, the FreeRTOS tick hook on each core
+// records the PC the tick interrupted, its caller and the running task into a fixed buffer.
+// /api/profile returns a binary dump that profile.sh symbolises into folded stacks.
+// Xtensa only: at interrupt entry the port saves the interrupted frame (XtExcFrame) at the
+// task's pxTopOfStack, which is the first word of its TCB.
+#define PROFILE_VERSION 1
+#define PROFILE_MAX_TASKS 32
+#define PROFILE_MAX_SECONDS 30
+#define XT_FRAME_PC 1       // XtExcFrame word offsets (xtensa_context.h: exit, pc, ps, a0, ...)
+#define XT_FRAME_A0 3
+
+typedef struct __attribute__((packed)) {
+    uint32_t pc;
+    uint32_t caller;        // Raw a0: windowed return address (profile.sh decodes it)
+    uint8_t core;
+    uint8_t task;           // Index into the dump's task table
+    uint16_t reserved;
+} profile_sample_t;
+
+typedef struct __attribute__((packed)) {
+    char magic[4];          // "PRF1"
+    uint16_t version;
+    uint16_t task_count;
+    uint32_t sample_count;
+    uint32_t rate_hz;       // Per core
+    uint32_t duration_ms;
+    uint32_t dropped;       // Samples lost to a full buffer
+    uint8_t elf_sha256[32]; // Must match the ELF used for symbolisation
+} profile_header_t;
+
+static profile_sample_t *profile_samples = NULL;
+static uint32_t profile_capacity = 0;               // Samples the current buffer holds
+static uint32_t profile_divider = 1;                // Sample every Nth tick so the window fits
+static uint32_t profile_ticks[portNUM_PROCESSORS];
+static volatile uint32_t profile_count = 0;
+static volatile uint32_t profile_dropped = 0;
+static volatile bool profile_running = false;
+static int64_t profile_start_us = 0;
+static uint32_t profile_duration_ms = 0;
+static TaskHandle_t profile_tasks[PROFILE_MAX_TASKS];
+static char profile_task_names[PROFILE_MAX_TASKS][16];
+static volatile uint8_t profile_task_count = 0;
+static portMUX_TYPE profile_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t profile_timer = NULL;
+
+/** Tick hook (both cores): sample the interrupted PC, its caller and the running task */
+static void IRAM_ATTR profile_tick_hook(void)
+{
+    if (!profile_running) return;
+    int core = xPortGetCoreID();
+    if (++profile_ticks[core] % profile_divider != 0) return;
+    TaskHandle_t task = xTaskGetCurrentTaskHandleForCore(core);
+    if (!task) return;
+    const uint32_t *frame = *(const uint32_t *const *)task;
+
+    portENTER_CRITICAL_ISR(&profile_lock);
+    uint32_t n = profile_count;
+    if (n >= profile_capacity) {
+        profile_dropped++;
+    } else {
+        int t = 0;
+        while (t < profile_task_count && profile_tasks[t] != task) t++;
+        if (t == profile_task_count && t < PROFILE_MAX_TASKS) {
+            profile_tasks[t] = task;
+            strncpy(profile_task_names[t], pcTaskGetName(task), sizeof(profile_task_names[t]));
+            profile_task_count = t + 1;
+        }
+        profile_samples[n].pc = frame[XT_FRAME_PC];
+        profile_samples[n].caller = frame[XT_FRAME_A0];
+        profile_samples[n].core = core;
+        profile_samples[n].task = t < PROFILE_MAX_TASKS ? t : 0xFF;
+        profile_samples[n].reserved = 0;
+        profile_count = n + 1;
+    }
+    portEXIT_CRITICAL_ISR(&profile_lock);
+}
+
+/** End of the profiling window: unhook both cores */
+static void profile_stop(void *arg)
+{
+    profile_running = false;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_deregister_freertos_tick_hook_for_cpu(profile_tick_hook, core);
+    }
+    profile_duration_ms = (uint32_t)((esp_timer_get_time() - profile_start_us) / 1000);
+    ESP_LOGI(TAG, "Profile done: %lu samples in %lu ms (%lu dropped)", (unsigned long)profile_count,
+             (unsigned long)profile_duration_ms, (unsigned long)profile_dropped);
 }
 
-/** Release a buffer pair back to the pool */
-static void release_buffer_pair(int index)
+/**
+ * Start sampling for the given number of seconds. Ticks are decimated so the whole window fits
+ * in PROFILER_MAX_SAMPLES, and the buffer is sized for the window. It prefers PSRAM; from
+ * internal RAM it must leave POOL_HEAP_RESERVE free for the proxy.
+ */
+static esp_err_t profile_start(int seconds)
 {
-    if (index >= 0 && index < MAX_CONCURRENT_CLIENTS) {
-        if (xSemaphoreTake(buffer_pool_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            buffer_pool[index].in_use = false;
-            xSemaphoreGive(buffer_pool_mutex);
+    uint32_t ticks = (uint32_t)seconds * CONFIG_FREERTOS_HZ;
+    uint32_t divider = 1;
+    while (((ticks + divider - 1) / divider + 1) * portNUM_PROCESSORS > PROFILER_MAX_SAMPLES) {
+        divider++;
+    }
+    uint32_t capacity = ((ticks + divider - 1) / divider + 1) * portNUM_PROCESSORS;
+    size_t size = capacity * sizeof(profile_sample_t);
+
+    heap_caps_free(profile_samples);    // Previous profile that was never downloaded
+    profile_samples = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (!profile_samples) {
+        size_t internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (internal_free < size + POOL_HEAP_RESERVE) {
+            ESP_LOGW(TAG, "Profile refused: %u bytes would leave less than %d bytes of internal heap",
+                     (unsigned)size, POOL_HEAP_RESERVE);
+            return ESP_ERR_NO_MEM;
         }
+        profile_samples = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (!profile_samples) return ESP_ERR_NO_MEM;
+    profile_capacity = capacity;
+    profile_divider = divider;
+    if (!profile_timer) {
+        esp_timer_create_args_t timer_args = {
+            .callback = profile_stop,
+            .name = "profile",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &profile_timer));
+    }
+
+    profile_count = 0;
+    profile_dropped = 0;
+    profile_task_count = 0;
+    memset(profile_ticks, 0, sizeof(profile_ticks));
+    profile_duration_ms = 0;
+    profile_start_us = esp_timer_get_time();
+    profile_running = true;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_register_freertos_tick_hook_for_cpu(profile_tick_hook, core);
     }
+    esp_timer_start_once(profile_timer, (uint64_t)seconds * 1000000);
+    ESP_LOGI(TAG, "Profiling for %d s at %lu Hz per core (%lu samples)", seconds,
+             (unsigned long)(CONFIG_FREERTOS_HZ / divider), (unsigned long)capacity);
+    return ESP_OK;
 }
+#endif
 
 // ===== NVS WiFi Credential Storage =====
 
@@ -256,16 +2974,13 @@ static void check_powerwall_connectivity(void)
         powerwall_reachable = false;
         return;
     }
+    socket_opened();
 
     // Set socket to non-blocking
     int flags = fcntl(sock, F_GETFL, 0);
     fcntl(sock, F_SETFL, flags | O_NONBLOCK);
 
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(443);
-    inet_pton(AF_INET, POWERWALL_IP_STR, &addr.sin_addr);
-
+    struct sockaddr_in addr = upstream_addr;
     int result = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
 
     if (result == 0) {
@@ -289,10 +3004,205 @@ static void check_powerwall_connectivity(void)
         powerwall_reachable = false;
     }
 
-    close(sock);
+    close_socket(sock);
     last_powerwall_check = esp_timer_get_time() / 1000;  // Convert to ms
 }
 
+/**
+ * Keep one upstream endpoint's MAC resolved (and pinned). A pin is checked against the
+ * endpoint's connect outcomes (proxied connections and health probes) since the last pass:
+ * only failures means the device behind the address may have changed, so the entry is
+ * dropped and relearned. Off-link endpoints are skipped; lwIP resolves their router.
+ */
+static void arp_refresh_endpoint(int i)
+{
+    upstream_endpoint_t *ep = &upstream_endpoints[i];
+    struct sockaddr_in addr;
+    esp_netif_t *via = upstream_endpoint_target(i, &addr);
+    struct netif *netif = esp_netif_get_netif_impl(via);
+    EventBits_t up_bit = ep->via_eth ? ETH_GOT_IP_BIT : WIFI_CONNECTED_BIT;
+    esp_netif_ip_info_t info;
+    if (!netif || !(xEventGroupGetBits(s_event_group) & up_bit) ||
+        esp_netif_get_ip_info(via, &info) != ESP_OK || info.ip.addr == 0) {
+        return;
+    }
+    if (((addr.sin_addr.s_addr ^ info.ip.addr) & info.netmask.addr) != 0) return;
+
+    char label[32];
+    upstream_endpoint_label(i, label, sizeof(label));
+    arp_op_t op = {.netif = netif};
+    op.ip.addr = addr.sin_addr.s_addr;
+
+    // Endpoint moved (new DHCP gateway) - drop the entry pinned for the old address
+    if (ep->arp_pinned && ep->pinned_ip != op.ip.addr) {
+        arp_op_t old = {.netif = netif, .unpin = true};
+        old.ip.addr = ep->pinned_ip;
+        run_arp_op(&old);
+        ep->arp_pinned = false;
+        ep->mac_valid = false;
+    }
+
+    uint32_t ok = 0, failed = 0;
+    if (upstream_mutex) {
+        xSemaphoreTake(upstream_mutex, portMAX_DELAY);
+        ok = ep->successes - ep->arp_successes;
+        failed = ep->failures - ep->arp_failures;
+        ep->arp_successes = ep->successes;
+        ep->arp_failures = ep->failures;
+        xSemaphoreGive(upstream_mutex);
+    }
+    if (ep->arp_pinned && failed > 0 && ok == 0) {
+        op.unpin = true;
+        run_arp_op(&op);
+        op.unpin = false;
+        ep->arp_pinned = false;
+        ep->mac_valid = false;
+        ESP_LOGW(TAG, "Upstream %s only failed since the last check - unpinned ARP entry to relearn MAC", label);
+    }
+
+    if (!ep->arp_pinned) {
+        // First lookup sends the request; check again once the reply had time to arrive
+        run_arp_op(&op);
+        if (!op.found) {
+            vTaskDelay(pdMS_TO_TICKS(200));
+            run_arp_op(&op);
+        }
+
+        if (op.found) {
+            if (!ep->mac_valid || memcmp(ep->mac, op.mac.addr, 6) != 0) {
+                memcpy(ep->mac, op.mac.addr, 6);
+                ESP_LOGI(TAG, "Upstream %s is at %02x:%02x:%02x:%02x:%02x:%02x", label,
+                         ep->mac[0], ep->mac[1], ep->mac[2], ep->mac[3], ep->mac[4], ep->mac[5]);
+            }
+            ep->mac_valid = true;
+
+            #if ARP_PIN_UPSTREAM && ETHARP_SUPPORT_STATIC_ENTRIES
+            op.pin = true;
+            if (run_arp_op(&op) && op.found) {
+                ep->arp_pinned = true;
+                ep->pinned_ip = op.ip.addr;
+                ESP_LOGI(TAG, "Pinned static ARP entry for %s", label);
+            }
+            #endif
+        }
+    }
+}
+
+/** Upstream ARP refresh task - keeps every on-link endpoint's MAC resolved */
+static void arp_refresh_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "Upstream ARP refresh started (interval: %d seconds)", ARP_REFRESH_INTERVAL_SEC);
+    while (1) {
+        for (int i = 0; i < upstream_endpoint_count; i++) {
+            arp_refresh_endpoint(i);
+        }
+        vTaskDelay(pdMS_TO_TICKS(ARP_REFRESH_INTERVAL_SEC * 1000));
+    }
+}
+
+// ===== Render Stats =====
+// Measures the cost of building web UI / API responses (bytes, chunks, time, stack).
+// The HTTP server runs handlers on a single task, so one in-flight render context is enough.
+typedef enum {
+    RENDER_STATUS_PAGE = 0,
+    RENDER_API_STATUS,
+    RENDER_API_REQUESTS,
+    RENDER_COUNT
+} render_id_t;
+
+static const char *render_names[RENDER_COUNT] = {"status_page", "api_status", "api_requests"};
+
+typedef struct {
+    uint32_t renders;       // Number of completed renders
+    uint32_t last_bytes;    // Bytes emitted by the last render
+    uint32_t max_bytes;     // Largest render seen
+    uint16_t last_chunks;   // Chunk (send) calls in the last render
+    uint32_t last_us;       // Duration of the last render
+    uint32_t max_us;        // Slowest render seen
+    uint64_t total_us;      // Sum of render durations (for average)
+    uint32_t stack_hwm;     // HTTP task stack high-water mark after render (bytes free)
+} render_stats_t;
+
+static render_stats_t render_stats[RENDER_COUNT];
+static int64_t render_start_us = 0;
+static uint32_t render_bytes = 0;
+static uint16_t render_chunks = 0;
+
+/** Start measuring a response render */
+static void render_begin(void)
+{
+    render_start_us = esp_timer_get_time();
+    render_bytes = 0;
+    render_chunks = 0;
+}
+
+/** Send a response chunk and account for it (NULL terminates the response) */
+static esp_err_t render_chunk(httpd_req_t *req, const char *str)
+{
+    if (str) {
+        render_bytes += strlen(str);
+        render_chunks++;
+    }
+    return httpd_resp_sendstr_chunk(req, str);
+}
+
+/** Send a complete (non-chunked) response and account for it */
+static esp_err_t render_send(httpd_req_t *req, const char *buf, size_t len)
+{
+    render_bytes += len;
+    render_chunks++;
+    return httpd_resp_send(req, buf, len);
+}
+
+/** Buffered chunk writer: batches small fragments into ~1 KB chunks with constant memory */
+typedef struct {
+    httpd_req_t *req;
+    char buf[1024];
+    size_t len;
+    esp_err_t err;          // First send error; later writes are dropped
+} chunk_writer_t;
+
+static void chunk_flush(chunk_writer_t *w)
+{
+    if (w->len > 0 && w->err == ESP_OK) {
+        w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void chunk_printf(chunk_writer_t *w, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(w->buf + w->len, sizeof(w->buf) - w->len, fmt, args);
+    va_end(args);
+    if (n >= 0 && (size_t)n >= sizeof(w->buf) - w->len) {
+        // Did not fit: flush what we have and format again into the empty buffer
+        chunk_flush(w);
+        va_start(args, fmt);
+        n = vsnprintf(w->buf, sizeof(w->buf), fmt, args);
+        va_end(args);
+        if ((size_t)n >= sizeof(w->buf)) n = sizeof(w->buf) - 1;
+    }
+    if (n > 0) w->len += n;
+}
+
+/** Finish measuring a response render */
+static void render_end(render_id_t id)
+{
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - render_start_us);
+    render_stats_t *s = &render_stats[id];
+
+    s->renders++;
+    s->last_bytes = render_bytes;
+    s->last_chunks = render_chunks;
+    s->last_us = elapsed_us;
+    s->total_us += elapsed_us;
+    if (elapsed_us > s->max_us) s->max_us = elapsed_us;
+    if (render_bytes > s->max_bytes) s->max_bytes = render_bytes;
+    s->stack_hwm = uxTaskGetStackHighWaterMark(NULL);
+}
+
 // ===== OTA Update Handlers =====
 
 // Simple inline SVG icons (no external fonts needed)
@@ -377,31 +3287,32 @@ static esp_err_t ota_status_handler(httpd_req_t *req)
     }
 
     // Build response - split into chunks for memory efficiency
+    render_begin();
     httpd_resp_set_type(req, "text/html");
 
     // Send HTML head and CSS separately (CSS is too large for single buffer)
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<!DOCTYPE html><html><head><meta charset=\"UTF-8\"><meta name=\"viewport\" content=\"width=device-width,initial-scale=1\">"
         "<title>ESP32 WiFi Bridge</title><style>");
-    httpd_resp_sendstr_chunk(req, DARK_CSS);
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req, DARK_CSS);
+    render_chunk(req,
         "svg.i{width:1.125rem;height:1.125rem;vertical-align:middle;margin-right:0.25rem;fill:currentColor}"
         "</style></head><body><div class=\"container\">");
 
     char buf[512];
 
     // Status card - header
-    httpd_resp_sendstr_chunk(req, "<div class=\"card\"><h1>" ICON_ROUTER " ESP32 WiFi Bridge</h1><div class=\"grid\">");
+    render_chunk(req, "<div class=\"card\"><h1>" ICON_ROUTER " ESP32 WiFi Bridge</h1><div class=\"grid\">");
 
     // WiFi status (clickable to show/hide WiFi config)
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<div class=\"status-item\" style=\"cursor:pointer\" onclick=\"document.getElementById('wificfg').style.display=document.getElementById('wificfg').style.display==='none'?'block':'none'\">"
         "<div class=\"label\">" ICON_WIFI " WiFi " ICON_SETTINGS "</div>");
     snprintf(buf, sizeof(buf),
         "<div class=\"value\"><span class=\"status-dot %s\"></span>%s</div></div>",
         wifi_connected ? "status-ok" : "status-err",
         wifi_connected ? "Connected" : "Disconnected");
-    httpd_resp_sendstr_chunk(req, buf);
+    render_chunk(req, buf);
 
     // Signal strength (with ID for auto-refresh, colored by quality)
     if (wifi_connected) {
@@ -415,7 +3326,7 @@ static esp_err_t ota_status_handler(httpd_req_t *req)
         snprintf(buf, sizeof(buf),
             "<div class=\"status-item\"><div class=\"label\">" ICON_SIGNAL " Signal</div><div class=\"value\" id=\"sig\">-</div></div>");
     }
-    httpd_resp_sendstr_chunk(req, buf);
+    render_chunk(req, buf);
 
     // Powerwall status
     snprintf(buf, sizeof(buf),
@@ -423,31 +3334,32 @@ static esp_err_t ota_status_handler(httpd_req_t *req)
         "<div class=\"value\"><span class=\"status-dot %s\"></span>%s</div></div>",
         powerwall_reachable ? "status-ok" : "status-err",
         powerwall_reachable ? "Reachable" : "Unreachable");
-    httpd_resp_sendstr_chunk(req, buf);
+    render_chunk(req, buf);
 
-    // Target IP
+    // Target IP (WiFi gateway unless overridden)
+    char target_str[16];
     snprintf(buf, sizeof(buf),
         "<div class=\"status-item\"><div class=\"label\">" ICON_DNS " Target</div><div class=\"value\">%s</div></div>"
-        "</div></div>", POWERWALL_IP_STR);
-    httpd_resp_sendstr_chunk(req, buf);
+        "</div></div>", upstream_ip_string(target_str, sizeof(target_str)));
+    render_chunk(req, buf);
 
     // WiFi Configuration card (hidden by default, toggle via WiFi Status click)
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<div class=\"card\" id=\"wificfg\" style=\"display:none\"><h2>" ICON_SETTINGS " WiFi Configuration</h2>"
         "<form method=\"POST\" action=\"/wifi/save\">"
         "<div class=\"form-group\"><label class=\"label\">Network SSID</label>");
 
     snprintf(buf, sizeof(buf),
         "<input type=\"text\" name=\"ssid\" id=\"ssid\" value=\"%s\" placeholder=\"Enter SSID\" class=\"mt-1\">", wifi_ssid);
-    httpd_resp_sendstr_chunk(req, buf);
+    render_chunk(req, buf);
 
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<div class=\"flex mt-1\">"
         "<button type=\"button\" class=\"btn btn-secondary\" onclick=\"scanWifi()\">" ICON_SEARCH " Scan</button>"
         "<select id=\"wl\" style=\"display:none;flex:1\" onchange=\"document.getElementById('ssid').value=this.value\"></select>"
         "</div></div>");
 
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<div class=\"form-group\"><label class=\"label\">Password</label>"
         "<input type=\"password\" name=\"password\" placeholder=\"Enter password\" class=\"mt-1\"></div>");
 
@@ -455,34 +3367,34 @@ static esp_err_t ota_status_handler(httpd_req_t *req)
         "<div class=\"text-xs text-muted\" style=\"margin-bottom:0.75rem\">Current: %s</div>"
         "<button type=\"submit\" class=\"btn btn-primary\">" ICON_SAVE " Save &amp; Reconnect</button>"
         "</form></div>", wifi_ssid);
-    httpd_resp_sendstr_chunk(req, buf);
+    render_chunk(req, buf);
 
     // System info card
-    httpd_resp_sendstr_chunk(req, "<div class=\"card\"><h2>" ICON_MEMORY " System</h2><div class=\"grid\">");
+    render_chunk(req, "<div class=\"card\"><h2>" ICON_MEMORY " System</h2><div class=\"grid\">");
     snprintf(buf, sizeof(buf),
         "<div class=\"status-item\"><div class=\"label\">CPU</div><div class=\"value\" id=\"cpu\">%u%%</div></div>"
         "<div class=\"status-item\"><div class=\"label\">Heap</div><div class=\"value\">%lu KB</div></div>",
         cpu_usage_percent, (unsigned long)(esp_get_free_heap_size() / 1024));
-    httpd_resp_sendstr_chunk(req, buf);
+    render_chunk(req, buf);
     snprintf(buf, sizeof(buf),
         "<div class=\"status-item\"><div class=\"label\">WiFi IP</div><div class=\"value\">%s</div></div>"
         "</div>",
         ip_str);
-    httpd_resp_sendstr_chunk(req, buf);
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req, buf);
+    render_chunk(req,
         "<hr><form id=\"rebootform\" method=\"POST\" action=\"/reboot\">"
         "<button type=\"button\" class=\"btn btn-secondary\" onclick=\"if(confirm('Reboot device?'))document.getElementById('rebootform').submit()\">"
         ICON_UPDATE " Reboot</button></form></div>");
 
     // Recent requests card with TTFB (IDs for auto-refresh)
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<div class=\"card\"><h2>" ICON_SWAP " Recent Requests</h2>"
         "<div class=\"flex\" style=\"justify-content:space-between;margin-bottom:0.5rem\">");
     snprintf(buf, sizeof(buf),
         "<span class=\"text-sm text-muted\">Avg TTFB: <span id=\"avgttfb\">%lu</span> ms</span>",
         (unsigned long)avg_ttfb_ms);
-    httpd_resp_sendstr_chunk(req, buf);
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req, buf);
+    render_chunk(req,
         "<span class=\"text-xs text-muted\">Updated: <span id=\"lastref\">now</span></span></div>"
         "<table style=\"width:100%;font-size:0.875rem\">"
         "<tr style=\"color:#94a3b8\"><td>Age</td><td>Source</td><td>Req/Resp</td><td>Response</td><td>Status</td></tr>"
@@ -505,30 +3417,30 @@ static esp_err_t ota_status_handler(httpd_req_t *req)
             const char *color = e->result == 0 ? "#22c55e" : (e->result == 1 ? "#eab308" : "#ef4444");
 
             // Format source IP
-            uint8_t *ip = (uint8_t *)&e->source_ip;
+            char src[20];
+            format_log_source(e, src, sizeof(src));
 
             snprintf(buf, sizeof(buf),
-                "<tr><td>%lld%s</td><td>%d.%d.%d.%d</td><td>%lu/%lu</td><td>%u-%ums</td><td style=\"color:%s\">%s</td></tr>",
-                (long long)age, age_unit,
-                ip[0], ip[1], ip[2], ip[3],
+                "<tr><td>%lld%s</td><td>%s</td><td>%lu/%lu</td><td>%u-%ums</td><td style=\"color:%s\">%s</td></tr>",
+                (long long)age, age_unit, src,
                 (unsigned long)e->bytes_in, (unsigned long)e->bytes_out,
                 e->ttfb_ms, e->ttlb_ms, color, status);
-            httpd_resp_sendstr_chunk(req, buf);
+            render_chunk(req, buf);
         }
         xSemaphoreGive(request_log_mutex);
     }
 
-    httpd_resp_sendstr_chunk(req, "</tbody></table></div>");
+    render_chunk(req, "</tbody></table></div>");
 
     // Firmware card (at bottom)
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<div class=\"card\"><h2>" ICON_UPDATE " Firmware</h2><div class=\"grid\">");
 
     snprintf(buf, sizeof(buf),
         "<div class=\"status-item\"><div class=\"label\">Version</div><div class=\"value\">%s</div></div>"
         "<div class=\"status-item\"><div class=\"label\">Built</div><div class=\"value text-sm\">%s</div></div>",
         app_desc->version, app_desc->date);
-    httpd_resp_sendstr_chunk(req, buf);
+    render_chunk(req, buf);
 
     snprintf(buf, sizeof(buf),
         "<div class=\"status-item\"><div class=\"label\">Partition</div><div class=\"value\">%s</div></div>"
@@ -536,21 +3448,21 @@ static esp_err_t ota_status_handler(httpd_req_t *req)
         running->label,
         ota_state == ESP_OTA_IMG_VALID ? "Valid" :
         ota_state == ESP_OTA_IMG_PENDING_VERIFY ? "Pending" : "New");
-    httpd_resp_sendstr_chunk(req, buf);
+    render_chunk(req, buf);
 
     // OTA upload form
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<form method=\"POST\" action=\"/ota/upload\" enctype=\"multipart/form-data\">"
         "<div class=\"form-group\"><label class=\"label\">" ICON_UPLOAD " Upload Firmware (.bin)</label>"
         "<input type=\"file\" name=\"firmware\" accept=\".bin\" class=\"mt-1\"></div>"
         "<div class=\"flex\"><button type=\"submit\" class=\"btn btn-primary\">" ICON_UPLOAD " Upload</button>");
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<button type=\"button\" class=\"btn btn-danger\" onclick=\"if(confirm('Rollback?'))document.getElementById('rb').submit()\">" ICON_HISTORY " Rollback</button></div>"
         "</form><form id=\"rb\" method=\"POST\" action=\"/ota/rollback\"></form>"
         "<div class=\"alert alert-warn mt-2\">" ICON_WARN " Device will reboot after update</div></div>");
 
     // JavaScript for WiFi scanning and auto-refresh
-    httpd_resp_sendstr_chunk(req,
+    render_chunk(req,
         "<script>"
         "function scanWifi(){"
         "var s=document.getElementById('wl');"
@@ -579,7 +3491,8 @@ static esp_err_t ota_status_handler(httpd_req_t *req)
         "setInterval(refresh,5000);setInterval(updAge,1000);refresh();"
         "</script></div></body></html>");
 
-    httpd_resp_sendstr_chunk(req, NULL);  // End chunked response
+    render_chunk(req, NULL);  // End chunked response
+    render_end(RENDER_STATUS_PAGE);
     return ESP_OK;
 }
 
@@ -697,9 +3610,9 @@ static esp_err_t ota_upload_handler(httpd_req_t *req)
     httpd_resp_set_type(req, "text/html");
     httpd_resp_send(req, response, strlen(response));
 
-    // Delay to allow response to be sent, then reboot
+    // Delay to allow response to be sent, then drain and reboot
     vTaskDelay(pdMS_TO_TICKS(1000));
-    esp_restart();
+    start_drain("ota", drain_restart);
 
     return ESP_OK;
 }
@@ -771,6 +3684,22 @@ static esp_err_t wifi_scan_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/** Reconnect WiFi with the current runtime credentials (after a drain) */
+static void wifi_reconnect(void)
+{
+    esp_wifi_disconnect();
+
+    wifi_config_t wifi_config = {0};
+    strncpy((char *)wifi_config.sta.ssid, wifi_ssid, sizeof(wifi_config.sta.ssid) - 1);
+    strncpy((char *)wifi_config.sta.password, wifi_password, sizeof(wifi_config.sta.password) - 1);
+    wifi_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
+
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_connect();
+
+    ESP_LOGI(TAG, "WiFi reconnecting to: %s", wifi_ssid);
+}
+
 /** WiFi save handler - saves new credentials and reconnects */
 static esp_err_t wifi_save_handler(httpd_req_t *req)
 {
@@ -842,20 +3771,9 @@ static esp_err_t wifi_save_handler(httpd_req_t *req)
     httpd_resp_set_type(req, "text/html");
     httpd_resp_send(req, response, strlen(response));
 
-    // Disconnect and reconnect with new credentials
+    // Drain proxied connections, then reconnect with the new credentials
     vTaskDelay(pdMS_TO_TICKS(500));
-
-    esp_wifi_disconnect();
-
-    wifi_config_t wifi_config = {0};
-    strncpy((char *)wifi_config.sta.ssid, new_ssid, sizeof(wifi_config.sta.ssid) - 1);
-    strncpy((char *)wifi_config.sta.password, new_password, sizeof(wifi_config.sta.password) - 1);
-    wifi_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
-
-    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
-    esp_wifi_connect();
-
-    ESP_LOGI(TAG, "WiFi reconnecting to: %s", new_ssid);
+    start_drain("wifi", wifi_reconnect);
     return ESP_OK;
 }
 
@@ -877,20 +3795,499 @@ static esp_err_t api_status_handler(httpd_req_t *req)
         check_powerwall_connectivity();
     }
 
-    char response[300];
-    snprintf(response, sizeof(response),
-        "{\"wifi\":{\"connected\":%s,\"ssid\":\"%s\",\"rssi\":%d},"
-        "\"powerwall\":{\"reachable\":%s,\"ip\":\"%s\"},"
-        "\"cpu\":%u,\"heap\":%lu}",
-        wifi_connected ? "true" : "false",
-        wifi_ssid, rssi,
-        powerwall_reachable ? "true" : "false",
-        POWERWALL_IP_STR,
-        cpu_usage_percent,
-        (unsigned long)esp_get_free_heap_size());
-
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, response, strlen(response));
+    render_begin();
+    // ARP state of the gateway endpoint (the address reported below)
+    const upstream_endpoint_t *gw_ep = NULL;
+    for (int i = 0; i < upstream_endpoint_count && !gw_ep; i++) {
+        if (upstream_endpoints[i].use_gateway) gw_ep = &upstream_endpoints[i];
+    }
+    char upstream_mac_str[18] = "";
+    if (gw_ep && gw_ep->mac_valid) {
+        snprintf(upstream_mac_str, sizeof(upstream_mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 gw_ep->mac[0], gw_ep->mac[1], gw_ep->mac[2], gw_ep->mac[3], gw_ep->mac[4], gw_ep->mac[5]);
+    }
+
+    char upstream_str[16];
+    upstream_ip_string(upstream_str, sizeof(upstream_str));
+
+    char response[640];
+    snprintf(response, sizeof(response),
+        "{\"wifi\":{\"connected\":%s,\"ssid\":\"%s\",\"rssi\":%d},"
+        "\"powerwall\":{\"reachable\":%s,\"ip\":\"%s\",\"from_dhcp\":%s,\"mac\":\"%s\",\"arp_pinned\":%s},"
+        "\"cpu\":%u,\"heap\":%lu,\"version\":\"%s\",\"uptime\":%lld,"
+        "\"connections\":{\"active\":%d,\"rejected\":%u,\"denied\":%u},"
+        "\"ethernet\":{\"link\":%s,\"speed\":%d,\"flaps\":%u,\"errors\":%u}}",
+        wifi_connected ? "true" : "false",
+        wifi_ssid, rssi,
+        powerwall_reachable ? "true" : "false",
+        upstream_str, upstream_from_dhcp ? "true" : "false", upstream_mac_str,
+        gw_ep && gw_ep->arp_pinned ? "true" : "false",
+        cpu_usage_percent,
+        (unsigned long)esp_get_free_heap_size(),
+        esp_app_get_description()->version,
+        (long long)(esp_timer_get_time() / 1000000),
+        atomic_load(&active_connections), atomic_load(&rejected_connections),
+        atomic_load(&acl_denied),
+        eth_link_up ? "true" : "false", eth_speed == ETH_SPEED_100M ? 100 : 10,
+        atomic_load(&eth_link_downs),
+        atomic_load(&w5500_rx_errors) + atomic_load(&w5500_spi_errors) + atomic_load(&eth_stack_drops));
+
+    httpd_resp_set_type(req, "application/json");
+    render_send(req, response, strlen(response));
+    render_end(RENDER_API_STATUS);
+    return ESP_OK;
+}
+
+/** API endpoint for connection admission (slot rejections, source ACL, accept control, drain) */
+static esp_err_t api_connections_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+        "{\"active\":%d,\"rejected\":%u,"
+        "\"acl\":{\"default\":\"%s\",\"ipv6\":\"%s\",\"denied\":%u,\"default_hits\":%u,\"rules\":[",
+        atomic_load(&active_connections), atomic_load(&rejected_connections),
+        SOURCE_ACL_DEFAULT_ALLOW ? "allow" : "deny", SOURCE_ACL_ALLOW_IPV6 ? "allow" : "deny",
+        atomic_load(&acl_denied), atomic_load(&acl_default_hits));
+    httpd_resp_sendstr_chunk(req, buf);
+
+    for (int i = 0; i < acl_rule_count; i++) {
+        struct in_addr net = {.s_addr = htonl(acl_rules[i].net)};
+        char net_str[16];
+        inet_ntoa_r(net, net_str, sizeof(net_str));
+        snprintf(buf, sizeof(buf), "%s{\"rule\":\"%c%s/%u\",\"hits\":%u}",
+                 i > 0 ? "," : "", acl_rules[i].allow ? '+' : '-', net_str,
+                 acl_rules[i].prefix_len, atomic_load(&acl_hits[i]));
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    httpd_resp_sendstr_chunk(req, "]},");
+
+    snprintf(buf, sizeof(buf),
+        "\"accept\":{\"total\":%u,\"throttled\":%u,\"errors\":%u,\"backlog\":%d,\"backlog_full\":%u,"
+        "\"latency_avg_us\":%u,\"latency_max_us\":%u}",
+        atomic_load(&accept_total), atomic_load(&accept_throttled), atomic_load(&accept_errors),
+        PROXY_LISTEN_BACKLOG, atomic_load(&accept_backlog_full),
+        atomic_load(&accept_latency_avg_us), atomic_load(&accept_latency_max_us));
+    httpd_resp_sendstr_chunk(req, buf);
+
+    httpd_resp_sendstr_chunk(req, ",\"closes\":{");
+    for (int i = 0; i < CLOSE_REASON_COUNT; i++) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%u", i > 0 ? "," : "",
+                 close_reason_names[i], atomic_load(&close_counts[i]));
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+    httpd_resp_sendstr_chunk(req, "}");
+
+    snprintf(buf, sizeof(buf), ",\"drain\":{\"active\":%s,\"timeout_ms\":%d,\"refused\":%u,\"last\":",
+             atomic_load(&draining) ? "true" : "false", DRAIN_TIMEOUT_MS, atomic_load(&drain_refused));
+    httpd_resp_sendstr_chunk(req, buf);
+    if (last_drain.magic == DRAIN_REPORT_MAGIC) {
+        snprintf(buf, sizeof(buf), "{\"reason\":\"%s\",\"drained\":%u,\"cut\":%u,\"ms\":%lu}}}",
+                 last_drain.reason, last_drain.drained, last_drain.cut, (unsigned long)last_drain.duration_ms);
+        httpd_resp_sendstr_chunk(req, buf);
+    } else {
+        httpd_resp_sendstr_chunk(req, "null}}");
+    }
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+#if PROFILER_ENABLED
+/** API endpoint to start a CPU profile: POST /api/profile?seconds=N */
+static esp_err_t api_profile_start_handler(httpd_req_t *req)
+{
+    int seconds = 5;
+    char query[32], value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "seconds", value, sizeof(value)) == ESP_OK) {
+        seconds = atoi(value);
+    }
+    if (seconds < 1 || seconds > PROFILE_MAX_SECONDS) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "seconds must be 1-30");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    if (profile_running) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "{\"error\":\"profile already running\"}");
+        return ESP_OK;
+    }
+    if (profile_start(seconds) != ESP_OK) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "{\"error\":\"not enough free heap for the profile buffer\"}");
+        return ESP_OK;
+    }
+
+    char response[128];
+    snprintf(response, sizeof(response), "{\"started\":true,\"seconds\":%d,\"rate_hz\":%lu,\"max_samples\":%lu}",
+             seconds, (unsigned long)(CONFIG_FREERTOS_HZ / profile_divider), (unsigned long)profile_capacity);
+    httpd_resp_sendstr(req, response);
+    return ESP_OK;
+}
+
+/** API endpoint to download the last CPU profile (binary; frees the buffer) */
+static esp_err_t api_profile_get_handler(httpd_req_t *req)
+{
+    if (profile_running) {
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "{\"error\":\"profile still running\"}");
+        return ESP_OK;
+    }
+    if (!profile_samples || profile_duration_ms == 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No profile captured");
+        return ESP_FAIL;
+    }
+
+    profile_header_t header = {
+        .magic = {'P', 'R', 'F', '1'},
+        .version = PROFILE_VERSION,
+        .task_count = profile_task_count,
+        .sample_count = profile_count,
+        .rate_hz = CONFIG_FREERTOS_HZ / profile_divider,
+        .duration_ms = profile_duration_ms,
+        .dropped = profile_dropped,
+    };
+    memcpy(header.elf_sha256, esp_app_get_description()->app_elf_sha256, sizeof(header.elf_sha256));
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"profile.bin\"");
+    httpd_resp_send_chunk(req, (const char *)&header, sizeof(header));
+    httpd_resp_send_chunk(req, (const char *)profile_task_names, profile_task_count * sizeof(profile_task_names[0]));
+    for (uint32_t i = 0; i < profile_count; i += 256) {
+        uint32_t n = profile_count - i < 256 ? profile_count - i : 256;
+        if (httpd_resp_send_chunk(req, (const char *)&profile_samples[i], n * sizeof(profile_sample_t)) != ESP_OK) {
+            break;
+        }
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    // The buffer is large; give it back once the dump has been served
+    heap_caps_free(profile_samples);
+    profile_samples = NULL;
+    profile_duration_ms = 0;
+    return ESP_OK;
+}
+#endif
+
+#if TRACE_ENABLED
+/** Look up a task name in a system state snapshot */
+static const char *trace_task_name(const TaskStatus_t *tasks, int count, uint32_t handle)
+{
+    for (int i = 0; i < count; i++) {
+        if ((uint32_t)tasks[i].xHandle == handle) return tasks[i].pcTaskName;
+    }
+    return NULL;
+}
+
+/** Emit one Chrome trace "complete" slice */
+static void trace_emit_slice(chunk_writer_t *w, const char *name, uint32_t handle, int core,
+                             uint32_t start_us, uint32_t end_us)
+{
+    if (name) {
+        chunk_printf(w, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lu,\"dur\":%lu}",
+                     name, core, (unsigned long)start_us, (unsigned long)(end_us - start_us));
+    } else {
+        chunk_printf(w, ",\n{\"name\":\"task 0x%08lx\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lu,\"dur\":%lu}",
+                     (unsigned long)handle, core, (unsigned long)start_us, (unsigned long)(end_us - start_us));
+    }
+}
+
+/** API endpoint for the scheduling trace: GET /api/trace?ms=N streams the last N ms as Chrome trace JSON */
+static esp_err_t api_trace_handler(httpd_req_t *req)
+{
+    uint32_t window_ms = 1000;
+    char query[32], value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "ms", value, sizeof(value)) == ESP_OK) {
+        window_ms = atoi(value);
+    }
+    if (window_ms < 1 || window_ms > 60000) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "ms must be 1-60000");
+        return ESP_FAIL;
+    }
+    if (!trace_ring) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Trace ring not allocated");
+        return ESP_FAIL;
+    }
+
+    // Task names for the handles in the ring (tasks deleted since are shown by address)
+    int task_count = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *tasks = malloc(task_count * sizeof(TaskStatus_t));
+    chunk_writer_t *w = malloc(sizeof(chunk_writer_t));
+    if (!tasks || !w) {
+        free(tasks);
+        free(w);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    task_count = uxTaskGetSystemState(tasks, task_count, NULL);
+
+    // Freeze the ring while streaming; a tick lets writers already inside trace_record finish
+    trace_paused = true;
+    vTaskDelay(1);
+    uint32_t head = atomic_load(&trace_head);
+    uint32_t oldest = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
+    uint32_t start = head;
+    while (start > oldest) {
+        const trace_event_t *ev = &trace_ring[(start - 1) % TRACE_RING_EVENTS];
+        if (ev->seq != start || now_us - ev->ts_us > window_ms * 1000) break;
+        start--;
+    }
+    uint32_t base_us = start < head ? trace_ring[start % TRACE_RING_EVENTS].ts_us : now_us;
+
+    w->req = req;
+    w->len = 0;
+    w->err = ESP_OK;
+    httpd_resp_set_type(req, "application/json");
+    chunk_printf(w, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"events\":%lu,\"dropped\":%lu},\"traceEvents\":[\n"
+                 "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}",
+                 (unsigned long)(head - start), (unsigned long)atomic_load(&trace_dropped), MDNS_HOSTNAME);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        chunk_printf(w, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"core %d\"}}",
+                     core, core);
+    }
+
+    // Pair switch-in/out and ISR enter/exit per core into slices; a task already running at
+    // the start of the window is drawn from the window start
+    uint32_t running[portNUM_PROCESSORS] = {0};
+    uint32_t running_since[portNUM_PROCESSORS] = {0};
+    uint32_t isr_since[portNUM_PROCESSORS] = {0};
+    bool isr_open[portNUM_PROCESSORS] = {false};
+    uint32_t last_us = 0;
+    for (uint32_t i = start; i < head && w->err == ESP_OK; i++) {
+        trace_event_t ev = trace_ring[i % TRACE_RING_EVENTS];
+        if (ev.seq != i + 1 || ev.core >= portNUM_PROCESSORS) continue;
+        uint32_t ts = ev.ts_us - base_us;
+        int core = ev.core;
+        last_us = ts;
+
+        switch (ev.type) {
+        case TRACE_SWITCH_IN:
+            running[core] = ev.arg;
+            running_since[core] = ts;
+            break;
+        case TRACE_SWITCH_OUT:
+            trace_emit_slice(w, trace_task_name(tasks, task_count, ev.arg), ev.arg, core,
+                             running[core] == ev.arg ? running_since[core] : 0, ts);
+            running[core] = 0;
+            break;
+        case TRACE_ISR_ENTER:
+            isr_since[core] = ts;
+            isr_open[core] = true;
+            break;
+        case TRACE_ISR_EXIT:
+            if (isr_open[core]) {
+                trace_emit_slice(w, "isr:w5500", 0, core, isr_since[core], ts);
+                isr_open[core] = false;
+            }
+            break;
+        case TRACE_QUEUE_BLOCK_RECV:
+        case TRACE_QUEUE_BLOCK_SEND: {
+            const char *task = trace_task_name(tasks, task_count, running[core]);
+            chunk_printf(w, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%lu,"
+                         "\"args\":{\"queue\":\"0x%08lx\",\"task\":\"%s\"}}",
+                         ev.type == TRACE_QUEUE_BLOCK_SEND ? "block:send" : "block:recv", core,
+                         (unsigned long)ts, (unsigned long)ev.arg, task ? task : "?");
+            break;
+        }
+        }
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        if (running[core]) {
+            trace_emit_slice(w, trace_task_name(tasks, task_count, running[core]), running[core], core,
+                             running_since[core], last_us);
+        }
+    }
+
+    trace_paused = false;
+    chunk_printf(w, "\n]}\n");
+    chunk_flush(w);
+    esp_err_t err = w->err;
+    httpd_resp_send_chunk(req, NULL, 0);
+    free(tasks);
+    free(w);
+    return err;
+}
+#endif
+
+/** API endpoint for the connection watchdog: live slot progress and stuck-connection incidents */
+static esp_err_t api_watchdog_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[384];
+    snprintf(buf, sizeof(buf), "{\"threshold_ms\":%d,\"flagged\":%u,\"recovered\":%u,\"unrecovered\":%u,\"slots\":[",
+             CONN_STUCK_THRESHOLD_MS, atomic_load(&stuck_flagged), atomic_load(&stuck_recovered),
+             atomic_load(&stuck_unrecovered));
+    httpd_resp_sendstr_chunk(req, buf);
+
+    TickType_t now = xTaskGetTickCount();
+    int64_t now_us = esp_timer_get_time();
+    for (int i = 0; i < buffer_pool_size; i++) {
+        const buffer_pair_t *slot = &buffer_pool[i];
+        bool in_use = slot->in_use;
+        snprintf(buf, sizeof(buf),
+                 "%s{\"slot\":%d,\"phase\":\"%s\",\"age_ms\":%lu,\"stalled_ms\":%lu,"
+                 "\"bytes_in\":%lu,\"bytes_out\":%lu,\"pending\":%lu}",
+                 i > 0 ? "," : "", i, conn_phase_names[in_use ? slot->phase : CONN_FREE],
+                 in_use ? (unsigned long)((now_us - slot->started_us) / 1000) : 0UL,
+                 in_use ? (unsigned long)((now - slot->last_progress) * portTICK_PERIOD_MS) : 0UL,
+                 (unsigned long)slot->bytes_in, (unsigned long)slot->bytes_out,
+                 (unsigned long)slot->pending_send);
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    // Incidents, newest first
+    httpd_resp_sendstr_chunk(req, "],\"incidents\":[");
+    bool first = true;
+    for (int n = 1; n <= STUCK_LOG_SIZE; n++) {
+        const stuck_incident_t *inc = &stuck_log[(stuck_log_index - n + STUCK_LOG_SIZE) % STUCK_LOG_SIZE];
+        if (!inc->valid) continue;
+        request_log_entry_t src = {.source_ip = inc->source_ip, .source_v6 = inc->source_v6};
+        char ip_str[20];
+        format_log_source(&src, ip_str, sizeof(ip_str));
+        snprintf(buf, sizeof(buf),
+                 "%s{\"ago\":%lld,\"slot\":%u,\"phase\":\"%s\",\"source\":\"%s\",\"age_ms\":%lu,"
+                 "\"stalled_ms\":%lu,\"bytes_in\":%lu,\"bytes_out\":%lu,\"pending\":%lu,"
+                 "\"sock_err\":[%d,%d],\"rx_queued\":[%d,%d],\"stack_free\":%lu,\"recovered_ms\":%lu}",
+                 first ? "" : ",", (long long)(now_us / 1000000 - inc->timestamp), inc->slot,
+                 conn_phase_names[inc->phase], ip_str, (unsigned long)inc->age_ms,
+                 (unsigned long)inc->stalled_ms, (unsigned long)inc->bytes_in, (unsigned long)inc->bytes_out,
+                 (unsigned long)inc->pending_send, inc->client_err, inc->upstream_err,
+                 inc->client_rx_queued, inc->upstream_rx_queued, (unsigned long)inc->stack_free,
+                 (unsigned long)inc->recovered_ms);
+        httpd_resp_sendstr_chunk(req, buf);
+        first = false;
+    }
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+/** API endpoint for upstream endpoints, their health and recent switchovers */
+static esp_err_t api_upstreams_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    int64_t now = esp_timer_get_time() / 1000000;
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"active\":%d,\"healthy_score\":%d,\"switches\":%lu,\"endpoints\":[",
+             upstream_active, UPSTREAM_HEALTHY_SCORE, (unsigned long)upstream_switches);
+    httpd_resp_sendstr_chunk(req, buf);
+
+    for (int i = 0; i < upstream_endpoint_count; i++) {
+        const upstream_endpoint_t *ep = &upstream_endpoints[i];
+        char ep_str[32], mac_str[18] = "";
+        upstream_endpoint_label(i, ep_str, sizeof(ep_str));
+        if (ep->mac_valid) {
+            snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
+                     ep->mac[0], ep->mac[1], ep->mac[2], ep->mac[3], ep->mac[4], ep->mac[5]);
+        }
+        snprintf(buf, sizeof(buf),
+                 "%s{\"endpoint\":\"%s\",\"gateway\":%s,\"score\":%u,\"healthy\":%s,\"latency_ms\":%u,"
+                 "\"successes\":%lu,\"failures\":%lu,\"mac\":\"%s\",\"arp_pinned\":%s}",
+                 i > 0 ? "," : "", ep_str, ep->use_gateway ? "true" : "false", ep->score,
+                 ep->score >= UPSTREAM_HEALTHY_SCORE ? "true" : "false", ep->latency_ms,
+                 (unsigned long)ep->successes, (unsigned long)ep->failures, mac_str,
+                 ep->arp_pinned ? "true" : "false");
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    // Switchovers, newest first
+    httpd_resp_sendstr_chunk(req, "],\"history\":[");
+    bool first = true;
+    for (int n = 1; n <= UPSTREAM_SWITCH_LOG_SIZE; n++) {
+        int idx = (upstream_switch_index - n + UPSTREAM_SWITCH_LOG_SIZE) % UPSTREAM_SWITCH_LOG_SIZE;
+        const upstream_switch_t *sw = &upstream_switch_log[idx];
+        if (!sw->valid) continue;
+        snprintf(buf, sizeof(buf), "%s{\"ago\":%lld,\"from\":%u,\"to\":%u,\"reason\":\"%s\"}",
+                 first ? "" : ",", (long long)(now - sw->timestamp), sw->from, sw->to,
+                 sw->unhealthy ? "unhealthy" : "cheaper");
+        httpd_resp_sendstr_chunk(req, buf);
+        first = false;
+    }
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+/** API endpoint for Ethernet: W5500 RX mode, frame latency, SPI utilisation, link stats and boot timing */
+static esp_err_t api_ethernet_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    static const char *mode_names[] = {"interrupt", "polling", "hybrid"};
+
+    char buf[320];
+    snprintf(buf, sizeof(buf), "{\"rx_mode\":\"%s\",\"current\":\"%s\",\"bursts\":%lu,\"modes\":{",
+             mode_names[W5500_RX_MODE], mode_names[w5500_mode_now], (unsigned long)w5500_bursts);
+    httpd_resp_sendstr_chunk(req, buf);
+
+    int64_t now = esp_timer_get_time();
+    for (int m = 0; m < 2; m++) {
+        const w5500_mode_stats_t *st = &w5500_stats[m];
+        uint64_t time_us = st->time_us + (m == w5500_mode_now ? now - w5500_mode_since_us : 0);
+        unsigned spi_permille = time_us ? (unsigned)(st->spi_busy_us * 1000 / time_us) : 0;
+        snprintf(buf, sizeof(buf),
+                 "%s\"%s\":{\"time_ms\":%llu,\"frames\":%lu,\"bytes\":%lu,"
+                 "\"latency_avg_us\":%lu,\"latency_max_us\":%lu,\"latency_samples\":%lu,"
+                 "\"spi_busy_pct\":%u.%u,\"spi_transactions\":%lu,\"spi_us_per_frame\":%lu}",
+                 m > 0 ? "," : "", mode_names[m], (unsigned long long)(time_us / 1000),
+                 (unsigned long)st->frames, (unsigned long)st->bytes,
+                 (unsigned long)(st->latency_samples ? st->latency_sum_us / st->latency_samples : 0),
+                 (unsigned long)st->latency_max_us, (unsigned long)st->latency_samples,
+                 spi_permille / 10, spi_permille % 10, (unsigned long)st->spi_transactions,
+                 (unsigned long)(st->frames ? st->spi_busy_us / st->frames : 0));
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+    // Link state, error counters and per-interval history (newest first)
+    uint8_t phycfgr = w5500_phycfgr;
+    snprintf(buf, sizeof(buf),
+             "},\"link\":{\"up\":%s,\"speed\":%d,\"duplex\":\"%s\",\"since\":%lld,\"ups\":%u,\"downs\":%u,"
+             "\"phycfgr\":%u,\"phy_link\":%s,\"phy_speed\":%d,\"phy_duplex\":\"%s\"},",
+             eth_link_up ? "true" : "false", eth_speed == ETH_SPEED_100M ? 100 : 10,
+             eth_duplex == ETH_DUPLEX_FULL ? "full" : "half",
+             (long long)((now - eth_link_changed_us) / 1000000),
+             atomic_load(&eth_link_ups), atomic_load(&eth_link_downs), phycfgr,
+             (phycfgr & W5500_PHYCFGR_LNK) ? "true" : "false", (phycfgr & W5500_PHYCFGR_SPD) ? 100 : 10,
+             (phycfgr & W5500_PHYCFGR_DPX) ? "full" : "half");
+    httpd_resp_sendstr_chunk(req, buf);
+
+    snprintf(buf, sizeof(buf),
+             "\"errors\":{\"rx\":%u,\"spi\":%u,\"logged\":%u,\"stack_drops\":%u,\"last\":\"%s\",\"last_ago\":%lld},"
+             "\"interval_sec\":%d,\"history\":[",
+             atomic_load(&w5500_rx_errors), atomic_load(&w5500_spi_errors), atomic_load(&w5500_logged_errors),
+             atomic_load(&eth_stack_drops),
+             w5500_last_error, w5500_last_error_us ? (long long)((now - w5500_last_error_us) / 1000000) : -1LL,
+             ETH_STATS_INTERVAL_SEC);
+    httpd_resp_sendstr_chunk(req, buf);
+
+    bool first = true;
+    for (int n = 1; n <= ETH_HISTORY_SIZE; n++) {
+        const eth_history_t *h = &eth_history[(eth_history_index - n + ETH_HISTORY_SIZE) % ETH_HISTORY_SIZE];
+        if (!h->valid) continue;
+        snprintf(buf, sizeof(buf),
+                 "%s{\"ago\":%lld,\"frames\":%lu,\"downs\":%u,\"rx_errors\":%u,\"spi_errors\":%u,"
+                 "\"drops\":%u,\"phycfgr\":%u}",
+                 first ? "" : ",", (long long)(now / 1000000 - h->timestamp), (unsigned long)h->frames,
+                 h->link_downs, h->rx_errors, h->spi_errors, h->stack_drops, h->phycfgr);
+        httpd_resp_sendstr_chunk(req, buf);
+        first = false;
+    }
+
+    // Boot milestones (ms after app start; dhcp_ms 0 = no lease yet or static)
+    snprintf(buf, sizeof(buf),
+             "],\"boot\":{\"address\":\"%s\",\"eth_ip_ms\":%lu,\"dhcp_ms\":%lu,"
+             "\"cached_confirmed\":%s,\"ota_listen_ms\":%lu,\"ota_reachable_ms\":%lu,\"proxy_listen_ms\":%lu}}",
+             eth_address_source, (unsigned long)boot_eth_ip_ms, (unsigned long)boot_dhcp_ms,
+             eth_cached_confirmed ? "true" : "false", (unsigned long)boot_ota_listen_ms,
+             (unsigned long)boot_reachable_ms(), (unsigned long)boot_proxy_listen_ms);
+    httpd_resp_sendstr_chunk(req, buf);
+    httpd_resp_sendstr_chunk(req, NULL);
     return ESP_OK;
 }
 
@@ -919,11 +4316,13 @@ static esp_err_t api_rssi_handler(httpd_req_t *req)
 /** API endpoint for recent requests */
 static esp_err_t api_requests_handler(httpd_req_t *req)
 {
+    render_begin();
     httpd_resp_set_type(req, "application/json");
 
     char buf[128];
-    snprintf(buf, sizeof(buf), "{\"avg_ttfb\":%lu,\"requests\":[", (unsigned long)avg_ttfb_ms);
-    httpd_resp_sendstr_chunk(req, buf);
+    snprintf(buf, sizeof(buf), "{\"avg_ttfb\":%lu,\"p95_ttfb\":%u,\"requests\":[",
+             (unsigned long)avg_ttfb_ms, ttfb_percentile(95));
+    render_chunk(req, buf);
 
     if (request_log_mutex && xSemaphoreTake(request_log_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
         int64_t now = esp_timer_get_time() / 1000000;
@@ -934,24 +4333,635 @@ static esp_err_t api_requests_handler(httpd_req_t *req)
             if (!e->valid) continue;
 
             int64_t age = now - e->timestamp;
-            uint8_t *ip = (uint8_t *)&e->source_ip;
+            char src[20];
+            format_log_source(e, src, sizeof(src));
 
             snprintf(buf, sizeof(buf),
-                "%s{\"age\":%lld,\"ip\":\"%d.%d.%d.%d\",\"in\":%lu,\"out\":%lu,\"ttfb\":%u,\"ttlb\":%u,\"ok\":%d}",
+                "%s{\"age\":%lld,\"ip\":\"%s\",\"in\":%lu,\"out\":%lu,\"ttfb\":%u,\"ttlb\":%u,\"ok\":%d}",
                 first ? "" : ",",
-                (long long)age, ip[0], ip[1], ip[2], ip[3],
+                (long long)age, src,
                 (unsigned long)e->bytes_in, (unsigned long)e->bytes_out,
                 e->ttfb_ms, e->ttlb_ms, e->result == 0 ? 1 : 0);
-            httpd_resp_sendstr_chunk(req, buf);
+            render_chunk(req, buf);
             first = false;
         }
         xSemaphoreGive(request_log_mutex);
     }
 
+    render_chunk(req, "]}");
+    render_chunk(req, NULL);
+    render_end(RENDER_API_REQUESTS);
+    return ESP_OK;
+}
+
+/** Does a request log entry pass the export filters */
+static bool request_matches(const request_log_entry_t *e, const request_filter_t *f)
+{
+    if (!e->valid || e->seq <= f->cursor) return false;
+    if (e->timestamp < f->since) return false;
+    if (f->result >= 0 && e->result != f->result) return false;
+    if (e->ttfb_ms < f->min_ttfb) return false;
+    if (f->ip[0]) {
+        char src[20];
+        format_log_source(e, src, sizeof(src));
+        if (strcmp(src, f->ip) != 0) return false;
+    }
+    return true;
+}
+
+/** Copy the oldest entry with a sequence number above `after` (false if none) */
+static bool request_log_next(uint32_t after, request_log_entry_t *out)
+{
+    bool found = false;
+    if (xSemaphoreTake(request_log_mutex, pdMS_TO_TICKS(100)) != pdTRUE) return false;
+    for (int i = 0; i < REQUEST_LOG_SIZE; i++) {
+        const request_log_entry_t *e = &request_log[i];
+        if (e->valid && e->seq > after && (!found || e->seq < out->seq)) {
+            *out = *e;
+            found = true;
+        }
+    }
+    xSemaphoreGive(request_log_mutex);
+    return found;
+}
+
+/** Callback for request_log_read; return false to stop reading */
+typedef bool (*request_reader_t)(const request_log_entry_t *e, void *ctx);
+
+#if FLASH_LOG_ENABLED
+// Adapts persistent log records to request_reader_t
+typedef struct {
+    request_reader_t cb;
+    void *ctx;
+} flash_request_reader_t;
+
+/** flash_log_read_range callback: hand request records on as log entries (seq = record position) */
+static bool flash_request_adapter(const flash_log_record_t *rec, uint32_t pos, void *ctx)
+{
+    flash_request_reader_t *r = ctx;
+    if (rec->type != FLASH_REC_REQUEST) return true;
+    request_log_entry_t e = {
+        .seq = pos,
+        .timestamp = rec->time,
+        .source_ip = rec->req.source_ip,
+        .bytes_in = rec->req.bytes_in,
+        .bytes_out = rec->req.bytes_out,
+        .ttfb_ms = rec->req.ttfb_ms,
+        .ttlb_ms = rec->req.ttlb_ms,
+        .result = rec->flags & FLASH_REC_RESULT_MASK,
+        .source_v6 = (rec->flags & FLASH_REC_V6) != 0,
+        .valid = true,
+    };
+    return r->cb(&e, r->ctx);
+}
+#endif
+
+/**
+ * Deliver request log entries after position `after` and at or after `since`, oldest first.
+ * With the persistent log mounted this reads the flash ring (positions are record positions,
+ * times are log clock seconds); otherwise the RAM ring (sequence numbers, uptime seconds).
+ */
+static void request_log_read(uint32_t after, int64_t since, request_reader_t cb, void *ctx)
+{
+    #if FLASH_LOG_ENABLED
+    if (flash_log_part) {
+        flash_request_reader_t r = {.cb = cb, .ctx = ctx};
+        uint32_t from = since <= 0 ? 0 : since >= UINT32_MAX ? UINT32_MAX : (uint32_t)since;
+        flash_log_read_range(from, UINT32_MAX, after, flash_request_adapter, &r);
+        return;
+    }
+    #endif
+    request_log_entry_t e;
+    while (request_log_next(after, &e)) {
+        after = e.seq;
+        if (!cb(&e, ctx)) return;
+    }
+}
+
+// Entries one export page examines at most; a sparse filter over the whole persistent log
+// returns a short page with X-More instead of reading megabytes of flash twice
+#define REQUEST_EXPORT_SCAN_MAX 4096
+
+// First export pass: where the page ends
+typedef struct {
+    const request_filter_t *filter;
+    int limit;
+    int matched;
+    int scanned;
+    uint32_t end;           // Last position scanned, including filtered-out entries
+    bool more;
+} export_scan_t;
+
+/** request_log_read callback: count matches up to the page limit */
+static bool export_scan(const request_log_entry_t *e, void *ctx)
+{
+    export_scan_t *s = ctx;
+    if (s->scanned++ == REQUEST_EXPORT_SCAN_MAX) {
+        s->more = true;
+        return false;
+    }
+    if (request_matches(e, s->filter)) {
+        if (s->matched == s->limit) {
+            s->more = true;
+            return false;
+        }
+        s->matched++;
+    }
+    s->end = e->seq;
+    return true;
+}
+
+// Second export pass: stream the page
+typedef struct {
+    chunk_writer_t w;
+    const request_filter_t *filter;
+    uint32_t end;
+    bool csv;
+} export_emit_t;
+
+/** request_log_read callback: format one matching entry as NDJSON or CSV */
+static bool export_emit(const request_log_entry_t *e, void *ctx)
+{
+    export_emit_t *x = ctx;
+    if (e->seq > x->end) return false;
+    if (!request_matches(e, x->filter)) return true;
+
+    char src[20];
+    format_log_source(e, src, sizeof(src));
+    const char *result = e->result < 3 ? request_result_names[e->result] : "unknown";
+    if (x->csv) {
+        chunk_printf(&x->w, "%lu,%lld,%s,%lu,%lu,%u,%u,%s\n",
+                     (unsigned long)e->seq, (long long)e->timestamp, src,
+                     (unsigned long)e->bytes_in, (unsigned long)e->bytes_out, e->ttfb_ms, e->ttlb_ms, result);
+    } else {
+        chunk_printf(&x->w, "{\"seq\":%lu,\"t\":%lld,\"ip\":\"%s\",\"in\":%lu,\"out\":%lu,"
+                     "\"ttfb\":%u,\"ttlb\":%u,\"result\":\"%s\"}\n",
+                     (unsigned long)e->seq, (long long)e->timestamp, src,
+                     (unsigned long)e->bytes_in, (unsigned long)e->bytes_out, e->ttfb_ms, e->ttlb_ms, result);
+    }
+    return x->w.err == ESP_OK;
+}
+
+/**
+ * API endpoint for streaming request log export:
+ * GET /api/requests/export?format=ndjson|csv&cursor=N&limit=N&since=S&ip=A&result=ok|timeout|error&min_ttfb=MS
+ * Reads the persistent log when it is mounted (the RAM ring only holds the last few requests).
+ * Entries stream oldest first; X-Next-Cursor / X-More tell the client how to page.
+ */
+static esp_err_t api_requests_export_handler(httpd_req_t *req)
+{
+    request_filter_t filter = {.result = -1};
+    bool csv = false;
+    int limit = 100;
+
+    char query[160];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        const char *bad = parse_request_query(httpd_query_key_value, query, &filter, &limit, &csv);
+        if (bad) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, bad);
+            return ESP_FAIL;
+        }
+    }
+    if (!request_log_mutex) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Request log not ready");
+        return ESP_FAIL;
+    }
+
+    // First pass (no output): find where this page ends so the cursor can go in the headers.
+    // The cursor also moves past filtered-out entries, so the next page resumes after them.
+    export_scan_t scan = {.filter = &filter, .limit = limit, .end = filter.cursor};
+    request_log_read(filter.cursor, filter.since, export_scan, &scan);
+
+    char cursor_hdr[12];
+    snprintf(cursor_hdr, sizeof(cursor_hdr), "%lu", (unsigned long)scan.end);
+    httpd_resp_set_type(req, csv ? "text/csv" : "application/x-ndjson");
+    httpd_resp_set_hdr(req, "X-Next-Cursor", cursor_hdr);
+    httpd_resp_set_hdr(req, "X-More", scan.more ? "1" : "0");
+    #if FLASH_LOG_ENABLED
+    char clock_hdr[12];
+    if (flash_log_part) {
+        snprintf(clock_hdr, sizeof(clock_hdr), "%lu", (unsigned long)flash_log_clock());
+        httpd_resp_set_hdr(req, "X-Log-Clock", clock_hdr);
+    }
+    #endif
+
+    export_emit_t *x = malloc(sizeof(export_emit_t));
+    if (!x) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    x->w.req = req;
+    x->w.len = 0;
+    x->w.err = ESP_OK;
+    x->filter = &filter;
+    x->end = scan.end;
+    x->csv = csv;
+
+    if (csv) chunk_printf(&x->w, "seq,t,ip,bytes_in,bytes_out,ttfb_ms,ttlb_ms,result\n");
+
+    // Second pass: stream matching entries up to the page end. Entries are copied out one at a
+    // time, so no lock is held while sending
+    request_log_read(filter.cursor, filter.since, export_emit, x);
+
+    chunk_flush(&x->w);
+    esp_err_t err = x->w.err;
+    httpd_resp_send_chunk(req, NULL, 0);
+    free(x);
+    return err;
+}
+
+#if FLASH_LOG_ENABLED
+// /api/history paging state: the export filters plus a record type
+typedef struct {
+    chunk_writer_t w;
+    request_filter_t filter;    // Only from/to come from the range read; the rest is checked here
+    uint8_t type;               // 0 = all record types
+    bool csv;
+    int limit;
+    int matched;
+    int scanned;
+    uint32_t end;               // Last position of the page
+    bool more;
+} history_export_t;
+
+/** Does a persistent log record pass the history filters (request filters drop metric records) */
+static bool history_matches(const flash_log_record_t *rec, uint32_t pos, const history_export_t *x)
+{
+    if (x->type && rec->type != x->type) return false;
+    const request_filter_t *f = &x->filter;
+    if (rec->type == FLASH_REC_METRIC) {
+        return !f->ip[0] && f->result < 0 && f->min_ttfb == 0;
+    }
+    if (rec->type != FLASH_REC_REQUEST) return false;
+    request_log_entry_t e = {
+        .seq = pos,
+        .timestamp = rec->time,
+        .source_ip = rec->req.source_ip,
+        .ttfb_ms = rec->req.ttfb_ms,
+        .result = rec->flags & FLASH_REC_RESULT_MASK,
+        .source_v6 = (rec->flags & FLASH_REC_V6) != 0,
+        .valid = true,
+    };
+    return request_matches(&e, f);
+}
+
+/** flash_log_read_range callback, first pass: find where the page ends */
+static bool history_scan(const flash_log_record_t *rec, uint32_t pos, void *ctx)
+{
+    history_export_t *x = ctx;
+    if (x->scanned++ == REQUEST_EXPORT_SCAN_MAX) {
+        x->more = true;
+        return false;
+    }
+    if (history_matches(rec, pos, x)) {
+        if (x->matched == x->limit) {
+            x->more = true;
+            return false;
+        }
+        x->matched++;
+    }
+    x->end = pos;
+    return true;
+}
+
+/** flash_log_read_range callback, second pass: format one record as NDJSON or CSV */
+static bool history_emit(const flash_log_record_t *rec, uint32_t pos, void *ctx)
+{
+    history_export_t *x = ctx;
+    if (pos > x->end) return false;
+    if (!history_matches(rec, pos, x)) return true;
+
+    if (rec->type == FLASH_REC_REQUEST) {
+        request_log_entry_t e = {
+            .source_ip = rec->req.source_ip,
+            .source_v6 = (rec->flags & FLASH_REC_V6) != 0,
+        };
+        char src[20];
+        format_log_source(&e, src, sizeof(src));
+        uint8_t result = rec->flags & FLASH_REC_RESULT_MASK;
+        const char *result_name = result < 3 ? request_result_names[result] : "unknown";
+        if (x->csv) {
+            chunk_printf(&x->w, "%lu,%lu,%u,request,%s,%lu,%lu,%u,%u,%s,,,,,\n",
+                         (unsigned long)pos, (unsigned long)rec->time, rec->boot, src,
+                         (unsigned long)rec->req.bytes_in, (unsigned long)rec->req.bytes_out,
+                         rec->req.ttfb_ms, rec->req.ttlb_ms, result_name);
+        } else {
+            chunk_printf(&x->w, "{\"seq\":%lu,\"t\":%lu,\"boot\":%u,\"type\":\"request\",\"ip\":\"%s\",\"in\":%lu,"
+                         "\"out\":%lu,\"ttfb\":%u,\"ttlb\":%u,\"result\":\"%s\"}\n",
+                         (unsigned long)pos, (unsigned long)rec->time, rec->boot, src,
+                         (unsigned long)rec->req.bytes_in, (unsigned long)rec->req.bytes_out,
+                         rec->req.ttfb_ms, rec->req.ttlb_ms, result_name);
+        }
+    } else {
+        if (x->csv) {
+            chunk_printf(&x->w, "%lu,%lu,%u,metric,,,,,,,%lu,%lu,%u,%lu,%u\n",
+                         (unsigned long)pos, (unsigned long)rec->time, rec->boot,
+                         (unsigned long)rec->metric.free_heap, (unsigned long)rec->metric.min_free_heap,
+                         rec->metric.active, (unsigned long)rec->metric.rejected, rec->metric.cpu);
+        } else {
+            chunk_printf(&x->w, "{\"seq\":%lu,\"t\":%lu,\"boot\":%u,\"type\":\"metric\",\"heap\":%lu,\"min_heap\":%lu,"
+                         "\"active\":%u,\"rejected\":%lu,\"cpu\":%u}\n",
+                         (unsigned long)pos, (unsigned long)rec->time, rec->boot,
+                         (unsigned long)rec->metric.free_heap, (unsigned long)rec->metric.min_free_heap,
+                         rec->metric.active, (unsigned long)rec->metric.rejected, rec->metric.cpu);
+        }
+    }
+    return x->w.err == ESP_OK;
+}
+
+/**
+ * API endpoint for the persistent request log:
+ * GET /api/history?from=T&to=T|ago=S&type=request|metric plus the export query
+ * (format, cursor, limit, since, ip, result, min_ttfb; see parse_request_query)
+ * Times are log clock seconds (see /api/history/status for the current clock); `from` is an
+ * alias of `since` and `ago` is relative to now. Defaults to the last hour, 1000 records per page.
+ */
+static esp_err_t api_history_handler(httpd_req_t *req)
+{
+    if (!flash_log_part) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No request log partition");
+        return ESP_FAIL;
+    }
+
+    history_export_t *x = calloc(1, sizeof(history_export_t));
+    if (!x) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    uint32_t now = flash_log_clock();
+    uint32_t to = now;
+    x->filter.result = -1;
+    x->filter.since = now > 3600 ? now - 3600 : 0;
+    x->limit = 1000;
+
+    char query[192], value[24];
+    const char *bad = NULL;
+    uint32_t n = 0;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "ago", value, sizeof(value)) == ESP_OK) {
+            if (!parse_uint(value, UINT32_MAX, &n)) bad = "ago must be a number of seconds";
+            x->filter.since = now > n ? now - n : 0;
+        }
+        if (!bad) bad = parse_request_query(httpd_query_key_value, query, &x->filter, &x->limit, &x->csv);
+        if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK) {
+            if (!parse_uint(value, UINT32_MAX, &n)) bad = "from must be a number of seconds";
+            x->filter.since = n;
+        }
+        if (httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK) {
+            if (!parse_uint(value, UINT32_MAX, &n)) bad = "to must be a number of seconds";
+            to = n;
+        }
+        if (httpd_query_key_value(query, "type", value, sizeof(value)) == ESP_OK) {
+            if (strcmp(value, "request") == 0) {
+                x->type = FLASH_REC_REQUEST;
+            } else if (strcmp(value, "metric") == 0) {
+                x->type = FLASH_REC_METRIC;
+            } else {
+                bad = "type must be request or metric";
+            }
+        }
+    }
+    uint32_t from = x->filter.since <= 0 ? 0 : x->filter.since >= UINT32_MAX ? UINT32_MAX : (uint32_t)x->filter.since;
+    if (!bad && from > to) bad = "from must not be after to";
+    if (bad) {
+        free(x);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, bad);
+        return ESP_FAIL;
+    }
+
+    // First pass (no output) finds the page end for the headers; the second streams up to it
+    x->end = x->filter.cursor;
+    flash_log_read_range(from, to, x->filter.cursor, history_scan, x);
+
+    char clock_hdr[12], cursor_hdr[12];
+    snprintf(clock_hdr, sizeof(clock_hdr), "%lu", (unsigned long)now);
+    snprintf(cursor_hdr, sizeof(cursor_hdr), "%lu", (unsigned long)x->end);
+    httpd_resp_set_type(req, x->csv ? "text/csv" : "application/x-ndjson");
+    httpd_resp_set_hdr(req, "X-Log-Clock", clock_hdr);
+    httpd_resp_set_hdr(req, "X-Next-Cursor", cursor_hdr);
+    httpd_resp_set_hdr(req, "X-More", x->more ? "1" : "0");
+
+    x->w.req = req;
+    x->w.len = 0;
+    x->w.err = ESP_OK;
+    if (x->csv) {
+        chunk_printf(&x->w, "seq,t,boot,type,ip,bytes_in,bytes_out,ttfb_ms,ttlb_ms,result,"
+                     "heap,min_heap,active,rejected,cpu\n");
+    }
+
+    flash_log_read_range(from, to, x->filter.cursor, history_emit, x);
+
+    chunk_flush(&x->w);
+    esp_err_t err = x->w.err;
+    httpd_resp_send_chunk(req, NULL, 0);
+    free(x);
+    return err;
+}
+
+/** Find the oldest record's time (callback stops at the first one) */
+static bool history_first(const flash_log_record_t *rec, uint32_t pos, void *ctx)
+{
+    *(uint32_t *)ctx = rec->time;
+    return false;
+}
+
+/** API endpoint for persistent request log status (clock, ring position, write counters) */
+static esp_err_t api_history_status_handler(httpd_req_t *req)
+{
+    if (!flash_log_part) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No request log partition");
+        return ESP_FAIL;
+    }
+
+    uint32_t oldest = 0;
+    bool any = flash_log_read_range(0, UINT32_MAX, 0, history_first, &oldest) > 0;
+
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+        "{\"clock\":%lu,\"boot\":%u,\"oldest\":%lld,\"partition\":\"%s\",\"size\":%lu,\"sectors\":%lu,"
+        "\"capacity\":%lu,\"sector\":%lu,\"slot\":%lu,\"sector_seq\":%lu,\"batch\":%d,"
+        "\"records\":%lu,\"page_writes\":%lu,\"erases\":%lu,\"inline_erases\":%lu,\"errors\":%lu,"
+        "\"queue_drops\":%u}",
+        (unsigned long)flash_log_clock(), flash_log_boot, any ? (long long)oldest : -1LL,
+        FLASH_LOG_PARTITION, (unsigned long)flash_log_part->size, (unsigned long)flash_log_sectors,
+        (unsigned long)((flash_log_sectors - 1) * FLASH_LOG_HEADER_SLOT), (unsigned long)flash_log_sector,
+        (unsigned long)flash_log_slot, (unsigned long)flash_log_seq, FLASH_LOG_BATCH,
+        (unsigned long)flash_log_records, (unsigned long)flash_log_page_writes,
+        (unsigned long)flash_log_erases, (unsigned long)flash_log_inline_erases, (unsigned long)flash_log_errors,
+        atomic_load(&flash_log_queue_drops));
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, buf);
+    return ESP_OK;
+}
+#endif
+
+/** API endpoint for memory: current heap and the boot-time connection pool plan */
+static esp_err_t api_memory_handler(httpd_req_t *req)
+{
+    const pool_plan_t *p = &pool_plan;
+    char buf[896];
+    snprintf(buf, sizeof(buf),
+        "{\"now\":{\"internal_free\":%u,\"internal_largest\":%u,\"internal_min\":%u,"
+        "\"psram_free\":%u,\"sockets\":%d},"
+        "\"pool\":{\"slots\":%d,\"active\":%d,\"limit\":\"%s\",\"max\":%d,\"min\":%d,"
+        "\"measured\":{\"internal_free\":%lu,\"internal_largest\":%lu,\"psram_free\":%lu,\"psram_largest\":%lu,"
+        "\"sockets_used\":%d,\"pcbs_used\":%d,\"service_sockets\":%d,\"service_pcbs\":%d},"
+        "\"per_connection\":{\"stack\":%lu,\"buffers\":%lu,\"lwip\":%lu,\"internal_with_margin\":%lu,"
+        "\"buffers_in_psram\":%s},"
+        "\"budget\":{\"heap_reserve\":%d,\"safety_pct\":%d,\"lwip_buffer_pct\":%d,\"socket_reserve\":%d},"
+        "\"allows\":{\"heap\":%d,\"largest_block\":%d,\"sockets\":%d}}}",
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM), count_lwip_sockets(),
+        buffer_pool_size, atomic_load(&active_connections), p->limit ? p->limit : "not planned",
+        MAX_CONCURRENT_CLIENTS, POOL_MIN_CLIENTS,
+        (unsigned long)p->internal_free, (unsigned long)p->internal_largest,
+        (unsigned long)p->psram_free, (unsigned long)p->psram_largest, p->sockets_used,
+        p->pcbs_used, p->service_sockets, p->service_pcbs,
+        (unsigned long)p->stack_bytes, (unsigned long)p->buffer_bytes, (unsigned long)p->lwip_bytes,
+        (unsigned long)p->conn_internal, p->buffers_in_psram ? "true" : "false",
+        POOL_HEAP_RESERVE, POOL_SAFETY_PCT, POOL_LWIP_BUFFER_PCT, POOL_SOCKET_RESERVE,
+        p->by_heap, p->by_block, p->by_sockets);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, buf);
+    return ESP_OK;
+}
+
+/** API endpoint for response render cost (bytes, chunks, time, stack per page/endpoint) */
+static esp_err_t api_render_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr_chunk(req, "{");
+
+    char buf[256];
+    for (int i = 0; i < RENDER_COUNT; i++) {
+        render_stats_t *s = &render_stats[i];
+        uint32_t avg_us = s->renders ? (uint32_t)(s->total_us / s->renders) : 0;
+        snprintf(buf, sizeof(buf),
+            "%s\"%s\":{\"renders\":%lu,\"bytes\":%lu,\"max_bytes\":%lu,\"chunks\":%u,"
+            "\"last_us\":%lu,\"avg_us\":%lu,\"max_us\":%lu,\"stack_hwm\":%lu}",
+            i > 0 ? "," : "", render_names[i],
+            (unsigned long)s->renders, (unsigned long)s->last_bytes, (unsigned long)s->max_bytes,
+            s->last_chunks, (unsigned long)s->last_us, (unsigned long)avg_us,
+            (unsigned long)s->max_us, (unsigned long)s->stack_hwm);
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    httpd_resp_sendstr_chunk(req, "}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+/** API endpoint for self-check results (leak and drift invariants) */
+static esp_err_t api_selfcheck_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+        "{\"ok\":%s,\"runs\":%lu,\"busy_skips\":%lu,"
+        "\"baseline\":{\"sockets\":%d,\"largest_block\":%lu},"
+        "\"current\":{\"free_slots\":%d,\"sockets\":%d,\"active\":%d,\"largest_block\":%lu,\"heap\":%lu},",
+        selfcheck_last_ok ? "true" : "false",
+        (unsigned long)selfcheck_runs, (unsigned long)selfcheck_busy_skips,
+        selfcheck_baseline_sockets, (unsigned long)selfcheck_baseline_block,
+        buffer_pool_mutex ? count_free_slots() : -1,
+        atomic_load(&open_sockets), atomic_load(&active_connections),
+        (unsigned long)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+        (unsigned long)esp_get_free_heap_size());
+    httpd_resp_sendstr_chunk(req, buf);
+
+    httpd_resp_sendstr_chunk(req, "\"violations\":{");
+    for (int i = 0; i < SELFCHECK_TYPE_COUNT; i++) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%lu", i > 0 ? "," : "",
+                 selfcheck_names[i], (unsigned long)selfcheck_counts[i]);
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+    httpd_resp_sendstr_chunk(req, "},\"recent\":[");
+
+    if (selfcheck_mutex && xSemaphoreTake(selfcheck_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        int64_t now = esp_timer_get_time() / 1000000;
+        bool first = true;
+        for (int i = 0; i < SELFCHECK_LOG_SIZE; i++) {
+            int idx = (selfcheck_log_index - 1 - i + SELFCHECK_LOG_SIZE) % SELFCHECK_LOG_SIZE;
+            selfcheck_violation_t *v = &selfcheck_log[idx];
+            if (!v->valid) continue;
+
+            snprintf(buf, sizeof(buf),
+                "%s{\"age\":%lld,\"type\":\"%s\",\"expected\":%ld,\"actual\":%ld}",
+                first ? "" : ",", (long long)(now - v->timestamp),
+                selfcheck_names[v->type], (long)v->expected, (long)v->actual);
+            httpd_resp_sendstr_chunk(req, buf);
+            first = false;
+        }
+        xSemaphoreGive(selfcheck_mutex);
+    }
+
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+#if HA_ENABLED
+/** API endpoint for active/standby pair status and failover timing */
+static esp_err_t api_ha_handler(httpd_req_t *req)
+{
+    int64_t now_us = esp_timer_get_time();
+    char peer_ip[16] = "";
+    if (ha_peer_ip) {
+        struct in_addr addr = {.s_addr = ha_peer_ip};
+        inet_ntoa_r(addr, peer_ip, sizeof(peer_ip));
+    }
+
+    char response[512];
+    snprintf(response, sizeof(response),
+        "{\"state\":\"%s\",\"vip\":\"%s\",\"vip_held\":%s,\"priority\":%d,\"node\":\"%08lx\","
+        "\"peer\":{\"ip\":\"%s\",\"state\":\"%s\",\"age_ms\":%lld},"
+        "\"takeovers\":%lu,\"last_failover_ms\":%lu,\"last_takeover_age\":%lld,"
+        "\"heartbeats\":{\"sent\":%lu,\"received\":%lu}}",
+        ha_state_names[ha_state], HA_VIRTUAL_IP_STR, ha_vip_held ? "true" : "false",
+        HA_PRIORITY, (unsigned long)ha_node_id,
+        peer_ip, ha_state_names[ha_peer_state],
+        ha_peer_last_seen_us ? (long long)((now_us - ha_peer_last_seen_us) / 1000) : -1LL,
+        (unsigned long)ha_takeovers, (unsigned long)ha_last_failover_ms,
+        ha_last_takeover_us ? (long long)((now_us - ha_last_takeover_us) / 1000000) : -1LL,
+        (unsigned long)ha_heartbeats_sent, (unsigned long)ha_heartbeats_received);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, strlen(response));
+    return ESP_OK;
+}
+#endif
+
+#if CONNECT_TUNNEL_ENABLED
+/** API endpoint for CONNECT tunnel targets and their usage */
+static esp_err_t api_tunnel_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[160];
+    snprintf(buf, sizeof(buf), "{\"port\":%d,\"denied\":%lu,\"targets\":[",
+             CONNECT_PORT, (unsigned long)atomic_load(&connect_denied));
+    httpd_resp_sendstr_chunk(req, buf);
+
+    for (int i = 0; i < connect_target_count; i++) {
+        connect_target_t *t = &connect_targets[i];
+        snprintf(buf, sizeof(buf),
+            "%s{\"target\":\"%s\",\"limit\":%d,\"active\":%d,\"total\":%lu,\"refused\":%lu,\"failed\":%lu}",
+            i > 0 ? "," : "", t->label, t->limit, atomic_load(&t->active),
+            (unsigned long)atomic_load(&t->total), (unsigned long)atomic_load(&t->refused),
+            (unsigned long)atomic_load(&t->failed));
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+
     httpd_resp_sendstr_chunk(req, "]}");
     httpd_resp_sendstr_chunk(req, NULL);
     return ESP_OK;
 }
+#endif
 
 /** Reboot handler */
 static esp_err_t reboot_handler(httpd_req_t *req)
@@ -973,7 +4983,7 @@ static esp_err_t reboot_handler(httpd_req_t *req)
     httpd_resp_send(req, response, strlen(response));
 
     vTaskDelay(pdMS_TO_TICKS(500));
-    esp_restart();
+    start_drain("reboot", drain_restart);
 
     return ESP_OK;
 }
@@ -1005,7 +5015,7 @@ static esp_err_t ota_rollback_handler(httpd_req_t *req)
     httpd_resp_send(req, response, strlen(response));
 
     vTaskDelay(pdMS_TO_TICKS(500));
-    esp_restart();
+    start_drain("rollback", drain_restart);
 
     return ESP_OK;
 }
@@ -1016,7 +5026,7 @@ static esp_err_t start_ota_server(void)
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = OTA_HTTP_PORT;
     config.stack_size = 8192;
-    config.max_uri_handlers = 10;
+    config.max_uri_handlers = 28;
 
     esp_err_t err = httpd_start(&ota_server, &config);
     if (err != ESP_OK) {
@@ -1076,21 +5086,149 @@ static esp_err_t start_ota_server(void)
     };
     httpd_register_uri_handler(ota_server, &api_status);
 
-    // API RSSI endpoint (plain text, just the dBm value)
-    httpd_uri_t api_rssi = {
-        .uri = "/api/rssi",
+    // API connections endpoint (admission counters and source ACL hits)
+    httpd_uri_t api_connections = {
+        .uri = "/api/connections",
+        .method = HTTP_GET,
+        .handler = api_connections_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_connections);
+
+    // API RSSI endpoint (plain text, just the dBm value)
+    httpd_uri_t api_rssi = {
+        .uri = "/api/rssi",
+        .method = HTTP_GET,
+        .handler = api_rssi_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_rssi);
+
+    // API requests endpoint (JSON array of recent requests)
+    httpd_uri_t api_requests = {
+        .uri = "/api/requests",
+        .method = HTTP_GET,
+        .handler = api_requests_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_requests);
+
+    // API request export endpoint (filtered, paginated NDJSON/CSV stream of the request log)
+    httpd_uri_t api_requests_export = {
+        .uri = "/api/requests/export",
+        .method = HTTP_GET,
+        .handler = api_requests_export_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_requests_export);
+
+    // API memory endpoint (heap now and the boot-time connection pool plan)
+    httpd_uri_t api_memory = {
+        .uri = "/api/memory",
+        .method = HTTP_GET,
+        .handler = api_memory_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_memory);
+
+    #if FLASH_LOG_ENABLED
+    // API history endpoints (persistent request log: time-range stream and ring status)
+    httpd_uri_t api_history = {
+        .uri = "/api/history",
+        .method = HTTP_GET,
+        .handler = api_history_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_history);
+
+    httpd_uri_t api_history_status = {
+        .uri = "/api/history/status",
+        .method = HTTP_GET,
+        .handler = api_history_status_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_history_status);
+    #endif
+
+    // API render stats endpoint (cost of building the pages above)
+    httpd_uri_t api_render = {
+        .uri = "/api/render",
+        .method = HTTP_GET,
+        .handler = api_render_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_render);
+
+    // API self-check endpoint (slot/socket leak and heap drift violations)
+    httpd_uri_t api_selfcheck = {
+        .uri = "/api/selfcheck",
+        .method = HTTP_GET,
+        .handler = api_selfcheck_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_selfcheck);
+
+    #if HA_ENABLED
+    // API HA endpoint (active/standby state and failover time)
+    httpd_uri_t api_ha = {
+        .uri = "/api/ha",
+        .method = HTTP_GET,
+        .handler = api_ha_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_ha);
+    #endif
+
+    // API ethernet endpoint (W5500 RX mode, frame latency, SPI utilisation)
+    httpd_uri_t api_ethernet = {
+        .uri = "/api/ethernet",
+        .method = HTTP_GET,
+        .handler = api_ethernet_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_ethernet);
+
+    // API watchdog endpoint (connection progress and stuck-connection incidents)
+    httpd_uri_t api_watchdog = {
+        .uri = "/api/watchdog",
+        .method = HTTP_GET,
+        .handler = api_watchdog_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_watchdog);
+
+    #if PROFILER_ENABLED
+    // API profile endpoints (POST starts sampling, GET downloads the dump)
+    httpd_uri_t api_profile_start = {
+        .uri = "/api/profile",
+        .method = HTTP_POST,
+        .handler = api_profile_start_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_profile_start);
+
+    httpd_uri_t api_profile_get = {
+        .uri = "/api/profile",
+        .method = HTTP_GET,
+        .handler = api_profile_get_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_profile_get);
+    #endif
+
+    #if TRACE_ENABLED
+    // API trace endpoint (scheduling trace as Chrome/Perfetto JSON)
+    httpd_uri_t api_trace = {
+        .uri = "/api/trace",
+        .method = HTTP_GET,
+        .handler = api_trace_handler,
+    };
+    httpd_register_uri_handler(ota_server, &api_trace);
+    #endif
+
+    // API upstreams endpoint (endpoint health and switchovers)
+    httpd_uri_t api_upstreams = {
+        .uri = "/api/upstreams",
         .method = HTTP_GET,
-        .handler = api_rssi_handler,
+        .handler = api_upstreams_handler,
     };
-    httpd_register_uri_handler(ota_server, &api_rssi);
+    httpd_register_uri_handler(ota_server, &api_upstreams);
 
-    // API requests endpoint (JSON array of recent requests)
-    httpd_uri_t api_requests = {
-        .uri = "/api/requests",
+    #if CONNECT_TUNNEL_ENABLED
+    // API tunnel endpoint (CONNECT targets, limits and usage)
+    httpd_uri_t api_tunnel = {
+        .uri = "/api/tunnel",
         .method = HTTP_GET,
-        .handler = api_requests_handler,
+        .handler = api_tunnel_handler,
     };
-    httpd_register_uri_handler(ota_server, &api_requests);
+    httpd_register_uri_handler(ota_server, &api_tunnel);
+    #endif
 
     ESP_LOGI(TAG, "OTA server started on port %d", OTA_HTTP_PORT);
     return ESP_OK;
@@ -1126,10 +5264,16 @@ static void eth_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "HW Addr %02x:%02x:%02x:%02x:%02x:%02x",
                  mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
         xEventGroupSetBits(s_event_group, ETH_CONNECTED_BIT);
+        eth_link_changed(true);
+        #if PROXY_IPV6_ENABLED
+        // Link-local first; SLAAC then adds a global address from router advertisements
+        esp_netif_create_ip6_linklocal(eth_netif);
+        #endif
         break;
     case ETHERNET_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "Ethernet Link Down");
         xEventGroupClearBits(s_event_group, ETH_CONNECTED_BIT | ETH_GOT_IP_BIT);
+        eth_link_changed(false);
         break;
     case ETHERNET_EVENT_START:
         ESP_LOGI(TAG, "Ethernet Started");
@@ -1156,9 +5300,28 @@ static void got_ip_event_handler(void *arg, esp_event_base_t event_base,
     ESP_LOGI(TAG, "ETHMASK:" IPSTR, IP2STR(&ip_info->netmask));
     ESP_LOGI(TAG, "ETHGW:" IPSTR, IP2STR(&ip_info->gw));
     ESP_LOGI(TAG, "~~~~~~~~~~~");
+    eth_address_changed(ip_info);
+    #if HA_ENABLED
+    ha_record_lease(ip_info);
+    #endif
+    send_gratuitous_arp(eth_netif);
     xEventGroupSetBits(s_event_group, ETH_GOT_IP_BIT);
 }
 
+#if PROXY_IPV6_ENABLED
+/** Event handler for IP_EVENT_GOT_IP6 (link-local and SLAAC addresses) */
+static void got_ip6_event_handler(void *arg, esp_event_base_t event_base,
+                                  int32_t event_id, void *event_data)
+{
+    ip_event_got_ip6_t *event = (ip_event_got_ip6_t *) event_data;
+    if (event->esp_netif != eth_netif) return;
+
+    ESP_LOGI(TAG, "Ethernet Got IPv6 Address: " IPV6STR, IPV62STR(event->ip6_info.ip));
+    // Publish the new address as an AAAA record (no-op until mDNS is up)
+    mdns_netif_action(eth_netif, MDNS_EVENT_ENABLE_IP6 | MDNS_EVENT_ANNOUNCE_IP6);
+}
+#endif
+
 /** Event handler for WiFi events */
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                 int32_t event_id, void *event_data)
@@ -1177,7 +5340,8 @@ static void wifi_got_ip_handler(void *arg, esp_event_base_t event_base,
                                 int32_t event_id, void *event_data)
 {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *) event_data;
-    ESP_LOGI(TAG, "WiFi got IP:" IPSTR, IP2STR(&event->ip_info.ip));
+    ESP_LOGI(TAG, "WiFi got IP:" IPSTR " gateway:" IPSTR, IP2STR(&event->ip_info.ip), IP2STR(&event->ip_info.gw));
+    set_upstream_from_gateway(event->ip_info.gw.addr);
     xEventGroupSetBits(s_event_group, WIFI_CONNECTED_BIT);
 }
 
@@ -1200,6 +5364,9 @@ static esp_err_t init_ethernet(void)
     // Register event handlers
     ESP_ERROR_CHECK(esp_event_handler_register(ETH_EVENT, ESP_EVENT_ANY_ID, &eth_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &got_ip_event_handler, NULL));
+    #if PROXY_IPV6_ENABLED
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_GOT_IP6, &got_ip6_event_handler, NULL));
+    #endif
 
     // Configure SPI bus
     spi_bus_config_t buscfg = {
@@ -1220,11 +5387,18 @@ static esp_err_t init_ethernet(void)
         .spics_io_num = W5500_CS_GPIO,
         .queue_size = 20,
         .cs_ena_posttrans = 1,
+        .pre_cb = w5500_spi_pre_cb,    // SPI utilisation accounting
+        .post_cb = w5500_spi_post_cb,
     };
 
-    // Configure W5500
+    // Configure W5500 (polling mode runs the driver off a timer instead of the INT pin)
     eth_w5500_config_t w5500_config = ETH_W5500_DEFAULT_CONFIG(SPI3_HOST, &spi_devcfg);
+    #if W5500_RX_MODE == W5500_RX_MODE_POLL
+    w5500_config.int_gpio_num = -1;
+    w5500_config.poll_period_ms = W5500_POLL_PERIOD_MS;
+    #else
     w5500_config.int_gpio_num = W5500_INT_GPIO;
+    #endif
 
     // Configure MAC and PHY
     eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
@@ -1256,6 +5430,9 @@ static esp_err_t init_ethernet(void)
 
     // Attach Ethernet driver to TCP/IP stack
     ESP_ERROR_CHECK(esp_netif_attach(eth_netif, esp_eth_new_netif_glue(eth_handle)));
+    init_w5500_rx_mode();
+    init_eth_addressing();
+    init_eth_stats(mac);
 
     // Start Ethernet driver
     ESP_ERROR_CHECK(esp_eth_start(eth_handle));
@@ -1308,10 +5485,12 @@ static void init_mdns(void)
     ESP_ERROR_CHECK(mdns_hostname_set(hostname));
     ESP_LOGI(TAG, "mDNS hostname set to: %s.local", hostname);
 
-    // Create TXT records with device info (using runtime wifi_ssid)
+    // Create TXT records with device info (using runtime wifi_ssid and upstream)
+    char target_str[16];
+    upstream_ip_string(target_str, sizeof(target_str));
     mdns_txt_item_t txt_records[] = {
         {"wifi_ssid", wifi_ssid},
-        {"target", POWERWALL_IP_STR},
+        {"target", target_str},
         {"ota_port", "8080"},
     };
 
@@ -1328,7 +5507,88 @@ static void init_mdns(void)
     mdns_service_add("Powerwall Bridge", "_http", "_tcp", OTA_HTTP_PORT, http_txt,
                      sizeof(http_txt) / sizeof(http_txt[0]));
     ESP_LOGI(TAG, "mDNS service added: _http._tcp on port %d", OTA_HTTP_PORT);
+
+    #if PROXY_IPV6_ENABLED
+    // Answer AAAA queries for any IPv6 address Ethernet already has
+    mdns_netif_action(eth_netif, MDNS_EVENT_ENABLE_IP6 | MDNS_EVENT_ANNOUNCE_IP6);
+    #endif
+}
+
+#if MDNS_LOAD_TXT_ENABLED
+/** Publish the _powerwall._tcp TXT record with static info plus live load figures */
+static esp_err_t publish_mdns_load_txt(int free_slots, uint16_t p95_ttfb, int rssi)
+{
+    char slots_str[8], ttfb_str[8], rssi_str[8], target_str[16];
+    upstream_ip_string(target_str, sizeof(target_str));
+    snprintf(slots_str, sizeof(slots_str), "%d", free_slots);
+    snprintf(ttfb_str, sizeof(ttfb_str), "%u", p95_ttfb);
+    snprintf(rssi_str, sizeof(rssi_str), "%d", rssi);
+
+    // Set all items at once so a change produces a single announcement
+    mdns_txt_item_t txt_records[] = {
+        {"wifi_ssid", wifi_ssid},
+        {"target", target_str},
+        {"ota_port", "8080"},
+        {"free_slots", slots_str},
+        {"ttfb_p95", ttfb_str},
+        {"rssi", rssi_str},
+    };
+    return mdns_service_txt_set(MDNS_SERVICE, MDNS_PROTOCOL, txt_records,
+                                sizeof(txt_records) / sizeof(txt_records[0]));
+}
+
+/** mDNS load task - advertises live load in TXT records, rate-limited to avoid multicast spam */
+static void mdns_load_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "mDNS load advertising started (min interval: %d seconds)", MDNS_TXT_MIN_INTERVAL_SEC);
+
+    int last_slots = -1;
+    int last_rssi = 0;
+    uint16_t last_ttfb = 0;
+    int64_t last_publish_us = 0;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(MDNS_TXT_CHECK_INTERVAL_SEC * 1000));
+
+        int64_t now_us = esp_timer_get_time();
+        if (last_slots >= 0 && now_us - last_publish_us < (int64_t)MDNS_TXT_MIN_INTERVAL_SEC * 1000000) {
+            continue;
+        }
+
+        int free_slots = count_free_slots();
+        uint16_t p95_ttfb = ttfb_percentile(95);
+        int rssi = 0;
+        wifi_ap_record_t ap_info;
+        if ((xEventGroupGetBits(s_event_group) & WIFI_CONNECTED_BIT) &&
+            esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+            rssi = ap_info.rssi;
+        }
+        if (free_slots < 0) continue;
+
+        // Only re-announce on a meaningful change (hysteresis on RSSI and TTFB)
+        int ttfb_delta = abs((int)p95_ttfb - (int)last_ttfb);
+        bool changed = last_slots < 0 ||
+                       free_slots != last_slots ||
+                       abs(rssi - last_rssi) >= MDNS_TXT_RSSI_HYSTERESIS ||
+                       ttfb_delta * 100 > (int)last_ttfb * MDNS_TXT_TTFB_HYSTERESIS_PCT;
+        if (!changed) continue;
+
+        esp_err_t err = publish_mdns_load_txt(free_slots, p95_ttfb, rssi);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to update mDNS TXT records: %s", esp_err_to_name(err));
+            continue;
+        }
+        #if DEBUG_MODE
+        ESP_LOGI(TAG, "mDNS TXT updated: free_slots=%d ttfb_p95=%u rssi=%d", free_slots, p95_ttfb, rssi);
+        #endif
+
+        last_slots = free_slots;
+        last_ttfb = p95_ttfb;
+        last_rssi = rssi;
+        last_publish_us = now_us;
+    }
 }
+#endif
 
 /** WiFi quality monitoring task - periodically logs connection quality */
 static void wifi_quality_monitor_task(void *pvParameters)
@@ -1446,94 +5706,95 @@ static void system_monitor_task(void *pvParameters)
     }
 }
 
-/** SSL/TLS Passthrough Proxy task - forwards encrypted packets without decryption */
-static void handle_client_task(void *pvParameters)
+/** End a client handler task, keeping the active connection count in sync */
+static void connection_task_exit(void)
 {
-    int client_sock = (int)pvParameters;
-    int buffer_index = -1;
-
-    // Per-request tracking for TTFB/TTLB measurement
-    TickType_t request_start_time = 0;
-    uint32_t request_bytes_in = 0;
-    uint32_t request_bytes_out = 0;
-    bool awaiting_first_byte = false;
-    uint16_t current_ttfb_ms = 0;
-    uint16_t current_ttlb_ms = 0;
-    uint8_t request_result = 0;  // 0=success, 1=timeout, 2=error
-
-    // Get source IP
-    struct sockaddr_in peer_addr;
-    socklen_t peer_len = sizeof(peer_addr);
-    uint32_t source_ip = 0;
-    if (getpeername(client_sock, (struct sockaddr *)&peer_addr, &peer_len) == 0) {
-        source_ip = peer_addr.sin_addr.s_addr;
-    }
-
-    ESP_LOGI(TAG, "Handling client connection (SSL passthrough mode)");
-
-    // Acquire buffer pair from pool (avoids malloc/free overhead)
-    buffer_index = acquire_buffer_pair();
-    if (buffer_index < 0) {
-        ESP_LOGE(TAG, "No buffers available - max concurrent clients (%d) reached", MAX_CONCURRENT_CLIENTS);
-        close(client_sock);
-        vTaskDelete(NULL);
-        return;
-    }
-
-    // Connect to Powerwall via TCP (no TLS, just raw socket)
-    struct sockaddr_in powerwall_addr;
-    powerwall_addr.sin_family = AF_INET;
-    powerwall_addr.sin_port = htons(443);
-    inet_pton(AF_INET, POWERWALL_IP_STR, &powerwall_addr.sin_addr);
+    atomic_fetch_sub(&active_connections, 1);
+    vTaskDelete(NULL);
+}
 
-    int powerwall_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (powerwall_sock < 0) {
-        ESP_LOGE(TAG, "Failed to create socket to Powerwall");
-        release_buffer_pair(buffer_index);
-        close(client_sock);
-        vTaskDelete(NULL);
-        return;
+/** Open a TCP socket to an upstream on the WiFi side (TTL rewrite, timeouts, no Nagle) */
+static int connect_upstream(const struct sockaddr_in *addr, const char *label, const keepalive_cfg_t *ka,
+                            esp_netif_t *via)
+{
+    int upstream_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (upstream_sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket to %s", label);
+        return -1;
     }
+    socket_opened();
+    bind_to_netif(upstream_sock, via);
 
     // Set TTL to hide that traffic is coming from outside the network
     // Common TTL values: 64 (Linux/Unix), 128 (Windows), 255 (Cisco)
     // Using 64 as it's the most common default
     int ttl = TTL_VALUE;
-    if (setsockopt(powerwall_sock, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
+    if (setsockopt(upstream_sock, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
         ESP_LOGW(TAG, "Failed to set TTL on socket: %d", errno);
     } else {
         ESP_LOGI(TAG, "Set TTL to %d on outgoing connection", ttl);
     }
 
-    // Set timeouts on both sockets
     struct timeval timeout = {.tv_sec = PROXY_TIMEOUT_MS / 1000, .tv_usec = (PROXY_TIMEOUT_MS % 1000) * 1000};
-    if (setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        ESP_LOGW(TAG, "Failed to set timeout on client socket: %d", errno);
+    if (setsockopt(upstream_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        ESP_LOGW(TAG, "Failed to set timeout on %s socket: %d", label, errno);
     }
-    if (setsockopt(powerwall_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        ESP_LOGW(TAG, "Failed to set timeout on powerwall socket: %d", errno);
+
+    // Deadline-bound connect so an unreachable upstream fails after PROXY_CONNECT_TIMEOUT_MS
+    int err = connect_with_timeout(upstream_sock, addr, PROXY_CONNECT_TIMEOUT_MS);
+    if (err == ETIMEDOUT) {
+        ESP_LOGE(TAG, "Connect to %s timed out after %d ms", label, PROXY_CONNECT_TIMEOUT_MS);
+        atomic_fetch_add(&close_counts[CLOSE_CONNECT_TIMEOUT], 1);
+        close_socket(upstream_sock);
+        return -1;
+    } else if (err != 0) {
+        ESP_LOGE(TAG, "Failed to connect to %s - error: %d", label, err);
+        atomic_fetch_add(&close_counts[CLOSE_CONNECT_FAILED], 1);
+        close_socket(upstream_sock);
+        return -1;
     }
 
-    // Connect to Powerwall
-    if (connect(powerwall_sock, (struct sockaddr *)&powerwall_addr, sizeof(powerwall_addr)) != 0) {
-        ESP_LOGE(TAG, "Failed to connect to Powerwall at %s:443 - error: %d", POWERWALL_IP_STR, errno);
-        release_buffer_pair(buffer_index);
-        close(powerwall_sock);
-        close(client_sock);
-        vTaskDelete(NULL);
-        return;
+    // Disable Nagle's algorithm for lower latency
+    int nodelay = 1;
+    setsockopt(upstream_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    apply_keepalive(upstream_sock, ka);
+
+    ESP_LOGI(TAG, "Connected to %s (encrypted passthrough)", label);
+    return upstream_sock;
+}
+
+/** Bidirectional forwarding between a client and a connected upstream, logging each exchange.
+ *  preface_bytes: request bytes the caller already sent upstream (CONNECT pipelining). */
+static void forward_streams(int client_sock, int upstream_sock, int buffer_index,
+                            uint32_t source_ip, bool source_v6, uint32_t preface_bytes,
+                            const keepalive_cfg_t *ka)
+{
+    // Per-request tracking for TTFB/TTLB measurement
+    TickType_t request_start_time = 0;
+    uint32_t request_bytes_in = 0;
+    uint32_t request_bytes_out = 0;
+    bool awaiting_first_byte = false;
+    uint16_t current_ttfb_ms = 0;
+    uint16_t current_ttlb_ms = 0;
+    uint8_t request_result = 0;  // 0=success, 1=timeout, 2=error
+
+    // Set timeout on the client socket (upstream already has one)
+    struct timeval timeout = {.tv_sec = PROXY_TIMEOUT_MS / 1000, .tv_usec = (PROXY_TIMEOUT_MS % 1000) * 1000};
+    if (setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        ESP_LOGW(TAG, "Failed to set timeout on client socket: %d", errno);
     }
 
-    // Disable Nagle's algorithm for lower latency on both sockets
+    // Disable Nagle's algorithm for lower latency
     int nodelay = 1;
     setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
-    setsockopt(powerwall_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
-
-    ESP_LOGI(TAG, "Connected to Powerwall at %s:443 (encrypted passthrough)", POWERWALL_IP_STR);
+    apply_keepalive(client_sock, ka);
 
     // Get buffer pointers from the preallocated pool
-    uint8_t *client_buffer = buffer_pool[buffer_index].client_buffer;
-    uint8_t *powerwall_buffer = buffer_pool[buffer_index].powerwall_buffer;
+    buffer_pair_t *slot = &buffer_pool[buffer_index];
+    uint8_t *client_buffer = slot->client_buffer;
+    uint8_t *upstream_buffer = slot->powerwall_buffer;
+    conn_set_sockets(buffer_index, client_sock, upstream_sock);
+    conn_progress(buffer_index, CONN_HANDSHAKE);
 
     // Set both sockets to non-blocking mode for bidirectional forwarding
     int flags = fcntl(client_sock, F_GETFL, 0);
@@ -1545,26 +5806,43 @@ static void handle_client_task(void *pvParameters)
         ESP_LOGW(TAG, "Failed to get client socket flags: %d", errno);
     }
     
-    flags = fcntl(powerwall_sock, F_GETFL, 0);
+    flags = fcntl(upstream_sock, F_GETFL, 0);
     if (flags >= 0) {
-        if (fcntl(powerwall_sock, F_SETFL, flags | O_NONBLOCK) < 0) {
-            ESP_LOGW(TAG, "Failed to set powerwall socket to non-blocking mode: %d", errno);
+        if (fcntl(upstream_sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+            ESP_LOGW(TAG, "Failed to set upstream socket to non-blocking mode: %d", errno);
         }
     } else {
-        ESP_LOGW(TAG, "Failed to get powerwall socket flags: %d", errno);
+        ESP_LOGW(TAG, "Failed to get upstream socket flags: %d", errno);
     }
 
-    TickType_t last_activity = xTaskGetTickCount();
+    TickType_t start_time = xTaskGetTickCount();
+    TickType_t last_activity = start_time;
     const TickType_t timeout_ticks = pdMS_TO_TICKS(PROXY_TIMEOUT_MS);
+    close_reason_t close_reason = CLOSE_ERROR;
+
+    // Handshake / slow-sender tracking
+    bool client_started = preface_bytes > 0;
+    bool handshake_done = false;
+    TickType_t window_start = start_time;
+    TickType_t window_first_client = 0, window_last_client = 0;
+    uint32_t window_client_bytes = 0;
+    uint32_t window_upstream_bytes = 0;
+    const TickType_t window_ticks = pdMS_TO_TICKS(PROXY_MIN_RATE_WINDOW_MS);
+
+    if (preface_bytes > 0) {
+        request_start_time = start_time;
+        awaiting_first_byte = true;
+        request_bytes_in = preface_bytes;
+    }
 
     // Bidirectional forwarding loop using select() for efficient I/O multiplexing
     while (1) {
         fd_set read_fds;
         FD_ZERO(&read_fds);
         FD_SET(client_sock, &read_fds);
-        FD_SET(powerwall_sock, &read_fds);
+        FD_SET(upstream_sock, &read_fds);
         
-        int max_fd = (client_sock > powerwall_sock) ? client_sock : powerwall_sock;
+        int max_fd = (client_sock > upstream_sock) ? client_sock : upstream_sock;
         
         // Use select with a small timeout for activity checking
         struct timeval select_timeout = {.tv_sec = 0, .tv_usec = 100000}; // 100ms
@@ -1573,24 +5851,59 @@ static void handle_client_task(void *pvParameters)
         if (ready < 0) {
             ESP_LOGE(TAG, "select() error: %d", errno);
             break;
-        } else if (ready == 0) {
-            // Timeout - check for inactivity timeout
-            if ((xTaskGetTickCount() - last_activity) > timeout_ticks) {
-                ESP_LOGI(TAG, "Connection timeout - no activity for %d ms", PROXY_TIMEOUT_MS);
-                request_result = 1;  // Timeout
+        }
+        conn_progress(buffer_index, handshake_done ? CONN_STREAMING : CONN_HANDSHAKE);
+
+        // Deadlines are checked on every pass so trickled traffic cannot keep a slot alive
+        TickType_t now = xTaskGetTickCount();
+        close_reason_t expired = CLOSE_REASON_COUNT;
+        if (!client_started && now - start_time > pdMS_TO_TICKS(PROXY_FIRST_BYTE_TIMEOUT_MS)) {
+            expired = CLOSE_FIRST_BYTE_TIMEOUT;
+        } else if (!handshake_done && now - start_time > pdMS_TO_TICKS(PROXY_HANDSHAKE_TIMEOUT_MS)) {
+            expired = CLOSE_HANDSHAKE_TIMEOUT;
+        } else if (PROXY_MAX_LIFETIME_MS > 0 && now - start_time > pdMS_TO_TICKS(PROXY_MAX_LIFETIME_MS)) {
+            expired = CLOSE_LIFETIME;
+        } else if (now - last_activity > timeout_ticks) {
+            expired = CLOSE_IDLE_TIMEOUT;
+        } else if (now - window_start >= window_ticks) {
+            // Slow sender: kept trickling a request across the window while the upstream waited
+            if (awaiting_first_byte && window_upstream_bytes == 0 && window_client_bytes > 0 &&
+                window_client_bytes < (uint32_t)PROXY_MIN_CLIENT_RATE_BPS * PROXY_MIN_RATE_WINDOW_MS / 1000 &&
+                window_last_client - window_first_client >= window_ticks / 2) {
+                expired = CLOSE_SLOW_CLIENT;
+            }
+            window_start = now;
+            window_client_bytes = 0;
+            window_upstream_bytes = 0;
+        }
+        if (expired != CLOSE_REASON_COUNT) {
+            ESP_LOGI(TAG, "Closing connection: %s", close_reason_names[expired]);
+            close_reason = expired;
+            request_result = 1;  // Timeout
+            break;
+        }
+
+        if (ready == 0) {
+            // Draining: close once the handshake has started, no request is awaiting a response
+            // and neither side has sent anything for DRAIN_QUIET_MS (a response can pause
+            // mid-stream, or the client can still be computing its next handshake flight)
+            if (atomic_load(&draining) && handshake_done && !awaiting_first_byte &&
+                now - last_activity >= pdMS_TO_TICKS(DRAIN_QUIET_MS)) {
+                ESP_LOGI(TAG, "Closing idle connection for drain");
+                close_reason = CLOSE_DRAIN;
                 break;
             }
             continue;
         }
 
-        // Client -> Powerwall: Forward encrypted data
+        // Client -> upstream: Forward encrypted data
         if (FD_ISSET(client_sock, &read_fds)) {
             int len = recv(client_sock, client_buffer, PROXY_BUFFER_SIZE, 0);
             if (len > 0) {
                 // If we were waiting for response and got new request data,
                 // log the previous request/response exchange
                 if (request_bytes_out > 0 && !awaiting_first_byte) {
-                    log_request(source_ip, request_bytes_in, request_bytes_out, current_ttfb_ms, current_ttlb_ms, request_result);
+                    log_request(source_ip, source_v6, request_bytes_in, request_bytes_out, current_ttfb_ms, current_ttlb_ms, request_result);
                     request_bytes_in = 0;
                     request_bytes_out = 0;
                     current_ttfb_ms = 0;
@@ -1604,49 +5917,59 @@ static void handle_client_task(void *pvParameters)
                     awaiting_first_byte = true;
                 }
 
-                // Forward encrypted data to Powerwall
+                // Forward encrypted data upstream
                 int total_sent = 0;
+                slot->pending_send = len;
                 while (total_sent < len) {
-                    int sent = send(powerwall_sock, client_buffer + total_sent, len - total_sent, 0);
+                    int sent = send(upstream_sock, client_buffer + total_sent, len - total_sent, 0);
                     if (sent < 0) {
                         if (errno == EAGAIN || errno == EWOULDBLOCK) {
                             // Wait for socket to become writable using select()
                             fd_set write_fds;
                             FD_ZERO(&write_fds);
-                            FD_SET(powerwall_sock, &write_fds);
+                            FD_SET(upstream_sock, &write_fds);
                             struct timeval write_timeout = {.tv_sec = 5, .tv_usec = 0};
-                            if (select(powerwall_sock + 1, NULL, &write_fds, NULL, &write_timeout) <= 0) {
-                                ESP_LOGE(TAG, "Timeout waiting for Powerwall socket writability");
+                            if (select(upstream_sock + 1, NULL, &write_fds, NULL, &write_timeout) <= 0) {
+                                ESP_LOGE(TAG, "Timeout waiting for upstream socket writability");
                                 goto cleanup;
                             }
                             continue;
                         }
-                        ESP_LOGE(TAG, "Error sending to Powerwall: %d", errno);
+                        ESP_LOGE(TAG, "Error sending upstream: %d", errno);
+                        if (is_dead_peer_error(errno)) close_reason = CLOSE_DEAD_UPSTREAM;
                         goto cleanup;
                     }
                     total_sent += sent;
+                    slot->pending_send = len - total_sent;
                 }
                 
                 last_activity = xTaskGetTickCount();
                 request_bytes_in += len;
+                slot->bytes_in += len;
+                client_started = true;
+                if (window_client_bytes == 0) window_first_client = last_activity;
+                window_last_client = last_activity;
+                window_client_bytes += len;
 
                 #if DEBUG_MODE
-                ESP_LOGI(TAG, "Forwarded %d bytes from client to Powerwall (encrypted)", len);
+                ESP_LOGI(TAG, "Forwarded %d bytes from client to upstream (encrypted)", len);
                 ESP_LOG_BUFFER_HEXDUMP(TAG, client_buffer, len < 64 ? len : 64, ESP_LOG_INFO);
                 #endif
             } else if (len == 0) {
                 ESP_LOGI(TAG, "Client closed connection");
+                close_reason = CLOSE_CLIENT;
                 break;
             } else {
                 ESP_LOGE(TAG, "Error reading from client: %d", errno);
+                if (is_dead_peer_error(errno)) close_reason = CLOSE_DEAD_CLIENT;
                 request_result = 2;  // Error
                 break;
             }
         }
 
-        // Powerwall -> Client: Forward encrypted data
-        if (FD_ISSET(powerwall_sock, &read_fds)) {
-            int len = recv(powerwall_sock, powerwall_buffer, PROXY_BUFFER_SIZE, 0);
+        // Upstream -> client: Forward encrypted data
+        if (FD_ISSET(upstream_sock, &read_fds)) {
+            int len = recv(upstream_sock, upstream_buffer, PROXY_BUFFER_SIZE, 0);
             if (len > 0) {
                 // Calculate TTFB on first response byte
                 if (awaiting_first_byte) {
@@ -1661,8 +5984,9 @@ static void handle_client_task(void *pvParameters)
                 
                 // Forward encrypted data to client
                 int total_sent = 0;
+                slot->pending_send = len;
                 while (total_sent < len) {
-                    int sent = send(client_sock, powerwall_buffer + total_sent, len - total_sent, 0);
+                    int sent = send(client_sock, upstream_buffer + total_sent, len - total_sent, 0);
                     if (sent < 0) {
                         if (errno == EAGAIN || errno == EWOULDBLOCK) {
                             // Wait for socket to become writable using select()
@@ -1677,13 +6001,18 @@ static void handle_client_task(void *pvParameters)
                             continue;
                         }
                         ESP_LOGE(TAG, "Error sending to client: %d", errno);
+                        if (is_dead_peer_error(errno)) close_reason = CLOSE_DEAD_CLIENT;
                         goto cleanup;
                     }
                     total_sent += sent;
+                    slot->pending_send = len - total_sent;
                 }
                 
                 last_activity = xTaskGetTickCount();
                 request_bytes_out += len;
+                slot->bytes_out += len;
+                handshake_done = true;
+                window_upstream_bytes += len;
 
                 // Update TTLB (time to last byte) - updated on each chunk
                 TickType_t ttlb_ticks = last_activity - request_start_time;
@@ -1691,14 +6020,16 @@ static void handle_client_task(void *pvParameters)
                 current_ttlb_ms = (ttlb_ms > 65535) ? 65535 : ttlb_ms;
 
                 #if DEBUG_MODE
-                ESP_LOGI(TAG, "Forwarded %d bytes from Powerwall to client (encrypted)", len);
-                ESP_LOG_BUFFER_HEXDUMP(TAG, powerwall_buffer, len < 64 ? len : 64, ESP_LOG_INFO);
+                ESP_LOGI(TAG, "Forwarded %d bytes from upstream to client (encrypted)", len);
+                ESP_LOG_BUFFER_HEXDUMP(TAG, upstream_buffer, len < 64 ? len : 64, ESP_LOG_INFO);
                 #endif
             } else if (len == 0) {
-                ESP_LOGI(TAG, "Powerwall closed connection");
+                ESP_LOGI(TAG, "Upstream closed connection");
+                close_reason = CLOSE_UPSTREAM;
                 break;
             } else {
-                ESP_LOGE(TAG, "Error reading from Powerwall: %d", errno);
+                ESP_LOGE(TAG, "Error reading from upstream: %d", errno);
+                if (is_dead_peer_error(errno)) close_reason = CLOSE_DEAD_UPSTREAM;
                 request_result = 2;  // Error
                 break;
             }
@@ -1706,86 +6037,410 @@ static void handle_client_task(void *pvParameters)
     }
 
 cleanup:
+    conn_progress(buffer_index, CONN_CLOSING);
+    if (slot->force_closed) {
+        close_reason = CLOSE_STUCK;
+    }
+    atomic_fetch_add(&close_counts[close_reason], 1);
+
     // Log final request if any data was exchanged
     if (request_bytes_in > 0 || request_bytes_out > 0) {
-        log_request(source_ip, request_bytes_in, request_bytes_out, current_ttfb_ms, current_ttlb_ms, request_result);
+        log_request(source_ip, source_v6, request_bytes_in, request_bytes_out, current_ttfb_ms, current_ttlb_ms, request_result);
+    }
+}
+
+/** SSL/TLS Passthrough Proxy task - forwards encrypted packets without decryption */
+static void handle_client_task(void *pvParameters)
+{
+    int client_sock = (int)pvParameters;
+
+    // Get source IP (IPv4, or IPv4-mapped when accepted on the dual-stack listener)
+    struct sockaddr_storage peer_addr;
+    socklen_t peer_len = sizeof(peer_addr);
+    uint32_t source_ip = 0;
+    bool source_v6 = false;
+    if (getpeername(client_sock, (struct sockaddr *)&peer_addr, &peer_len) == 0) {
+        source_ip = sockaddr_source(&peer_addr, &source_v6);
+    }
+
+    ESP_LOGI(TAG, "Handling client connection (SSL passthrough mode)");
+
+    // Acquire buffer pair from pool (avoids malloc/free overhead)
+    int buffer_index = acquire_buffer_pair();
+    if (buffer_index < 0) {
+        ESP_LOGE(TAG, "No buffers available - max concurrent clients (%d) reached", buffer_pool_size);
+        atomic_fetch_add(&rejected_connections, 1);
+        close_socket(client_sock);
+        connection_task_exit();
+        return;
+    }
+    buffer_pool[buffer_index].source_ip = source_ip;
+    buffer_pool[buffer_index].source_v6 = source_v6;
+    conn_set_sockets(buffer_index, client_sock, -1);
+    conn_progress(buffer_index, CONN_CONNECTING);
+
+    // Connect to Powerwall via TCP (no TLS, just raw socket). If the selected endpoint fails,
+    // the next best one is tried right away.
+    int powerwall_sock = -1;
+    uint32_t failed_mask = 0;
+    while (powerwall_sock < 0) {
+        int endpoint = select_upstream(failed_mask);
+        if (failed_mask & (1u << endpoint)) break;
+
+        struct sockaddr_in powerwall_addr;
+        esp_netif_t *via = upstream_endpoint_target(endpoint, &powerwall_addr);
+        char label[48], ep_str[32];
+        upstream_endpoint_label(endpoint, ep_str, sizeof(ep_str));
+        snprintf(label, sizeof(label), "Powerwall at %s", ep_str);
+
+        int64_t start_us = esp_timer_get_time();
+        conn_progress(buffer_index, CONN_CONNECTING);
+        powerwall_sock = connect_upstream(&powerwall_addr, label, &powerwall_keepalive, via);
+        record_upstream_result(endpoint, powerwall_sock >= 0, (uint32_t)((esp_timer_get_time() - start_us) / 1000));
+        failed_mask |= 1u << endpoint;
+    }
+    if (powerwall_sock < 0) {
+        release_buffer_pair(buffer_index);
+        close_socket(client_sock);
+        connection_task_exit();
+        return;
     }
 
+    forward_streams(client_sock, powerwall_sock, buffer_index, source_ip, source_v6, 0, &powerwall_keepalive);
+
     release_buffer_pair(buffer_index);
-    close(powerwall_sock);
-    close(client_sock);
+    close_socket(powerwall_sock);
+    close_socket(client_sock);
 
     ESP_LOGI(TAG, "Client connection closed (passthrough mode)");
-    vTaskDelete(NULL);
+    connection_task_exit();
 }
 
-/** TCP Server task */
-static void tcp_server_task(void *pvParameters)
+/** Create a listening TCP socket on the Ethernet side (dual-stack when IPv6 is enabled) */
+static int open_listener(uint16_t port)
 {
-    // Wait for Ethernet to get IP
-    ESP_LOGI(TAG, "Waiting for Ethernet IP...");
-    xEventGroupWaitBits(s_event_group, ETH_GOT_IP_BIT, false, true, portMAX_DELAY);
-
-    // Create server socket
-    server_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-    if (server_socket < 0) {
+#if PROXY_IPV6_ENABLED
+    // One dual-stack socket: IPv4 clients arrive as ::ffff:a.b.c.d
+    int sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_IP);
+#else
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+#endif
+    if (sock < 0) {
         ESP_LOGE(TAG, "Unable to create socket");
-        vTaskDelete(NULL);
-        return;
+        return -1;
     }
+    socket_opened();
 
     int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+#if PROXY_IPV6_ENABLED
+    int v6only = 0;
+    setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+
+    struct sockaddr_in6 server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin6_family = AF_INET6;
+    server_addr.sin6_port = htons(port);
+    server_addr.sin6_addr = in6addr_any;
+#else
     struct sockaddr_in server_addr;
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PROXY_PORT);
+    server_addr.sin_port = htons(port);
     server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+#endif
 
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
-        ESP_LOGE(TAG, "Socket bind failed");
-        close(server_socket);
-        vTaskDelete(NULL);
-        return;
+    if (bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
+        ESP_LOGE(TAG, "Socket bind failed on port %d", port);
+        close_socket(sock);
+        return -1;
     }
 
-    if (listen(server_socket, 3) != 0) {
-        ESP_LOGE(TAG, "Socket listen failed");
-        close(server_socket);
-        vTaskDelete(NULL);
-        return;
+    if (listen(sock, PROXY_LISTEN_BACKLOG) != 0) {
+        ESP_LOGE(TAG, "Socket listen failed on port %d", port);
+        close_socket(sock);
+        return -1;
     }
+    return sock;
+}
 
-    ESP_LOGI(TAG, "TCP Server (SSL passthrough) listening on port %d", PROXY_PORT);
-    ESP_LOGI(TAG, "Ready to forward encrypted SSL/TLS traffic to Powerwall (%s:443) with TTL modification", POWERWALL_IP_STR);
+/** Accept connections on a listener and hand each to its own handler task */
+static void accept_loop(int listen_sock, TaskFunction_t handler, const char *task_name)
+{
+    #if ACCEPT_RATE_PER_SEC > 0
+    accept_bucket_t bucket = {.last_refill_us = esp_timer_get_time(), .tokens_milli = ACCEPT_BURST * 1000};
+    #endif
+    uint32_t backoff_ms = 0;
+    int queued = 0;  // Connections accepted back-to-back since the queue was last empty
 
     while (1) {
-        struct sockaddr_in client_addr;
+        if (!listener_ready(listen_sock, 0)) {
+            queued = 0;
+            if (!listener_ready(listen_sock, 1000)) continue;
+        }
+        int64_t ready_us = esp_timer_get_time();
+
+        struct sockaddr_storage client_addr;
         socklen_t client_len = sizeof(client_addr);
 
-        int client_sock = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
+        int client_sock = accept(listen_sock, (struct sockaddr *)&client_addr, &client_len);
         if (client_sock < 0) {
-            ESP_LOGE(TAG, "Unable to accept connection");
+            atomic_fetch_add(&accept_errors, 1);
+            backoff_ms = backoff_ms ? backoff_ms * 2 : ACCEPT_BACKOFF_MIN_MS;
+            if (backoff_ms > ACCEPT_BACKOFF_MAX_MS) backoff_ms = ACCEPT_BACKOFF_MAX_MS;
+            ESP_LOGE(TAG, "Unable to accept connection: %d (retry in %lu ms)", errno, (unsigned long)backoff_ms);
+            vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+            continue;
+        }
+        socket_opened();
+        backoff_ms = 0;
+
+        atomic_fetch_add(&accept_total, 1);
+        record_accept_latency((uint32_t)(esp_timer_get_time() - ready_us));
+        if (++queued == PROXY_LISTEN_BACKLOG) {
+            atomic_fetch_add(&accept_backlog_full, 1);
+            ESP_LOGW(TAG, "Accept queue reached backlog (%d) - new SYNs may be dropped", PROXY_LISTEN_BACKLOG);
+        }
+
+        char addr_str[48];
+        format_sockaddr(&client_addr, addr_str, sizeof(addr_str));
+
+        // Denied clients are reset before any task or buffer is committed to them
+        if (!source_acl_allows(&client_addr)) {
+            ESP_LOGD(TAG, "Client %s denied by ACL", addr_str);
+            reset_socket(client_sock);
+            continue;
+        }
+
+        // Draining for a restart: refuse so the client retries elsewhere or after reboot
+        if (atomic_load(&draining)) {
+            atomic_fetch_add(&drain_refused, 1);
+            reset_socket(client_sock);
             continue;
         }
 
-        char addr_str[32];
-        inet_ntoa_r(client_addr.sin_addr, addr_str, sizeof(addr_str) - 1);
-        ESP_LOGI(TAG, "Client connected from %s:%d", addr_str, ntohs(client_addr.sin_port));
+        #if ACCEPT_RATE_PER_SEC > 0
+        // Only admitted clients take a token, so denied sources cannot starve allowed ones.
+        // Out of tokens: hold this connection (the rest stay queued in the backlog) until one refills
+        uint32_t wait_ms = accept_bucket_take(&bucket);
+        if (wait_ms) {
+            atomic_fetch_add(&accept_throttled, 1);
+            do {
+                vTaskDelay(pdMS_TO_TICKS(wait_ms));
+            } while ((wait_ms = accept_bucket_take(&bucket)) > 0);
+        }
+        #endif
+
+        bool source_v6;
+        uint32_t log_source = sockaddr_source(&client_addr, &source_v6);
+        if (source_v6) {
+            // The request log only keeps the address hash; print it so entries can be traced back
+            ESP_LOGI(TAG, "Client connected from [%s]:%d (logged as v6:%08lx)", addr_str,
+                     ntohs(((struct sockaddr_in *)&client_addr)->sin_port), (unsigned long)log_source);
+        } else {
+            ESP_LOGI(TAG, "Client connected from %s:%d", addr_str,
+                     ntohs(((struct sockaddr_in *)&client_addr)->sin_port));
+        }
 
         // Spawn a new task to handle each client connection
         // This allows multiple simultaneous connections
-        BaseType_t task_created = xTaskCreate(handle_client_task, "ssl_passthrough", 
+        atomic_fetch_add(&active_connections, 1);
+        BaseType_t task_created = xTaskCreate(handler, task_name,
                                                SSL_PASSTHROUGH_TASK_STACK_SIZE, (void *)client_sock, 5, NULL);
         if (task_created != pdPASS) {
             ESP_LOGE(TAG, "Failed to create client handler task");
-            close(client_sock);
+            atomic_fetch_sub(&active_connections, 1);
+            close_socket(client_sock);
+        }
+    }
+}
+
+/** TCP Server task */
+static void tcp_server_task(void *pvParameters)
+{
+    // Wait for Ethernet to get IP
+    ESP_LOGI(TAG, "Waiting for Ethernet IP...");
+    xEventGroupWaitBits(s_event_group, ETH_GOT_IP_BIT, false, true, portMAX_DELAY);
+
+    // Create server socket
+    server_socket = open_listener(PROXY_PORT);
+    if (server_socket < 0) {
+        vTaskDelete(NULL);
+        return;
+    }
+
+    boot_proxy_listen_ms = boot_ms();
+    ESP_LOGI(TAG, "TCP Server (SSL passthrough) listening on port %d%s", PROXY_PORT,
+             PROXY_IPV6_ENABLED ? " (IPv4 + IPv6)" : "");
+    ESP_LOGI(TAG, "Boot to proxy listening: %lu ms (%s Ethernet address at %lu ms, DHCP lease at %lu ms)",
+             (unsigned long)boot_proxy_listen_ms, eth_address_source,
+             (unsigned long)boot_eth_ip_ms, (unsigned long)boot_dhcp_ms);
+    char ip_str[16];
+    ESP_LOGI(TAG, "Ready to forward encrypted SSL/TLS traffic to Powerwall (%s:443) with TTL modification",
+             upstream_ip_string(ip_str, sizeof(ip_str)));
+
+    accept_loop(server_socket, handle_client_task, "ssl_passthrough");
+
+    close_socket(server_socket);
+    vTaskDelete(NULL);
+}
+
+#if CONNECT_TUNNEL_ENABLED
+/** Send a minimal HTTP response on a tunnel client socket */
+static void send_connect_status(int sock, const char *status)
+{
+    char resp[96];
+    int len = snprintf(resp, sizeof(resp), "HTTP/1.1 %s\r\n\r\n", status);
+    send(sock, resp, len, 0);
+}
+
+/** Read a CONNECT request head into buf; returns its length (through the blank line) or -1 */
+static int read_connect_head(int sock, char *buf, int size, int *received)
+{
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(CONNECT_HEADER_TIMEOUT_MS);
+    int total = 0;
+    while (total < size - 1 && xTaskGetTickCount() < deadline) {
+        int len = recv(sock, buf + total, size - 1 - total, 0);
+        if (len <= 0) return -1;
+        total += len;
+        buf[total] = '\0';
+
+        char *end = strstr(buf, "\r\n\r\n");
+        if (end) {
+            *received = total;
+            return (end - buf) + 4;
+        }
+    }
+    return -1;
+}
+
+/** HTTP CONNECT tunnel task - checks the allow-list, then forwards like the Powerwall proxy */
+static void connect_client_task(void *pvParameters)
+{
+    int client_sock = (int)pvParameters;
+    int upstream_sock = -1;
+    connect_target_t *target = NULL;
+
+    struct sockaddr_storage peer_addr;
+    socklen_t peer_len = sizeof(peer_addr);
+    uint32_t source_ip = 0;
+    bool source_v6 = false;
+    if (getpeername(client_sock, (struct sockaddr *)&peer_addr, &peer_len) == 0) {
+        source_ip = sockaddr_source(&peer_addr, &source_v6);
+    }
+
+    int buffer_index = acquire_buffer_pair();
+    if (buffer_index < 0) {
+        ESP_LOGE(TAG, "No buffers available for CONNECT tunnel");
+        atomic_fetch_add(&rejected_connections, 1);
+        send_connect_status(client_sock, "503 Service Unavailable");
+        close_socket(client_sock);
+        connection_task_exit();
+        return;
+    }
+    buffer_pool[buffer_index].source_ip = source_ip;
+    buffer_pool[buffer_index].source_v6 = source_v6;
+    conn_set_sockets(buffer_index, client_sock, -1);
+
+    // The request head is parsed in the client buffer before forwarding starts
+    struct timeval head_timeout = {.tv_sec = CONNECT_HEADER_TIMEOUT_MS / 1000,
+                                   .tv_usec = (CONNECT_HEADER_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &head_timeout, sizeof(head_timeout));
+
+    char *head = (char *)buffer_pool[buffer_index].client_buffer;
+    int received = 0;
+    int head_len = read_connect_head(client_sock, head, PROXY_BUFFER_SIZE, &received);
+    if (head_len < 0) {
+        ESP_LOGW(TAG, "CONNECT request head missing or too large");
+        atomic_fetch_add(&connect_denied, 1);
+        send_connect_status(client_sock, "400 Bad Request");
+        goto done;
+    }
+
+    char authority[32];
+    if (strncmp(head, "CONNECT ", 8) != 0) {
+        atomic_fetch_add(&connect_denied, 1);
+        send_connect_status(client_sock, "405 Method Not Allowed");
+        goto done;
+    }
+    if (sscanf(head + 8, "%31s", authority) != 1) {
+        atomic_fetch_add(&connect_denied, 1);
+        send_connect_status(client_sock, "400 Bad Request");
+        goto done;
+    }
+    target = find_connect_target(authority);
+    if (!target) {
+        ESP_LOGW(TAG, "CONNECT to %s denied (not on allow-list)", authority);
+        atomic_fetch_add(&connect_denied, 1);
+        send_connect_status(client_sock, "403 Forbidden");
+        goto done;
+    }
+
+    // Per-target concurrency limit
+    if (atomic_fetch_add(&target->active, 1) >= target->limit) {
+        atomic_fetch_sub(&target->active, 1);
+        atomic_fetch_add(&target->refused, 1);
+        ESP_LOGW(TAG, "CONNECT to %s refused - %d tunnels already open", target->label, target->limit);
+        target = NULL;
+        send_connect_status(client_sock, "503 Service Unavailable");
+        goto done;
+    }
+
+    conn_progress(buffer_index, CONN_CONNECTING);
+    upstream_sock = connect_upstream(&target->addr, target->label, &connect_keepalive, NULL);
+    if (upstream_sock < 0) {
+        atomic_fetch_add(&target->failed, 1);
+        send_connect_status(client_sock, "502 Bad Gateway");
+        goto done;
+    }
+    atomic_fetch_add(&target->total, 1);
+    send_connect_status(client_sock, "200 Connection Established");
+
+    // Bytes the client sent right after the head (e.g. a TLS ClientHello) go upstream first
+    int pending = received - head_len;
+    for (int sent = 0; sent < pending; ) {
+        int n = send(upstream_sock, head + head_len + sent, pending - sent, 0);
+        if (n <= 0) {
+            ESP_LOGE(TAG, "Error sending to %s: %d", target->label, errno);
+            goto done;
         }
+        sent += n;
     }
 
-    close(server_socket);
+    ESP_LOGI(TAG, "CONNECT tunnel open to %s", target->label);
+    forward_streams(client_sock, upstream_sock, buffer_index, source_ip, source_v6, pending, &connect_keepalive);
+    ESP_LOGI(TAG, "CONNECT tunnel to %s closed", target->label);
+
+done:
+    if (target) {
+        atomic_fetch_sub(&target->active, 1);
+    }
+    release_buffer_pair(buffer_index);
+    close_socket(upstream_sock);
+    close_socket(client_sock);
+    connection_task_exit();
+}
+
+/** HTTP CONNECT listener task */
+static void connect_server_task(void *pvParameters)
+{
+    xEventGroupWaitBits(s_event_group, ETH_GOT_IP_BIT, false, true, portMAX_DELAY);
+
+    init_connect_targets();
+    int listen_sock = open_listener(CONNECT_PORT);
+    if (listen_sock < 0) {
+        vTaskDelete(NULL);
+        return;
+    }
+
+    ESP_LOGI(TAG, "CONNECT tunnel listening on port %d (%d allow-listed targets)",
+             CONNECT_PORT, connect_target_count);
+    accept_loop(listen_sock, connect_client_task, "connect_tunnel");
+
+    close_socket(listen_sock);
     vTaskDelete(NULL);
 }
+#endif
 
 /** Task to initialize WiFi-dependent services after connection */
 static void wifi_services_task(void *pvParameters)
@@ -1804,8 +6459,13 @@ static void wifi_services_task(void *pvParameters)
 
     ESP_LOGI(TAG, "WiFi connected - starting proxy services");
 
-    // Initialize buffer pool for proxy connections
-    init_buffer_pool();
+    // Initialize buffer pool for proxy connections. The services started below will hold the
+    // proxy (and CONNECT) listeners and the connectivity / endpoint health probe sockets.
+    int probes = 1 + (upstream_endpoint_count > 1 ? 1 : 0);
+    init_buffer_pool(1 + CONNECT_TUNNEL_ENABLED + probes, probes);
+
+    // Parse the source ACL before any listener accepts
+    init_source_acl();
 
     // Start WiFi quality monitoring task
     xTaskCreate(wifi_quality_monitor_task, "wifi_monitor", 3072, NULL, 3, NULL);
@@ -1813,7 +6473,35 @@ static void wifi_services_task(void *pvParameters)
     // Start TCP server task (proxy)
     xTaskCreate(tcp_server_task, "tcp_server", 4096, NULL, 5, NULL);
 
-    ESP_LOGI(TAG, "Proxy services started - forwarding to %s:443", POWERWALL_IP_STR);
+    #if CONNECT_TUNNEL_ENABLED
+    // Start HTTP CONNECT tunnel for other allow-listed devices on the Powerwall network
+    xTaskCreate(connect_server_task, "connect_server", 4096, NULL, 5, NULL);
+    #endif
+
+    // Start upstream ARP refresh (keeps the Powerwall MAC resolved between connections)
+    xTaskCreate(arp_refresh_task, "arp_refresh", 3072, NULL, 3, NULL);
+
+    // Start upstream endpoint health probing (only useful with more than one endpoint)
+    if (upstream_endpoint_count > 1) {
+        xTaskCreate(upstream_health_task, "upstream_health", 3072, NULL, 3, NULL);
+    }
+
+    #if CONN_STUCK_THRESHOLD_MS > 0
+    // Start connection watchdog (force-closes connections that stopped making progress)
+    xTaskCreate(conn_watchdog_task, "conn_watchdog", 3072, NULL, 4, NULL);
+    #endif
+
+    // Start self-check task (slot/socket leak and heap drift detection)
+    xTaskCreate(selfcheck_task, "selfcheck", 3072, NULL, 2, NULL);
+
+    #if MDNS_LOAD_TXT_ENABLED
+    // Start mDNS load advertising (needs the buffer pool for free slot counts)
+    xTaskCreate(mdns_load_task, "mdns_load", 3072, NULL, 2, NULL);
+    #endif
+
+    char ip_str[16];
+    ESP_LOGI(TAG, "Proxy services started - forwarding to %s:443%s", upstream_ip_string(ip_str, sizeof(ip_str)),
+             upstream_from_dhcp ? " (WiFi gateway)" : "");
 
     vTaskDelete(NULL);
 }
@@ -1822,12 +6510,24 @@ void app_main(void)
 {
     ESP_LOGI(TAG, "=== ESP32-S3-POE-ETH WiFi-Ethernet SSL Bridge ===");
     ESP_LOGI(TAG, "Mode: SSL Passthrough (no decryption, TTL modification)");
-    ESP_LOGI(TAG, "Target: Tesla Powerwall at %s:443", POWERWALL_IP_STR);
+    ESP_LOGI(TAG, "Target: Tesla Powerwall at %s:443", POWERWALL_IP_OVERRIDE ? POWERWALL_IP_STR : "WiFi gateway");
+    init_upstream_addr();
+    init_upstream_endpoints();
+    #if TRACE_ENABLED
+    init_trace();
+    #endif
 
     // Print firmware version
     const esp_app_desc_t *app_desc = esp_app_get_description();
     ESP_LOGI(TAG, "Firmware version: %s (built %s %s)", app_desc->version, app_desc->date, app_desc->time);
 
+    // Report how the previous restart's drain went (RTC memory survives a software reset)
+    if (last_drain.magic == DRAIN_REPORT_MAGIC) {
+        last_drain.reason[sizeof(last_drain.reason) - 1] = '\0';
+        ESP_LOGI(TAG, "Last drain (%s): %u finished, %u cut in %lu ms", last_drain.reason,
+                 last_drain.drained, last_drain.cut, (unsigned long)last_drain.duration_ms);
+    }
+
     // Initialize NVS
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -1836,6 +6536,11 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+    #if FLASH_LOG_ENABLED
+    // Mount the persistent request log before any traffic can be logged
+    init_flash_log();
+    #endif
+
     // Initialize Ethernet first (OTA server runs on Ethernet)
     ESP_ERROR_CHECK(init_ethernet());
 
@@ -1848,8 +6553,11 @@ void app_main(void)
 
     // Start OTA HTTP server immediately (on Ethernet interface)
     // This allows WiFi config even if WiFi credentials are wrong
-    start_ota_server();
-    ESP_LOGI(TAG, "OTA server started - http://<eth-ip>:%d/", OTA_HTTP_PORT);
+    if (start_ota_server() == ESP_OK) {
+        boot_ota_listen_ms = boot_ms();
+    }
+    ESP_LOGI(TAG, "OTA server started - http://<eth-ip>:%d/ (%s address, %lu ms after boot)",
+             OTA_HTTP_PORT, eth_address_source, (unsigned long)boot_ota_listen_ms);
 
     // Initialize mDNS on Ethernet (for device discovery, doesn't need WiFi)
     init_mdns();
@@ -1857,6 +6565,15 @@ void app_main(void)
     // Validate OTA image early so device doesn't rollback while user configures WiFi
     validate_ota_image();
 
+    #if HA_ENABLED
+    // Start active/standby heartbeat exchange (node ID from the Ethernet MAC)
+    uint8_t eth_mac[6];
+    esp_read_mac(eth_mac, ESP_MAC_ETH);
+    ha_node_id = ((uint32_t)eth_mac[2] << 24) | ((uint32_t)eth_mac[3] << 16) | ((uint32_t)eth_mac[4] << 8) | eth_mac[5];
+    inet_pton(AF_INET, HA_VIRTUAL_IP_STR, &ha_vip);
+    xTaskCreate(ha_task, "ha", 3072, NULL, 6, NULL);
+    #endif
+
     // Start system monitoring task
     xTaskCreate(system_monitor_task, "sys_monitor", 3072, NULL, 3, NULL);
 
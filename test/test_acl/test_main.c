@@ -0,0 +1,137 @@
+// Source ACL rule parsing and longest-prefix matching (include/bridge_logic.h)
+#include <unity.h>
+#include "bridge_logic.h"
+
+#define IP(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_parse_network(void)
+{
+    acl_rule_t r;
+    TEST_ASSERT_TRUE(acl_parse_rule("+192.168.0.0/16", &r));
+    TEST_ASSERT_TRUE(r.allow);
+    TEST_ASSERT_EQUAL_UINT8(16, r.prefix_len);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFF0000, r.mask);
+    TEST_ASSERT_EQUAL_HEX32(IP(192, 168, 0, 0), r.net);
+}
+
+static void test_parse_host_defaults_to_32(void)
+{
+    acl_rule_t r;
+    TEST_ASSERT_TRUE(acl_parse_rule("-192.168.1.66", &r));
+    TEST_ASSERT_FALSE(r.allow);
+    TEST_ASSERT_EQUAL_UINT8(32, r.prefix_len);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, r.mask);
+    TEST_ASSERT_EQUAL_HEX32(IP(192, 168, 1, 66), r.net);
+}
+
+static void test_parse_masks_host_bits(void)
+{
+    acl_rule_t r;
+    TEST_ASSERT_TRUE(acl_parse_rule("+10.1.2.3/8", &r));
+    TEST_ASSERT_EQUAL_HEX32(IP(10, 0, 0, 0), r.net);
+}
+
+static void test_parse_prefix_edges(void)
+{
+    acl_rule_t r;
+    TEST_ASSERT_TRUE(acl_parse_rule("+0.0.0.0/0", &r));
+    TEST_ASSERT_EQUAL_HEX32(0, r.mask);
+    TEST_ASSERT_EQUAL_HEX32(0, r.net);
+    TEST_ASSERT_TRUE(acl_parse_rule("+1.2.3.4/32", &r));
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, r.mask);
+    TEST_ASSERT_TRUE(acl_parse_rule("+1.2.3.4/1", &r));
+    TEST_ASSERT_EQUAL_HEX32(0x80000000, r.mask);
+}
+
+static void test_parse_rejects_malformed(void)
+{
+    static const char *bad[] = {
+        "192.168.0.0/16",       // No +/- sign
+        "*192.168.0.0/16",
+        "+",
+        "+192.168.0/16",        // Three octets
+        "+192.168.0.0.1",
+        "+256.1.1.1",
+        "+1.2.3.1000",
+        "+1..2.3",
+        "+1.2.3.4/33",
+        "+1.2.3.4/",
+        "+1.2.3.4/-1",
+        "+1.2.3.4/8x",          // Trailing garbage
+        "+1.2.3.4x",
+        "+1.2.3.4 /8",
+    };
+    for (unsigned i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        acl_rule_t r;
+        TEST_ASSERT_FALSE_MESSAGE(acl_parse_rule(bad[i], &r), bad[i]);
+    }
+}
+
+static void test_insert_orders_longest_first(void)
+{
+    acl_rule_t rules[4];
+    int count = 0;
+    acl_rule_t r;
+    acl_parse_rule("+10.0.0.0/8", &r);
+    TEST_ASSERT_TRUE(acl_insert_rule(rules, &count, 4, &r));
+    acl_parse_rule("-10.1.1.1", &r);
+    TEST_ASSERT_TRUE(acl_insert_rule(rules, &count, 4, &r));
+    acl_parse_rule("+10.1.0.0/16", &r);
+    TEST_ASSERT_TRUE(acl_insert_rule(rules, &count, 4, &r));
+    acl_parse_rule("+0.0.0.0/0", &r);
+    TEST_ASSERT_TRUE(acl_insert_rule(rules, &count, 4, &r));
+
+    TEST_ASSERT_EQUAL_INT(4, count);
+    TEST_ASSERT_EQUAL_UINT8(32, rules[0].prefix_len);
+    TEST_ASSERT_EQUAL_UINT8(16, rules[1].prefix_len);
+    TEST_ASSERT_EQUAL_UINT8(8, rules[2].prefix_len);
+    TEST_ASSERT_EQUAL_UINT8(0, rules[3].prefix_len);
+
+    TEST_ASSERT_FALSE(acl_insert_rule(rules, &count, 4, &r));
+    TEST_ASSERT_EQUAL_INT(4, count);
+}
+
+static void test_match_most_specific(void)
+{
+    acl_rule_t rules[3];
+    int count = 0;
+    acl_rule_t r;
+    acl_parse_rule("+192.168.0.0/16", &r);
+    acl_insert_rule(rules, &count, 3, &r);
+    acl_parse_rule("-192.168.1.66", &r);
+    acl_insert_rule(rules, &count, 3, &r);
+    acl_parse_rule("+10.0.0.0/8", &r);
+    acl_insert_rule(rules, &count, 3, &r);
+
+    int i = acl_match(rules, count, IP(192, 168, 1, 66));
+    TEST_ASSERT_TRUE(i >= 0);
+    TEST_ASSERT_FALSE(rules[i].allow);
+
+    i = acl_match(rules, count, IP(192, 168, 1, 67));
+    TEST_ASSERT_TRUE(i >= 0);
+    TEST_ASSERT_TRUE(rules[i].allow);
+    TEST_ASSERT_EQUAL_UINT8(16, rules[i].prefix_len);
+
+    i = acl_match(rules, count, IP(10, 200, 0, 1));
+    TEST_ASSERT_TRUE(i >= 0);
+    TEST_ASSERT_EQUAL_UINT8(8, rules[i].prefix_len);
+
+    TEST_ASSERT_EQUAL_INT(-1, acl_match(rules, count, IP(172, 16, 0, 1)));
+    TEST_ASSERT_EQUAL_INT(-1, acl_match(rules, 0, IP(192, 168, 1, 66)));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_network);
+    RUN_TEST(test_parse_host_defaults_to_32);
+    RUN_TEST(test_parse_masks_host_bits);
+    RUN_TEST(test_parse_prefix_edges);
+    RUN_TEST(test_parse_rejects_malformed);
+    RUN_TEST(test_insert_orders_longest_first);
+    RUN_TEST(test_match_most_specific);
+    return UNITY_END();
+}
@@ -0,0 +1,145 @@
+// Connection pool planner arithmetic (include/bridge_logic.h)
+#include <unity.h>
+#include "bridge_logic.h"
+
+// Shipped defaults: 6 KB client stacks, two 4 KB forwarding buffers per slot, IDF default 5760-byte
+// TCP send buffer and window, 32 sockets / active PCBs
+static const pool_config_t config = {
+    .task_stack = 6144,
+    .slot_bytes = 8256,
+    .tcp_buffer_bytes = 5760 + 5760,
+    .lwip_buffer_pct = 50,
+    .safety_pct = 20,
+    .heap_reserve = 65536,
+    .max_sockets = 32,
+    .max_active_tcp = 32,
+    .socket_reserve = 4,
+    .max_clients = 8,
+    .min_clients = 1,
+};
+
+static pool_plan_t plan;
+
+void setUp(void)
+{
+    memset(&plan, 0, sizeof(plan));
+    plan.internal_free = 300000;
+    plan.internal_largest = 110000;
+    plan.sockets_used = 3;
+    plan.pcbs_used = 0;
+    plan.service_sockets = 4;
+    plan.service_pcbs = 1;
+}
+
+void tearDown(void) {}
+
+static void test_per_connection_costs(void)
+{
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_EQUAL_UINT32(6144 + 512, plan.stack_bytes);
+    TEST_ASSERT_EQUAL_UINT32(8256, plan.buffer_bytes);
+    TEST_ASSERT_EQUAL_UINT32(2 * (384 + 11520 / 2), plan.lwip_bytes);
+    // No PSRAM: the slot is internal too, plus the 20% margin
+    TEST_ASSERT_FALSE(plan.buffers_in_psram);
+    TEST_ASSERT_EQUAL_UINT32((6656 + 12288 + 8256) * 120 / 100, plan.conn_internal);
+}
+
+static void test_heap_bound(void)
+{
+    plan.internal_free = 65536 + 2 * 32640 + 100;   // Two connections' worth above the reserve
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_EQUAL_INT(2, plan.by_heap);
+    TEST_ASSERT_EQUAL_INT(2, plan.slots);
+    TEST_ASSERT_EQUAL_STRING("heap", plan.limit);
+}
+
+static void test_heap_below_reserve_falls_back_to_min(void)
+{
+    plan.internal_free = 40000;
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_EQUAL_INT(0, plan.by_heap);
+    TEST_ASSERT_EQUAL_INT(1, plan.slots);
+    TEST_ASSERT_EQUAL_STRING("min", plan.limit);
+}
+
+static void test_largest_block_bound(void)
+{
+    plan.internal_free = 1000000;
+    plan.internal_largest = 3 * 8256 + 10;
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_EQUAL_INT(3, plan.by_block);
+    TEST_ASSERT_EQUAL_INT(3, plan.slots);
+    TEST_ASSERT_EQUAL_STRING("largest_block", plan.limit);
+}
+
+static void test_psram_moves_slots_out_of_internal_heap(void)
+{
+    plan.internal_free = 1000000;
+    plan.internal_largest = 4096;       // Too fragmented for a single internal slot
+    plan.psram_free = 4 * 1024 * 1024;
+    plan.psram_largest = 4 * 1024 * 1024;
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_TRUE(plan.buffers_in_psram);
+    TEST_ASSERT_EQUAL_UINT32((6656 + 12288) * 120 / 100, plan.conn_internal);
+    TEST_ASSERT_EQUAL_INT(4 * 1024 * 1024 / 8256, plan.by_block);
+}
+
+static void test_socket_bound_counts_services_and_pcbs(void)
+{
+    plan.internal_free = 1000000;
+    plan.internal_largest = 1000000;
+    // (32 - 3 in use - 4 services - 4 reserve) / 2 = 10 sockets-wise; PCBs: (32 - 20 - 1 - 4) / 2 = 3
+    plan.pcbs_used = 20;
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_EQUAL_INT(3, plan.by_sockets);
+    TEST_ASSERT_EQUAL_INT(3, plan.slots);
+    TEST_ASSERT_EQUAL_STRING("sockets", plan.limit);
+}
+
+static void test_exhausted_sockets_fall_back_to_min(void)
+{
+    plan.internal_free = 1000000;
+    plan.internal_largest = 1000000;
+    plan.sockets_used = 30;
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_TRUE(plan.by_sockets < 0);
+    TEST_ASSERT_EQUAL_INT(1, plan.slots);
+    TEST_ASSERT_EQUAL_STRING("min", plan.limit);
+}
+
+static void test_max_clients_when_nothing_binds(void)
+{
+    plan.internal_free = 1000000;
+    plan.internal_largest = 1000000;
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_EQUAL_INT(8, plan.slots);
+    TEST_ASSERT_EQUAL_STRING("max", plan.limit);
+}
+
+static void test_tightest_limit_wins(void)
+{
+    // Heap allows 5, block 4, sockets 10: the block limit binds
+    plan.internal_free = 65536 + 5 * 32640;
+    plan.internal_largest = 4 * 8256;
+    pool_plan_compute(&plan, &config);
+    TEST_ASSERT_EQUAL_INT(5, plan.by_heap);
+    TEST_ASSERT_EQUAL_INT(4, plan.by_block);
+    TEST_ASSERT_EQUAL_INT(10, plan.by_sockets);
+    TEST_ASSERT_EQUAL_INT(4, plan.slots);
+    TEST_ASSERT_EQUAL_STRING("largest_block", plan.limit);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_per_connection_costs);
+    RUN_TEST(test_heap_bound);
+    RUN_TEST(test_heap_below_reserve_falls_back_to_min);
+    RUN_TEST(test_largest_block_bound);
+    RUN_TEST(test_psram_moves_slots_out_of_internal_heap);
+    RUN_TEST(test_socket_bound_counts_services_and_pcbs);
+    RUN_TEST(test_exhausted_sockets_fall_back_to_min);
+    RUN_TEST(test_max_clients_when_nothing_binds);
+    RUN_TEST(test_tightest_limit_wins);
+    return UNITY_END();
+}
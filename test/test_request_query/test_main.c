@@ -0,0 +1,141 @@
+// Request log export / history query parsing (include/bridge_logic.h)
+#include <unity.h>
+#include "bridge_logic.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/** httpd_query_key_value() stand-in: "k=v&k=v", no URL decoding, truncates like the real one */
+static int query_value(const char *query, const char *key, char *value, size_t len)
+{
+    size_t key_len = strlen(key);
+    const char *p = query;
+    while (*p) {
+        const char *end = strchr(p, '&');
+        if (!end) end = p + strlen(p);
+        if ((size_t)(end - p) > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            const char *v = p + key_len + 1;
+            size_t n = (size_t)(end - v);
+            if (n >= len) n = len - 1;
+            memcpy(value, v, n);
+            value[n] = '\0';
+            return 0;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return -1;
+}
+
+// Defaults as the export handler sets them
+static request_filter_t filter;
+static int limit;
+static bool csv;
+
+static const char *parse(const char *query)
+{
+    memset(&filter, 0, sizeof(filter));
+    filter.result = -1;
+    limit = 100;
+    csv = false;
+    return parse_request_query(query_value, query, &filter, &limit, &csv);
+}
+
+static void test_empty_query_keeps_defaults(void)
+{
+    TEST_ASSERT_NULL(parse(""));
+    TEST_ASSERT_EQUAL_UINT32(0, filter.cursor);
+    TEST_ASSERT_EQUAL_INT64(0, filter.since);
+    TEST_ASSERT_EQUAL_STRING("", filter.ip);
+    TEST_ASSERT_EQUAL_INT(-1, filter.result);
+    TEST_ASSERT_EQUAL_UINT16(0, filter.min_ttfb);
+    TEST_ASSERT_EQUAL_INT(100, limit);
+    TEST_ASSERT_FALSE(csv);
+}
+
+static void test_all_fields(void)
+{
+    TEST_ASSERT_NULL(parse("format=csv&cursor=4294967295&limit=1000&since=120000&ip=192.168.1.20"
+                           "&result=timeout&min_ttfb=250"));
+    TEST_ASSERT_TRUE(csv);
+    TEST_ASSERT_EQUAL_UINT32(4294967295u, filter.cursor);
+    TEST_ASSERT_EQUAL_INT(1000, limit);
+    TEST_ASSERT_EQUAL_INT64(120000, filter.since);
+    TEST_ASSERT_EQUAL_STRING("192.168.1.20", filter.ip);
+    TEST_ASSERT_EQUAL_INT(1, filter.result);
+    TEST_ASSERT_EQUAL_UINT16(250, filter.min_ttfb);
+}
+
+static void test_result_names(void)
+{
+    TEST_ASSERT_NULL(parse("result=ok"));
+    TEST_ASSERT_EQUAL_INT(0, filter.result);
+    TEST_ASSERT_NULL(parse("result=error"));
+    TEST_ASSERT_EQUAL_INT(2, filter.result);
+    TEST_ASSERT_NOT_NULL(parse("result=fail"));
+    TEST_ASSERT_NOT_NULL(parse("result="));
+}
+
+static void test_ipv6_source_form(void)
+{
+    TEST_ASSERT_NULL(parse("ip=v6:1c9e03a7"));
+    TEST_ASSERT_EQUAL_STRING("v6:1c9e03a7", filter.ip);
+}
+
+static void test_format(void)
+{
+    TEST_ASSERT_NULL(parse("format=ndjson"));
+    TEST_ASSERT_FALSE(csv);
+    TEST_ASSERT_NOT_NULL(parse("format=json"));
+}
+
+static void test_limit_bounds(void)
+{
+    TEST_ASSERT_NULL(parse("limit=1"));
+    TEST_ASSERT_EQUAL_INT(1, limit);
+    TEST_ASSERT_NOT_NULL(parse("limit=0"));
+    TEST_ASSERT_NOT_NULL(parse("limit=1001"));
+    TEST_ASSERT_NOT_NULL(parse("limit=-5"));
+    TEST_ASSERT_NOT_NULL(parse("limit=ten"));
+}
+
+static void test_numbers_reject_junk_and_overflow(void)
+{
+    TEST_ASSERT_NOT_NULL(parse("cursor=-1"));
+    TEST_ASSERT_NOT_NULL(parse("cursor=4294967296"));
+    TEST_ASSERT_NOT_NULL(parse("cursor=12abc"));
+    TEST_ASSERT_NOT_NULL(parse("cursor="));
+    TEST_ASSERT_NOT_NULL(parse("since=-60"));
+    TEST_ASSERT_NOT_NULL(parse("min_ttfb=65536"));
+    TEST_ASSERT_NOT_NULL(parse("min_ttfb=-1"));
+    TEST_ASSERT_NULL(parse("min_ttfb=65535"));
+    TEST_ASSERT_EQUAL_UINT16(65535, filter.min_ttfb);
+}
+
+static void test_key_prefix_does_not_match(void)
+{
+    // "ip" must not pick up "ipx", nor "limit" pick up "limits"
+    TEST_ASSERT_NULL(parse("ipx=1.2.3.4&limits=5"));
+    TEST_ASSERT_EQUAL_STRING("", filter.ip);
+    TEST_ASSERT_EQUAL_INT(100, limit);
+}
+
+static void test_overlong_ip_is_truncated_not_overflowed(void)
+{
+    TEST_ASSERT_NULL(parse("ip=123.123.123.123.123.123"));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(filter.ip) - 1, strlen(filter.ip));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_query_keeps_defaults);
+    RUN_TEST(test_all_fields);
+    RUN_TEST(test_result_names);
+    RUN_TEST(test_ipv6_source_form);
+    RUN_TEST(test_format);
+    RUN_TEST(test_limit_bounds);
+    RUN_TEST(test_numbers_reject_junk_and_overflow);
+    RUN_TEST(test_key_prefix_does_not_match);
+    RUN_TEST(test_overlong_ip_is_truncated_not_overflowed);
+    return UNITY_END();
+}